@@ -28,9 +28,6 @@
 #include <iostream>
 #include <fstream>
 using namespace std;
-// HDAL
-#include <hdl/hdl.h>
-#include <hdlu/hdlu.h>
 #include <string>
 
 #include <cstdlib>
@@ -39,15 +36,31 @@ using namespace std;
 //---------------------------------------------------------------------------
 #include "chai3d.h"
 //---------------------------------------------------------------------------
+#if defined(_WIN32)
 #include <windows.h>
+#endif
+#include "servo_timer.h"
+#include "telemetry.h"
+#include "falcon_device.h"
+#include "falcon_kinematics.h"
+#include "teleop.h"
+#include "gravity_lut.h"
+#include "force_filter.h"
+#include "velocity_estimator.h"
+#include "seqlock.h"
+#include "command_queue.h"
+#include "coupling.h"
+#include "rt_profile.h"
+#include "transport.h"
+#include "delay_emulator.h"
+#include "tick_profile.h"
+#include "device_label.h"
+#include "input_trace.h"
+#include "freq_response.h"
 //---------------------------------------------------------------------------
 // DECLARED CONSTANTS
 //---------------------------------------------------------------------------
 
-double force[2][3];
-const int AVG = 5;
-double avg_force[2][3][AVG];
-double last_force[2][3];
 // initial size (width/height) in pixels of the display window
 const int WINDOW_SIZE_W         = 600;
 const int WINDOW_SIZE_H         = 600;
@@ -58,20 +71,125 @@ const int OPTION_WINDOWDISPLAY  = 2;
 
 // maximum number of haptic devices supported in this demo
 const int MAX_DEVICES           = 8;
+
+// samples per baza_RD.txt row with -compress: the packed logs hold them all
+const int COMPRESSED_RECORD_EVERY = 100;
+
+double force[MAX_DEVICES][3];
+double last_force[MAX_DEVICES][3];
 const double EndTime			= 3600;
 const double StartTime			= 1;
 
+// servo loop rate [Hz] and busy-wait tail [us], see -rate and -spin
+double ServoRate				= SERVO_DEFAULT_RATE;
+int ServoSpinUs					= SERVO_DEFAULT_SPIN_US;
+
+// echo every n-th telemetry sample to the console (0 = off), see -console
+int ConsoleEvery				= 100;
+
+// run against simulated devices instead of HDAL, see -sim and -devices
+bool UseSimulation				= false;
+int NumSimDevices				= 2;
+
+// advance time by exactly one servo period per tick, as fast as possible
+// (simulated devices only), see -virtual
+bool VirtualTime				= false;
+
+// no window or rendering, console status every StatusPeriod seconds
+// (0 = off), see -headless and -status
+bool Headless					= false;
+double StatusPeriod				= 1.0;
+
+// gravity compensation from a table with this many points per axis
+// (0 = off), cached in gravity_<n>.lut, see -gravity
+int GravityLutSize				= 0;
+
+// smoothing of the coupling force: type, window length or Butterworth
+// order, and biquad cutoff [Hz], see -filter and -cutoff
+int FilterType					= FILTER_NONE;
+int FilterOrder					= 5;
+double FilterCutoff				= 50.0;
+
+// grip velocity for the damping terms, see -velocity
+int VelocityType				= VELOCITY_DIFFERENCE;
+
+// who is coupled to whom, and the edges of COUPLING_EDGES, see -coupling
+int CouplingTopology			= COUPLING_STAR;
+const char* CouplingEdges		= NULL;
+
+// this process drives only device LocalSide (0 or 1, -1 = both) and
+// exchanges state with the process driving the other one, over shared
+// memory or UDP, see -side, -shm and -udp
+int LocalSide					= -1;
+const char* ShmName				= NULL;
+int UdpLocalPort				= 0;
+const char* UdpHost				= NULL;
+int UdpPort						= 0;
+
+// graphics frame rate cap [Hz], 0 = redraw as fast as possible, see -fps
+double FrameRate				= 60.0;
+
+// emulated channel between the devices: one-way delay and Gaussian
+// jitter [ms] or a jitter trace file, loss and reordering [%] and the
+// hold of a reordered sample [ms]; on when any of them is given, see
+// -delay, -jitter, -loss and -reorder
+bool UseDelay					= false;
+double DelayMs					= 0;
+double JitterMs					= 0;
+const char* JitterTrace			= NULL;
+double LossPercent				= 0;
+double ReorderPercent			= 0;
+double ReorderMs				= 0;
+
+// real-time setup of the process and the servo thread, see -rt
+bool UseRtProfile				= false;
+RtProfile rtProfile;
+
+// compressed binary logs and their precision: time [s], position [m],
+// velocity [m/s], force [N] and position error [m], see -compress
+bool CompressLogs				= false;
+BinLogPrecision LogPrecision	= { 1e-9, 1e-6, 1e-5, 1e-4, 1e-6 };
+
+// write every n-th sample of a device to baza_RD.txt, see -record-every;
+// 0 = all of them, or 1 in COMPRESSED_RECORD_EVERY with -compress
+int RecordEvery					= 0;
+
+// input trace of the session to write, or to play back instead of the
+// devices, see -record and -replay
+const char* RecordPath			= NULL;
+const char* ReplayPath			= NULL;
+
+// summary of the frequency response of every sweep step, see -response;
+// with -nolog it is the only output of a sweep
+const char* ResponsePath		= "sweep_response.txt";
+
 
 //---------------------------------------------------------------------------
 // DECLARED VARIABLES
 //---------------------------------------------------------------------------
-// Handle to device
-HDLDeviceHandle deviceHandle[MAX_DEVICES];
+// real (HDAL) or simulated devices
+FalconBackend* backend;
+
+// the same backend when it is simulated, NULL otherwise
+SimFalconBackend* simBackend = NULL;
+
+// the same backend when a trace is replayed, NULL otherwise
+ReplayBackend* replayBackend = NULL;
+
+// deadline scheduler of the haptic loop, also the experiment clock
+ServoTimer servoTimer;
 
-// Handle to Contact Callback
-HDLServoOpExitCode servoOp;
+// time spent in each phase of the servo tick, printed with [h] and at exit
+TickProfile tickProfile;
 
-cPrecisionClock* clock;
+// tabulated gravity compensation (when GravityLutSize > 0)
+GravityLut gravityLut;
+
+// filters of the coupling force, channel = device * 3 + HDAL axis
+ForceFilterBank forceFilter;
+
+// velocity of the grips from their timestamped positions
+VelocityEstimatorBank velocityEstimator;
 
 // a world that contains all objects of the virtual environment
 cWorld* world;
@@ -109,6 +227,16 @@ cGenericHapticDevice* hapticDevices[MAX_DEVICES];
 cLabel* labels[MAX_DEVICES];
 cGenericObject* rootLabels;
 
+// text of those labels, formatted only when a shown value changes
+DeviceLabel deviceLabels[MAX_DEVICES];
+
+// frames drawn and the time of the first one, for the frame rate at exit
+long long framesDrawn = 0;
+long long firstFrameNs = 0;
+
+// a frameTimer() call is pending
+bool frameScheduled = false;
+
 // number of haptic devices detected
 int numHapticDevices = 0;
 
@@ -137,28 +265,82 @@ bool useForceField = false;
 // has exited haptics simulation thread
 bool simulationFinished = false;
 
+// full-rate samples: binary logs, record file and console, see -nolog
 bool write_to_file = true;
 
-bool EnableHaptics = true;
+// HDAL tool position axis stored as x, y, z (see updateHaptics)
+const int AXIS_MAP[3] = {2, 0, 1};
 
+bool EnableHaptics = true;
 
-ofstream output[MAX_DEVICES];
 
 struct HapticDevice
 {
-    HDLDeviceHandle handle;
-    double workspaceDims[6];
-    cVector3d pos;
-	cVector3d vel;
 	double time;
-	cVector3d error; //Distance from desired trajectory
-    double transformMat[16];
     cVector3d force;
-    bool   button;
-	char* devicename;
+	char devicename[20];
+};
+
+HapticDevice hd[MAX_DEVICES];
+
+// coupling graph over the devices and the state it reads each tick:
+// position, velocity and integrated error of every device
+CouplingGraph couplingGraph;
+CouplingState coupled;
+
+// what the real-time setup was granted; the servo thread fills in its
+// part and then sets rtServoReady
+RtReport rtReport;
+std::atomic<bool> rtServoReady(false);
+
+// page faults the servo thread took while it was running
+long long rtServoFaults = -1;
+
+// link to the process driving the other device (NULL = both local), and
+// its latency figures as of the last tick
+Transport* transport = NULL;
+Seqlock<TransportStats> linkStats;
+
+// the emulated channel (with UseDelay) and the state of every device as
+// the coupling sees it at the far end of it
+DelayEmulator delayEmulator;
+CouplingState delayed;
+
+// state of a device as published by the servo loop once per tick
+struct DeviceSnapshot
+{
+    long long tick;             // servo tick of the sample
+    double    time;             // experiment time [s]
+    double    pos[3];           // position [m]
+    double    vel[3];           // velocity [m/s]
+    double    force[3];         // commanded force [N], application axes
+    double    Kp, Kd, Ki;       // gains in effect at this tick
+    FreqResponse response;      // of the sweep step so far
+};
+
+// read by the graphics and status output without locking the servo loop
+Seqlock<DeviceSnapshot> snapshots[MAX_DEVICES];
+
+// counters of the servo loop as published once per tick
+struct ServoStatus
+{
+    long long ticks;            // servo ticks so far
+    long long overruns;         // ticks that missed their deadline
+    double    time;             // experiment time of the last tick [s]
+    int       freq;             // sweep step (Freq_count)
 };
 
-HapticDevice hd[2];
+// the status output and the graphics read these, never servoTimer or
+// Freq_count themselves
+Seqlock<ServoStatus> servoStatus;
+
+// sweep step whose log the rotator of a device refused to prepare (still
+// busy with the previous one), retried every tick; -1 = none
+int prepareRetry[MAX_DEVICES];
+
+// running response of every device at the current sweep frequency,
+// servo thread only; copied into the snapshots
+FreqResponse responses[MAX_DEVICES];
 
 //---------------------------------------------------------------------------
 // DECLARED MACROS
@@ -186,15 +368,55 @@ void close(void);
 // main graphics callback
 void updateGraphics(void);
 
+// next frame of the capped frame rate, see -fps
+void frameTimer(int value);
+
 // main haptics loop
 void updateHaptics(void);
+
+// apply the parameter changes posted by keySelect()
+void applyCommands(long long tick, double time);
+
+// apply one parameter change and log it
+void applyParam(long long tick, double time, const ParamCommand& command);
+
+// the variable behind a parameter, either a value or a flag; false for
+// an unknown parameter
+bool paramVariable(int param, double** value, bool** flag);
+
+// true if device i is driven by this process
+bool isLocal(int i);
+
+// backend index of device i: with a link, a real backend only has the
+// local Falcon
+int backendIndex(int i);
+
+// take the newest state of the remote device from the link
+void receiveRemote(void);
+
+// clock of the emulated channel [s]; in virtual time it follows the ticks
+double delayClock(void);
+
+// scene, device cursors and GLUT window (not used in headless mode)
+void initScene(void);
+void initCursor(int i);
+void initWindow(int argc, char* argv[]);
+
+// wait for the end of the sweep, printing a status line now and then
+void runHeadless(void);
+
+// report the frequency and output files of a sweep step
+void printSweepStep(int freq);
+
+// binary log file of a device for the current sweep frequency
+void log_file_name(int device, int freq, char* path, int size);
+void open_device_logs(long long tick);
+// create a sweep step's binary logs ahead of the switch to them
+void prepare_device_logs(int freq);
+void prepare_device_log(int device, int freq);
+void retry_device_logs(void);
 double zaokraglanie(double x);
-int empty_avg_force();
-double calc_avg_force(int which_falcon, int which_axis,double last_force);
-void print_avg_force();
 
-cVector3d gravity_compensate(cVector3d);
-FILE *plik;
 //===========================================================================
 /*
     DEMO:    device.cpp
@@ -219,7 +441,10 @@ FILE *plik;
 
 int main(int argc, char* argv[])
 {
-	plik=fopen("baza_RD.txt", "w"); 
+	double Freqmin;
+	double Freqmax;
+	bool FreqGiven = false;
+	rt_profile_defaults(&rtProfile);
 
     //-----------------------------------------------------------------------
     // INITIALIZATION
@@ -235,85 +460,277 @@ int main(int argc, char* argv[])
     printf ("Keyboard Options:\n\n");
     printf ("[1] - Render attraction force\n");
     printf ("[2] - Render viscous environment\n");
+    printf ("[h] - Print the servo phase histograms\n");
     printf ("[x] - Exit application\n");
     printf ("\n\n");
+    printf ("Command line options:\n\n");
+    printf ("-rate <Hz>   - Servo loop rate (default %.0f)\n", SERVO_DEFAULT_RATE);
+    printf ("-spin <us>   - Busy-wait tail before each servo tick (default %d)\n", SERVO_DEFAULT_SPIN_US);
+    printf ("-console <n> - Print every n-th servo sample, 0 = off (default %d)\n", ConsoleEvery);
+    printf ("-sim         - Use simulated Falcons instead of HDAL\n");
+    printf ("-devices <n> - Number of simulated Falcons (default %d)\n", NumSimDevices);
+    printf ("-coupling <star|ring|all> - Coupling of more than two devices (default star)\n");
+    printf ("-coupling edges <i-j:w,...> - Explicit weighted coupling edges\n");
+    printf ("-headless    - No window, coupling on, the servo loop runs the sweep\n");
+    printf ("-virtual     - Virtual time: run the simulation as fast as possible\n");
+    printf ("-fps <Hz>    - Graphics frame rate cap, 0 = uncapped (default %.0f)\n", FrameRate);
+    printf ("-status <s>  - Headless status line period, 0 = off (default %.0f)\n", StatusPeriod);
+    printf ("-gravity <n> - Gravity compensation from an n^3 table, 0 = off (default %d)\n", GravityLutSize);
+    printf ("-filter <type> <n> - Force filter none|avg|biquad|median and its order (default none)\n");
+    printf ("-cutoff <Hz> - Biquad filter cutoff (default %.0f)\n", FilterCutoff);
+    printf ("-velocity <type> - Velocity estimator diff|foaw|kalman|levant (default diff)\n");
+    printf ("-side <0|1>  - Drive only this device, the other one runs in another process\n");
+    printf ("-shm <name>  - Link to the other side over shared memory (with -side)\n");
+    printf ("-udp <port> <host> <port> - Link to the other side over UDP (with -side)\n");
+    printf ("-delay <ms>  - Emulated one-way delay between the devices\n");
+    printf ("-jitter <ms> - Emulated Gaussian jitter (standard deviation)\n");
+    printf ("-jitter trace <file> - Emulated jitter from a file of delays [ms]\n");
+    printf ("-loss <%%>    - Emulated sample loss\n");
+    printf ("-reorder <%%> <ms> - Emulated reordering: samples held back this long\n");
+    printf ("-rt          - Real-time profile: FIFO priority, CPU pinning, locked memory\n");
+    printf ("-rtprio <n>  - Servo thread FIFO priority with -rt (default %d)\n", RT_DEFAULT_PRIORITY);
+    printf ("-rtcpu <n>   - Servo thread CPU with -rt (default last CPU)\n");
+    printf ("-prefault <KB> - Heap to pre-fault with -rt (default %d)\n", RT_DEFAULT_HEAP_KB);
+    printf ("-compress    - Compress the binary logs, 1 in %d samples to baza_RD.txt\n",
+            COMPRESSED_RECORD_EVERY);
+    printf ("-record-every <n> - Write every n-th sample to baza_RD.txt (default 1)\n");
+    printf ("-precision <pos> <vel> <force> <error> - Compressed log resolution (default %g %g %g %g)\n",
+            LogPrecision.pos, LogPrecision.vel, LogPrecision.force, LogPrecision.error);
+    printf ("-record <file> - Record the device input and parameter changes to a trace\n");
+    printf ("-replay <file> - Replay a trace instead of the devices, in virtual time\n");
+    printf ("-response <file> - Frequency response summary of each step (default %s)\n", ResponsePath);
+    printf ("-nolog       - No full-rate logs, only the response summary\n");
+    printf ("-freq <min> <max> - Sweep frequency range [Hz], skips the prompt\n");
+    printf ("\n\n");
 
     // parse first arg to try and locate resources
     resourceRoot = string(argv[0]).substr(0,string(argv[0]).find_last_of("/\\")+1);
 
+    // parse remaining options
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-rate") == 0 && a+1 < argc)
+            ServoRate = atof(argv[++a]);
+        else if (strcmp(argv[a], "-spin") == 0 && a+1 < argc)
+            ServoSpinUs = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-console") == 0 && a+1 < argc)
+            ConsoleEvery = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-sim") == 0)
+            UseSimulation = true;
+        else if (strcmp(argv[a], "-devices") == 0 && a+1 < argc)
+            NumSimDevices = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-coupling") == 0 && a+1 < argc)
+        {
+            CouplingTopology = coupling_topology(argv[++a]);
+            if (CouplingTopology == COUPLING_EDGES && a+1 < argc)
+                CouplingEdges = argv[++a];
+        }
+        else if (strcmp(argv[a], "-headless") == 0)
+            Headless = true;
+        else if (strcmp(argv[a], "-virtual") == 0)
+            VirtualTime = true;
+        else if (strcmp(argv[a], "-freq") == 0 && a+2 < argc)
+        {
+            Freqmin = atof(argv[++a]);
+            Freqmax = atof(argv[++a]);
+            FreqGiven = true;
+        }
+        else if (strcmp(argv[a], "-fps") == 0 && a+1 < argc)
+            FrameRate = atof(argv[++a]);
+        else if (strcmp(argv[a], "-status") == 0 && a+1 < argc)
+            StatusPeriod = atof(argv[++a]);
+        else if (strcmp(argv[a], "-gravity") == 0 && a+1 < argc)
+            GravityLutSize = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-filter") == 0 && a+2 < argc)
+        {
+            FilterType = force_filter_type(argv[++a]);
+            FilterOrder = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-cutoff") == 0 && a+1 < argc)
+            FilterCutoff = atof(argv[++a]);
+        else if (strcmp(argv[a], "-velocity") == 0 && a+1 < argc)
+            VelocityType = velocity_type(argv[++a]);
+        else if (strcmp(argv[a], "-side") == 0 && a+1 < argc)
+            LocalSide = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-shm") == 0 && a+1 < argc)
+            ShmName = argv[++a];
+        else if (strcmp(argv[a], "-udp") == 0 && a+3 < argc)
+        {
+            UdpLocalPort = atoi(argv[++a]);
+            UdpHost = argv[++a];
+            UdpPort = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-delay") == 0 && a+1 < argc)
+        {
+            DelayMs = atof(argv[++a]);
+            UseDelay = true;
+        }
+        else if (strcmp(argv[a], "-jitter") == 0 && a+1 < argc)
+        {
+            if (strcmp(argv[++a], "trace") == 0 && a+1 < argc)
+                JitterTrace = argv[++a];
+            else
+                JitterMs = atof(argv[a]);
+            UseDelay = true;
+        }
+        else if (strcmp(argv[a], "-loss") == 0 && a+1 < argc)
+        {
+            LossPercent = atof(argv[++a]);
+            UseDelay = true;
+        }
+        else if (strcmp(argv[a], "-reorder") == 0 && a+2 < argc)
+        {
+            ReorderPercent = atof(argv[++a]);
+            ReorderMs = atof(argv[++a]);
+            UseDelay = true;
+        }
+        else if (strcmp(argv[a], "-rt") == 0)
+            UseRtProfile = true;
+        else if (strcmp(argv[a], "-rtprio") == 0 && a+1 < argc)
+            rtProfile.priority = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-rtcpu") == 0 && a+1 < argc)
+            rtProfile.servoCpu = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-prefault") == 0 && a+1 < argc)
+            rtProfile.heapKb = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-compress") == 0)
+            CompressLogs = true;
+        else if (strcmp(argv[a], "-record-every") == 0 && a+1 < argc)
+            RecordEvery = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-precision") == 0 && a+4 < argc)
+        {
+            LogPrecision.pos   = atof(argv[++a]);
+            LogPrecision.vel   = atof(argv[++a]);
+            LogPrecision.force = atof(argv[++a]);
+            LogPrecision.error = atof(argv[++a]);
+            CompressLogs = true;
+        }
+        else if (strcmp(argv[a], "-record") == 0 && a+1 < argc)
+            RecordPath = argv[++a];
+        else if (strcmp(argv[a], "-replay") == 0 && a+1 < argc)
+            ReplayPath = argv[++a];
+        else if (strcmp(argv[a], "-response") == 0 && a+1 < argc)
+            ResponsePath = argv[++a];
+        else if (strcmp(argv[a], "-nolog") == 0)
+            write_to_file = false;
+    }
 
-    //-----------------------------------------------------------------------
-    // 3D - SCENEGRAPH
-    //-----------------------------------------------------------------------
+    // a replay runs the recorded session again, at its rate and sweep and
+    // as fast as the loop goes
+    if (ReplayPath != NULL)
+    {
+        replayBackend = new ReplayBackend();
+        if (!replayBackend->load(ReplayPath))
+        {
+            printf ("Could not read the input trace %s\n", ReplayPath);
+            exit(1);
+        }
+        const InputTraceHeader& trace = replayBackend->header();
+        ServoRate = trace.servoRate;
+        Freqmin = trace.freqMin;
+        Freqmax = trace.freqMax;
+        FreqGiven = true;
+        VirtualTime = true;
+        printf ("Replaying %s: %d devices at %.0f Hz\n", ReplayPath, trace.numDevices, trace.servoRate);
+    }
+    if (ServoRate < 1000 || ServoRate > 4000)
+        printf ("Warning: servo rate %.0f Hz is outside the 1-4 kHz range\n", ServoRate);
 
-	clock = new cPrecisionClock();
+    // there is no keyboard to switch the coupling on without a window
+    if (Headless)
+        useForceField = true;
 
+    // a trace has the input of every device, one process replays it all
+    if ((ReplayPath != NULL || RecordPath != NULL) && LocalSide >= 0)
+    {
+        printf ("-record and -replay cannot be used with -side\n");
+        exit(1);
+    }
 
-    // create a new world.
-    world = new cWorld();
+    // real devices cannot follow a virtual clock
+    if (VirtualTime && !UseSimulation && replayBackend == NULL)
+    {
+        printf ("-virtual requires -sim\n");
+        exit(1);
+    }
 
-    // set the background color of the environment
-    // the color is defined by its (R,G,B) components.
-    world->setBackgroundColor(0.0, 0.0, 0.0);
+    // a split session needs a side and exactly one link; the two sides
+    // run on their own clocks, so they cannot use virtual time
+    if (LocalSide >= 0 || ShmName != NULL || UdpHost != NULL)
+    {
+        if ((LocalSide != 0 && LocalSide != 1) || (ShmName != NULL) == (UdpHost != NULL))
+        {
+            printf ("A split session needs -side 0|1 and one of -shm or -udp\n");
+            exit(1);
+        }
+        if (VirtualTime)
+        {
+            printf ("-virtual cannot be used with -side\n");
+            exit(1);
+        }
+        transport = (ShmName != NULL) ? transport_create_shm(ShmName, LocalSide)
+                                      : transport_create_udp(UdpLocalPort, UdpHost, UdpPort);
+        if (transport == NULL)
+        {
+            printf ("Could not open the %s link\n", (ShmName != NULL) ? "shared memory" : "UDP");
+            exit(1);
+        }
+        printf ("Link: %s, this process drives device %d\n", transport->getName(), LocalSide);
+    }
 
-    // create a camera and insert it into the virtual world
-    camera = new cCamera(world);
-    world->addChild(camera);
+    // load or build the gravity table before anything runs at servo rate
+    if (GravityLutSize > 0)
+    {
+        char lutPath[64];
+        snprintf(lutPath, sizeof(lutPath), "gravity_%d.lut", GravityLutSize);
+        if (!gravity_lut_init(&gravityLut, GravityLutSize, lutPath))
+        {
+            printf ("Could not build the gravity table\n");
+            exit(1);
+        }
+        printf ("Gravity table %d^3: error max %.4f N, p99 %.4f N, rms %.4f N\n",
+                GravityLutSize, gravityLut.maxError, gravityLut.p99Error, gravityLut.rmsError);
+    }
 
-    // position and oriente the camera
-    camera->set( cVector3d (0.5, 0.0, 0.0),    // camera position (eye)
-                 cVector3d (0.0, 0.0, 0.0),    // lookat position (target)
-                 cVector3d (0.0, 0.0, 1.0));   // direction of the "up" vector
+    // the filter delay adds to the coupling latency
+    if (!force_filter_init(&forceFilter, FilterType, FilterOrder, FilterCutoff, ServoRate, 3 * MAX_DEVICES))
+    {
+        printf ("Invalid force filter, see -filter and -cutoff\n");
+        exit(1);
+    }
+    if (FilterType != FILTER_NONE)
+    {
+        printf ("Force filter %s, order %d: group delay %.2f ms\n",
+                force_filter_name(FilterType), FilterOrder, force_filter_group_delay(&forceFilter) * 1000.0);
+    }
 
-    // set the near and far clipping planes of the camera
-    // anything in front/behind these clipping planes will not be rendered
-    camera->setClippingPlanes(0.01, 10.0);
+    if (!velocity_init(&velocityEstimator, VelocityType, MAX_DEVICES))
+    {
+        printf ("Invalid velocity estimator, see -velocity\n");
+        exit(1);
+    }
 
-    // create a light source and attach it to the camera
-    light = new cLight(world);
-    camera->addChild(light);                   // attach light to camera
-    light->setEnabled(true);                   // enable light source
-    light->setPos(cVector3d( 2.0, 0.5, 1.0));  // position the light source
-    light->setDir(cVector3d(-2.0, 0.5, 1.0));  // define the direction of the light beam
+    if (CompressLogs && !(LogPrecision.pos > 0 && LogPrecision.vel > 0 &&
+                          LogPrecision.force > 0 && LogPrecision.error > 0))
+    {
+        printf ("Invalid log precision, see -precision\n");
+        exit(1);
+    }
+    if (RecordEvery <= 0)
+    {
+        RecordEvery = CompressLogs ? COMPRESSED_RECORD_EVERY : 1;
+    }
 
 
     //-----------------------------------------------------------------------
-    // 2D - WIDGETS
+    // 3D - SCENEGRAPH
     //-----------------------------------------------------------------------
 
-    // create a 2D bitmap logo
-    logo = new cBitmap();
-
-    // add logo to the front plane
-    camera->m_front_2Dscene.addChild(logo);
-
-    // load a "chai3d" bitmap image file
-    bool fileload;
-    fileload = logo->m_image.loadFromFile(RESOURCE_PATH("resources/images/chai3d.bmp"));
-    if (!fileload)
+    // no scene, window or GL context in headless mode
+    if (!Headless)
     {
-        #if defined(_MSVC)
-        fileload = logo->m_image.loadFromFile("../../../bin/resources/images/chai3d.bmp");
-        #endif
+        initScene();
     }
 
-    // position the logo at the bottom left of the screen (pixel coordinates)
-    logo->setPos(10, 10, 0);
-
-    // scale the logo along its horizontal and vertical axis
-    logo->setZoomHV(0.4, 0.4);
-
-    // here we replace all black pixels (0,0,0) of the logo bitmap
-    // with transparent black pixels (0, 0, 0, 0). This allows us to make
-    // the background of the logo look transparent.
-    logo->m_image.replace(
-                          cColorb(0, 0, 0),      // original RGB color
-                          cColorb(0, 0, 0, 0)    // new RGBA color
-                          );
-
-    // enable transparency
-    logo->enableTransparency(true);
-
 
     //-----------------------------------------------------------------------
     // HAPTIC DEVICES / TOOLS
@@ -322,46 +739,101 @@ int main(int argc, char* argv[])
     // create a haptic device handler
     //handler = new cHapticDeviceHandler();
 
+    // select real or simulated devices
+    if (replayBackend != NULL)
+    {
+        backend = replayBackend;
+    }
+    else if (UseSimulation)
+    {
+        simBackend = new SimFalconBackend(cMin(cMax(NumSimDevices, 1), MAX_DEVICES));
+        backend = simBackend;
+    }
+    else
+    {
+        backend = falcon_create_hdal_backend();
+        if (backend == NULL)
+        {
+            std::cout << "HDAL is not available in this build, use -sim" << std::endl;
+            exit(1);
+        }
+    }
+    std::cout << "Device backend: " << backend->getName() << std::endl;
+
     // read the number of haptic devices currently connected to the computer
     //numHapticDevices = handler->getNumDevices();
-	numHapticDevices = hdlCountDevices();
+	numHapticDevices = backend->getNumDevices();
 
-    // limit the number of devices to MAX_DEVICES
+    // limit the number of devices to MAX_DEVICES; a split session is
+    // always the pair, one device on each side
     numHapticDevices = cMin(numHapticDevices, MAX_DEVICES);
+    if (transport != NULL)
+    {
+        numHapticDevices = 2;
+    }
 
-	empty_avg_force();
-	//print_avg_force();
-
-	hd[0].devicename = "FALCON_1";
-	hd[1].devicename = "FALCON_2";
-
-    // create a node on which we will attach small labels that display the
-    // position of each haptic device
-    rootLabels = new cGenericObject();
-    camera->m_front_2Dscene.addChild(rootLabels);
+    for (int j = 0; j < numHapticDevices; j++)
+    {
+        snprintf(hd[j].devicename, sizeof(hd[j].devicename), "FALCON_%d", j + 1);
+    }
 
-    // create a small label as title
-    cLabel* titleLabel = new cLabel();
-    rootLabels->addChild(titleLabel);
+    // coupling between the devices
+    bool couplingValid = (CouplingTopology == COUPLING_EDGES)
+        ? (CouplingEdges != NULL && coupling_parse(&couplingGraph, CouplingEdges, numHapticDevices))
+        : coupling_init(&couplingGraph, CouplingTopology, numHapticDevices);
+    if (!couplingValid)
+    {
+        printf ("Invalid coupling, see -coupling\n");
+        exit(1);
+    }
+    if (numHapticDevices > 2 || CouplingTopology == COUPLING_EDGES)
+    {
+        coupling_print(&couplingGraph);
+    }
 
-    // define its position, color and string message
-    titleLabel->setPos(0, 30, 0);
-    titleLabel->m_fontColor.set(1.0, 1.0, 1.0);
-    titleLabel->m_string = "Haptic Device Pos [mm]:";
+    // emulated channel between the devices
+    if (UseDelay)
+    {
+        if (!delay_init(&delayEmulator, numHapticDevices, DelayMs / 1000.0) ||
+            JitterMs < 0 || ReorderMs < 0 ||
+            LossPercent < 0 || LossPercent >= 100 || ReorderPercent < 0 || ReorderPercent > 100)
+        {
+            printf ("Invalid delay emulation, see -delay, -jitter, -loss and -reorder\n");
+            exit(1);
+        }
+        if (JitterTrace != NULL)
+        {
+            if (!delay_load_trace(&delayEmulator, JitterTrace))
+            {
+                printf ("Could not read the jitter trace %s\n", JitterTrace);
+                exit(1);
+            }
+        }
+        else if (JitterMs > 0)
+        {
+            delayEmulator.jitterType = DELAY_JITTER_GAUSS;
+            delayEmulator.jitter = JitterMs / 1000.0;
+        }
+        delayEmulator.lossRate = LossPercent / 100.0;
+        delayEmulator.reorderRate = ReorderPercent / 100.0;
+        delayEmulator.reorderHold = ReorderMs / 1000.0;
+        delay_print_config(&delayEmulator, stdout);
+    }
 
     // for each available haptic device, create a 3D cursor
     // and a small line to show velocity
     int i = 0;
 	std::cout << "Number of devices: " <<numHapticDevices <<std::endl;
 
-	double Freqmin;
-	double Freqmax;
-
-	cout<<"Enter the input frequency range"<<endl;
-	cout<<"Min: ";
-	cin>>Freqmin;
-	cout<<"Max: ";
-	cin>>Freqmax;
+	// ask for the frequency range unless it was given with -freq
+	if (!FreqGiven)
+	{
+		cout<<"Enter the input frequency range"<<endl;
+		cout<<"Min: ";
+		cin>>Freqmin;
+		cout<<"Max: ";
+		cin>>Freqmax;
+	}
 
 	Freq[0] = Freqmin;
 	for(int i = 1; i < MAX_FREQ_NUM; i++)
@@ -387,17 +859,18 @@ int main(int argc, char* argv[])
 				break;
 		}*/
 		//hd[i].handle = hdlInitNamedDevice(hd[i].devicename);
-		hd[i].handle = hdlInitIndexedDevice(i);
 
 		// Init device data
-		hd[i].pos.zero();
-		hd[i].vel.zero();
-		hd[i].error.zero();
+		coupled.pos[i].zero();
+		coupled.vel[i].zero();
+		coupled.integral[i].zero();
+		delayed.pos[i].zero();
+		delayed.vel[i].zero();
 		hd[i].time = 0;
 
-		if (hd[i].handle == HDL_INVALID_HANDLE)
+		if (isLocal(i) && !backend->open(backendIndex(i)))
 		{
-			std::cout << "Could not open device: HDL_INVALID_HANDLE" << std::endl;
+			std::cout << "Could not open device " << i << std::endl;
 			exit(1);
 		}
 
@@ -413,79 +886,221 @@ int main(int argc, char* argv[])
         // retrieve information about the current haptic device
         //cHapticDeviceInfo info = newHapticDevice->getSpecifications();
 
-        // create a cursor by setting its radius
-        cShapeSphere* newCursor = new cShapeSphere(0.000000001);
+        // create a cursor, a velocity line and labels for the device
+        if (!Headless)
+        {
+            initCursor(i);
+        }
 
-        // add cursor to the world
-        world->addChild(newCursor);
+        // increment counter
+        i++;
+    }
 
-        // add cursor to the cursor table
-        cursors[i] = newCursor;
+	// starts servo and all haptic devices.
+	std::cout << "Starting devices" << std::endl;
+	backend->start();
 
-        // create a small line to illustrate velocity
-        cShapeLine* newLine = new cShapeLine(cVector3d(0,0,0), cVector3d(0,0,0));
-        velocityVectors[i] = newLine;
+	// sets callback for the nonblocking servo loop
+	//std::cout << "HDAL: hdlCreateServoOp" << std::endl;
+	//hdlCreateServoOp(NonBlockingServoOpCallback, NULL, bNonBlocking);
 
-        // add line to the world
-        world->addChild(newLine);
+	// make a specific haptic device current
 
-        // create a string that concatenates the device number and model name.
-        string strID;
-        cStr(strID, i);
-        string strDevice = "#" + strID + " - ";
+    //-----------------------------------------------------------------------
+    // OPEN GL - WINDOW DISPLAY
+    //-----------------------------------------------------------------------
 
-        // attach a small label next to the cursor to indicate device information
-        cLabel* newLabel = new cLabel();
-        newCursor->addChild(newLabel);
-        newLabel->m_string = strDevice;
-        newLabel->setPos(0.00, 0.02, 0.00);
-        newLabel->m_fontColor.set(1.0, 1.0, 1.0);
+    if (!Headless)
+    {
+        initWindow(argc, argv);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // START SIMULATION
+    //-----------------------------------------------------------------------
 
-        // if the device provided orientation sensing (stylus), a reference
-        // frame is displayed
-        /*if (info.m_sensedRotation == true)
+    // lock and pre-fault memory and keep this thread, and every thread
+    // started from here on, off the servo CPU
+    if (UseRtProfile)
+    {
+        rt_process_setup(&rtProfile, &rtReport);
+    }
+
+    // start the telemetry writer before the servo loop produces records
+    if (!telemetry_start("baza_RD.txt", numHapticDevices, RecordEvery, ConsoleEvery, VirtualTime,
+                         CompressLogs ? &LogPrecision : NULL))
+    {
+        printf ("Could not start the telemetry writer (baza_RD.txt)\n");
+        exit(1);
+    }
+    if (write_to_file)
+    {
+        // the first files exist before the loop switches to them
+        prepare_device_logs(0);
+        telemetry_wait_prepared();
+    }
+
+    // gains and modes as the recorded session started, or as this one does
+    if (replayBackend != NULL)
+    {
+        for (int p = 0; p < PARAM_COUNT; p++)
+        {
+            double* value;
+            bool* flag;
+            if (!paramVariable(p, &value, &flag)) continue;
+            if (value != NULL)
+                *value = replayBackend->header().params[p];
+            else
+                *flag = (replayBackend->header().params[p] != 0);
+        }
+    }
+    if (RecordPath != NULL)
+    {
+        InputTraceHeader trace;
+        input_trace_init_header(&trace, numHapticDevices, ServoRate, Freqmin, Freqmax);
+        for (int p = 0; p < PARAM_COUNT; p++)
+        {
+            double* value;
+            bool* flag;
+            if (!paramVariable(p, &value, &flag)) continue;
+            trace.params[p] = (value != NULL) ? *value : (*flag ? 1.0 : 0.0);
+        }
+        if (!telemetry_start_trace(RecordPath, trace))
         {
-            // display a reference frame
-            newCursor->setShowFrame(true);
+            printf ("Could not create the input trace %s\n", RecordPath);
+            exit(1);
+        }
+    }
 
-            // set the size of the reference frame
-            newCursor->setFrameSize(0.05, 0.05);
-        }*/
+    // one line per device and sweep step
+    if (!telemetry_start_response(ResponsePath))
+    {
+        printf ("Could not create the response summary %s\n", ResponsePath);
+        exit(1);
+    }
 
-        // crate a small label to indicate the position of the device
-        cLabel* newPosLabel = new cLabel();
-        rootLabels->addChild(newPosLabel);
-        newPosLabel->setPos(0, -20 * i, 0);
-        newPosLabel->m_fontColor.set(0.6, 0.6, 0.6);
-        labels[i] = newPosLabel;
+    // simulation in now running, start the experiment clock
+    simulationRunning = true;
+    servo_timer_init(&servoTimer, ServoRate, ServoSpinUs, VirtualTime);
+    profile_init(&tickProfile, numHapticDevices, ServoRate, !VirtualTime);
 
+    // create a thread which starts the main haptics rendering loop
+    cThread* hapticsThread = new cThread();
+    hapticsThread->set(updateHaptics, CHAI_THREAD_PRIORITY_HAPTICS);
 
-		string strLabel = "H:\\plik_";
-		strLabel += hd[i].devicename;
-		strLabel += "\\f";
+    // report the real-time setup once the servo thread has done its part
+    if (UseRtProfile)
+    {
+        while (!rtServoReady) { cSleepMs(1); }
+        rt_print_report(&rtReport, stdout);
+    }
 
-		cStr(strLabel, Freq[Freq_count], 2);
+    // start the main graphics rendering loop, or just wait for the sweep
+    // to finish when there is no display
+    if (Headless)
+    {
+        runHeadless();
+    }
+    else
+    {
+        glutMainLoop();
+    }
 
-		strLabel += ".txt";
-		const char * c = strLabel.c_str();
+    // close everything
+    close();
 
-		if (write_to_file)
-			cout<<"Output file name is: "<<strLabel<<endl;
+    // exit
+    return (0);
+}
 
-		output[i].open (c);
-        // increment counter
-        i++;
+//---------------------------------------------------------------------------
+
+void initScene(void)
+{
+    //-----------------------------------------------------------------------
+    // 3D - SCENEGRAPH
+    //-----------------------------------------------------------------------
+
+    // create a new world.
+    world = new cWorld();
+
+    // set the background color of the environment
+    // the color is defined by its (R,G,B) components.
+    world->setBackgroundColor(0.0, 0.0, 0.0);
+
+    // create a camera and insert it into the virtual world
+    camera = new cCamera(world);
+    world->addChild(camera);
+
+    // position and oriente the camera
+    camera->set( cVector3d (0.5, 0.0, 0.0),    // camera position (eye)
+                 cVector3d (0.0, 0.0, 0.0),    // lookat position (target)
+                 cVector3d (0.0, 0.0, 1.0));   // direction of the "up" vector
+
+    // set the near and far clipping planes of the camera
+    // anything in front/behind these clipping planes will not be rendered
+    camera->setClippingPlanes(0.01, 10.0);
+
+    // create a light source and attach it to the camera
+    light = new cLight(world);
+    camera->addChild(light);                   // attach light to camera
+    light->setEnabled(true);                   // enable light source
+    light->setPos(cVector3d( 2.0, 0.5, 1.0));  // position the light source
+    light->setDir(cVector3d(-2.0, 0.5, 1.0));  // define the direction of the light beam
+
+
+    //-----------------------------------------------------------------------
+    // 2D - WIDGETS
+    //-----------------------------------------------------------------------
+
+    // create a 2D bitmap logo
+    logo = new cBitmap();
+
+    // add logo to the front plane
+    camera->m_front_2Dscene.addChild(logo);
+
+    // load a "chai3d" bitmap image file
+    bool fileload;
+    fileload = logo->m_image.loadFromFile(RESOURCE_PATH("resources/images/chai3d.bmp"));
+    if (!fileload)
+    {
+        #if defined(_MSVC)
+        fileload = logo->m_image.loadFromFile("../../../bin/resources/images/chai3d.bmp");
+        #endif
     }
 
-	// starts servo and all haptic devices.
-	std::cout << "HDAL: hdlStart" << std::endl;
-	hdlStart();
+    // position the logo at the bottom left of the screen (pixel coordinates)
+    logo->setPos(10, 10, 0);
 
-	// sets callback for the nonblocking servo loop
-	//std::cout << "HDAL: hdlCreateServoOp" << std::endl;
-	//hdlCreateServoOp(NonBlockingServoOpCallback, NULL, bNonBlocking);
+    // scale the logo along its horizontal and vertical axis
+    logo->setZoomHV(0.4, 0.4);
+
+    // here we replace all black pixels (0,0,0) of the logo bitmap
+    // with transparent black pixels (0, 0, 0, 0). This allows us to make
+    // the background of the logo look transparent.
+    logo->m_image.replace(
+                          cColorb(0, 0, 0),      // original RGB color
+                          cColorb(0, 0, 0, 0)    // new RGBA color
+                          );
+
+    // enable transparency
+    logo->enableTransparency(true);
+
+
+    // create a node on which we will attach small labels that display the
+    // position of each haptic device
+    rootLabels = new cGenericObject();
+    camera->m_front_2Dscene.addChild(rootLabels);
+
+    // create a small label as title
+    cLabel* titleLabel = new cLabel();
+    rootLabels->addChild(titleLabel);
 
-	// make a specific haptic device current
+    // define its position, color and string message
+    titleLabel->setPos(0, 30, 0);
+    titleLabel->m_fontColor.set(1.0, 1.0, 1.0);
+    titleLabel->m_string = "Haptic Device Pos [mm]:";
 
     // here we define the material properties of the cursor when the
     // user button of the device end-effector is engaged (ON) or released (OFF)
@@ -499,11 +1114,63 @@ int main(int argc, char* argv[])
     matCursorButtonON.m_ambient.set(0.1, 0.1, 0.4);
     matCursorButtonON.m_diffuse.set(0.3, 0.3, 0.8);
     matCursorButtonON.m_specular.set(1.0, 1.0, 1.0);
+}
+
+//---------------------------------------------------------------------------
+
+void initCursor(int i)
+{
+    // create a cursor by setting its radius
+    cShapeSphere* newCursor = new cShapeSphere(0.000000001);
+
+    // add cursor to the world
+    world->addChild(newCursor);
+
+    // add cursor to the cursor table
+    cursors[i] = newCursor;
+
+    // create a small line to illustrate velocity
+    cShapeLine* newLine = new cShapeLine(cVector3d(0,0,0), cVector3d(0,0,0));
+    velocityVectors[i] = newLine;
+
+    // add line to the world
+    world->addChild(newLine);
+
+    // create a string that concatenates the device number and model name.
+    string strID;
+    cStr(strID, i);
+    string strDevice = "#" + strID + " - ";
 
+    // attach a small label next to the cursor to indicate device information
+    cLabel* newLabel = new cLabel();
+    newCursor->addChild(newLabel);
+    newLabel->m_string = strDevice;
+    newLabel->setPos(0.00, 0.02, 0.00);
+    newLabel->m_fontColor.set(1.0, 1.0, 1.0);
 
+    // if the device provided orientation sensing (stylus), a reference
+    // frame is displayed
+    /*if (info.m_sensedRotation == true)
+    {
+        // display a reference frame
+        newCursor->setShowFrame(true);
+
+        // set the size of the reference frame
+        newCursor->setFrameSize(0.05, 0.05);
+    }*/
 
+    // crate a small label to indicate the position of the device
+    cLabel* newPosLabel = new cLabel();
+    rootLabels->addChild(newPosLabel);
+    newPosLabel->setPos(0, -20 * i, 0);
+    newPosLabel->m_fontColor.set(0.6, 0.6, 0.6);
+    labels[i] = newPosLabel;
+}
 
+//---------------------------------------------------------------------------
 
+void initWindow(int argc, char* argv[])
+{
     //-----------------------------------------------------------------------
     // OPEN GL - WINDOW DISPLAY
     //-----------------------------------------------------------------------
@@ -533,28 +1200,81 @@ int main(int argc, char* argv[])
     glutAddMenuEntry("full screen", OPTION_FULLSCREEN);
     glutAddMenuEntry("window display", OPTION_WINDOWDISPLAY);
     glutAttachMenu(GLUT_RIGHT_BUTTON);
+}
 
+//---------------------------------------------------------------------------
 
-    //-----------------------------------------------------------------------
-    // START SIMULATION
-    //-----------------------------------------------------------------------
+void printSweepStep(int freq)
+{
+    printf("Sweep step %d of %d: %.2f Hz\n", freq + 1, MAX_FREQ_NUM, Freq[freq]);
+    if (write_to_file)
+    {
+        for (int i=0; i<numHapticDevices; i++)
+        {
+            if (!isLocal(i)) continue;
+            char path[TELEMETRY_MAX_PATH];
+            log_file_name(i, freq, path, sizeof(path));
+            cout<<"Output file name is: "<<path<<endl;
+        }
+    }
+}
 
-    // simulation in now running
-    simulationRunning = true;
-	clock->start(true);
+//---------------------------------------------------------------------------
 
-    // create a thread which starts the main haptics rendering loop
-    cThread* hapticsThread = new cThread();
-    hapticsThread->set(updateHaptics, CHAI_THREAD_PRIORITY_HAPTICS);
+void runHeadless(void)
+{
+    int lastFreq = -1;
+    double lastStatus = 0;
+
+    // the servo loop ends the run after the last sweep frequency
+    while (simulationRunning)
+    {
+        cSleepMs(100);
 
-    // start the main graphics rendering loop
-    glutMainLoop();
+        ServoStatus status;
+        servoStatus.read(status);
 
-    // close everything
-    close();
+        // announce each new sweep step
+        int freq = status.freq;
+        if (freq != lastFreq && freq < MAX_FREQ_NUM)
+        {
+            printSweepStep(freq);
+            lastFreq = freq;
+        }
 
-    // exit
-    return (0);
+        // low-rate status line in place of the labels
+        double now = status.time;
+        if (StatusPeriod > 0 && (now < lastStatus || now - lastStatus >= StatusPeriod))
+        {
+            DeviceSnapshot first;
+            snapshots[0].read(first);
+            printf("t: %.1f  Kp: %.2f  Ki: %.2f  Kd: %.2f  ticks: %lld  overruns: %lld\n",
+                   now, first.Kp, first.Ki, first.Kd, status.ticks, status.overruns);
+            for (int i=0; i<numHapticDevices; i++)
+            {
+                DeviceSnapshot state;
+                snapshots[i].read(state);
+                printf("  #%d  force x: %.5f  y: %.5f  z: %.5f  tick: %lld",
+                       i, state.force[0], state.force[1], state.force[2], state.tick);
+                FreqResponseEstimate response;
+                if (freq_response_estimate(state.response, &response))
+                {
+                    int a = response.axis;
+                    printf("  %.2f Hz %c: %.3f mm %.1f deg  %.4f N %.1f deg",
+                           response.freq, "xyz"[a], response.posAmp[a] * 1000.0, cRadToDeg(response.posPhase[a]),
+                           response.forceAmp[a], cRadToDeg(response.forcePhase[a]));
+                }
+                printf("\n");
+            }
+            if (transport != NULL)
+            {
+                TransportStats stats;
+                linkStats.read(stats);
+                Transport::printStats(stats, stdout);
+            }
+            lastStatus = now;
+        }
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -584,49 +1304,46 @@ void keySelect(unsigned char key, int x, int y)
         exit(0);
     }
 
-    // option 1:
-    if (key == '1')
-    {
-        useForceField = !useForceField;
-        if (useForceField)
-        {
-            printf ("- Enable force field\n");
-        }
-        else
-        {
-            printf ("- Disable force field\n");
-        }
-    }
+    // where the servo tick spends its time, read while the loop runs
+    if (key == 'h')
+        profile_print(&tickProfile, stdout);
+
+    // the servo loop applies the changes at its next tick and reports
+    // them through the telemetry
+
+	// option 1:
+	if (key == '1')
+		command_post(PARAM_FORCE_FIELD, COMMAND_TOGGLE, 0);
 
 	if (key == '[')
-		Kp -= 10;
+		command_post(PARAM_KP, COMMAND_ADD, -10);
 	if (key == ']')
-		Kp += 10;
+		command_post(PARAM_KP, COMMAND_ADD, 10);
 	if (key == 'l')
-		Ki -= .1;
+		command_post(PARAM_KI, COMMAND_ADD, -.1);
 	if (key == ';')
-		Ki += .1;
+		command_post(PARAM_KI, COMMAND_ADD, .1);
 	if (key == ',')
-		Kd -= 1;
+		command_post(PARAM_KD, COMMAND_ADD, -1);
 	if (key == '.')
-		Kd += 1;
+		command_post(PARAM_KD, COMMAND_ADD, 1);
 	if (key == 'e')
-		EnableHaptics = !EnableHaptics;
+		command_post(PARAM_ENABLE_HAPTICS, COMMAND_TOGGLE, 0);
 
 	if (key == 'q')
-		last_force[1][0] -= 0.5;
+		command_post(PARAM_TEST_FORCE_0, COMMAND_ADD, -0.5);
 	if (key == 'w')
-		last_force[1][0] += 0.5;
+		command_post(PARAM_TEST_FORCE_0, COMMAND_ADD, 0.5);
 
 	if (key == 'a')
-		last_force[1][1] -= 0.5;
+		command_post(PARAM_TEST_FORCE_1, COMMAND_ADD, -0.5);
 	if (key == 's')
-		last_force[1][1] += 0.5;
+		command_post(PARAM_TEST_FORCE_1, COMMAND_ADD, 0.5);
 
 	if (key == 'c')
-		last_force[1][2] -= 0.5;
+		command_post(PARAM_TEST_FORCE_2, COMMAND_ADD, -0.5);
 	if (key == 'v')
-		last_force[1][2] += 0.5;
+		command_post(PARAM_TEST_FORCE_2, COMMAND_ADD, 0.5);
     // option 2:
     /*if (key == '2')
     {
@@ -670,17 +1387,62 @@ void close(void)
     // wait for graphics and haptics loops to terminate
     while (!simulationFinished) { cSleepMs(100); }
 
+    // report how well the servo loop kept its deadlines
+    servo_timer_print_stats(&servoTimer, stdout);
+    profile_print(&tickProfile, stdout);
+
+    // what the graphics cost, against the -fps cap
+    if (framesDrawn > 1)
+    {
+        double seconds = (servo_time_ns() - firstFrameNs) * 1e-9;
+        printf("graphics: %lld frames, %.1f fps\n", framesDrawn, framesDrawn / seconds);
+    }
+    if (rtServoFaults >= 0)
+    {
+        printf("servo: %lld page faults while running\n", rtServoFaults);
+    }
+
+    // latency of the link over the whole run
+    if (transport != NULL)
+    {
+        Transport::printStats(transport->getStats(), stdout);
+    }
+
+    // what the emulated channel did to the samples
+    if (UseDelay)
+    {
+        printf("delay emulation:\n");
+        delay_print_stats(&delayEmulator, stdout);
+    }
+
+    // flush remaining telemetry and report losses
+    telemetry_stop();
+    for (int i=0; i<numHapticDevices; i++)
+    {
+        printf("telemetry: device %d dropped %lld records\n", i, telemetry_dropped(i));
+    }
+
     // close all haptic devices
+    backend->stop();
     int i=0;
     while (i < numHapticDevices)
     {
         //hd[i]->close();
 		//hdlDestroyServoOp();
-		hdlStop();
-		hdlUninitDevice(hd[i].handle);
-		output[i].close();
+		if (isLocal(i))
+			backend->close(backendIndex(i));
         i++;
     }
+
+    // peak speeds and limit hits tell whether the coupling stayed stable
+    if (simBackend != NULL)
+    {
+        simBackend->printStats(stdout);
+    }
+
+    // the other side sees no more packets from here on
+    delete transport;
+    transport = NULL;
 }
 
 //---------------------------------------------------------------------------
@@ -688,57 +1450,37 @@ void close(void)
 void updateGraphics(void)
 {
 
+    // snapshots shown so far per device
+    static unsigned long long shown[MAX_DEVICES] = { 0 };
+
     // update content of position label
-	double newTime = clock->getCurrentTimeSeconds();
     for (int i=0; i<numHapticDevices; i++)
     {
-        // read position of device an convert into millimeters
+        // consistent copy of the last tick of the device, nothing to do
+        // if the servo loop has not published a new one since last frame
+        DeviceSnapshot state;
+        unsigned long long published = snapshots[i].read(state);
+        if (published == shown[i]) continue;
+        shown[i] = published;
+
+        // update position of cursor and velocity arrow
+        cVector3d position(state.pos[0], state.pos[1], state.pos[2]);
+        cursors[i]->setPos(position);
+        velocityVectors[i]->m_pointA = position;
+        velocityVectors[i]->m_pointB = cAdd(position, cVector3d(state.vel[0], state.vel[1], state.vel[2]));
+
 		//hdlMakeCurrent(deviceHandle[i]);
-		cVector3d pos;
-		double positionServo[3];
-
-		//hdlToolPosition(positionServo);
-		pos = hd[i].force;
-
-        //hapticDevices[i]->getPosition(pos);
-        //pos.mul(1000);
-
-
-        // create a string that concatenates the device number and its position.
-        string strID;
-        cStr(strID, i);
-        string strLabel = "#" + strID + "  x: ";
-        cStr(strLabel, pos.x, 5);
-        strLabel = strLabel + "   y: ";
-        cStr(strLabel, pos.y, 5);
-        strLabel = strLabel + "  z: ";
-        cStr(strLabel, pos.z, 5);
-		strLabel = strLabel + "  t: ";
-		cStr(strLabel, newTime, 2);
-
-		strLabel = strLabel + "  Kp: ";
-		cStr(strLabel, Kp, 2);
-
-		strLabel = strLabel + "  Ki: ";
-		cStr(strLabel, Ki, 2);
-
-		strLabel = strLabel + "  Kd: ";
-		cStr(strLabel, Kd, 2);
-
-        labels[i]->m_string = strLabel;
-
-		string strLabel2 = "";
-		cStr(strLabel2, pos.x, 5);
-		strLabel2 += " ";
-		cStr(strLabel2, pos.y, 5);
-		strLabel2 += " ";
-		cStr(strLabel2, pos.z, 5);
-		strLabel2 += " ";
-		cStr(strLabel2, clock->getCurrentTimeSeconds(), 5);
-		strLabel2 += "\n";
-
-		if (write_to_file)
-			output[i]<<strLabel2;
+
+        // device number, force, time, gains and the response so far; the
+        // label keeps its buffer, so copying a changed text in does not
+        // allocate either
+        FreqResponseEstimate response;
+        bool hasResponse = freq_response_estimate(state.response, &response);
+        if (device_label_update(&deviceLabels[i], i, state.force, state.time,
+                                state.Kp, state.Ki, state.Kd, hasResponse ? &response : NULL))
+        {
+            labels[i]->m_string = deviceLabels[i].text;
+        }
     }
 
     // render world
@@ -751,109 +1493,241 @@ void updateGraphics(void)
     GLenum err;
     err = glGetError();
     if (err != GL_NO_ERROR) printf("Error:  %s\n", gluErrorString(err));
-	if (newTime>=EndTime)
-	{
-
-		clock->reset();
-
-		Freq_count++;
-		if (Freq_count<MAX_FREQ_NUM)
-		{
-			for (int i = 0; i<numHapticDevices; i++)
-			{
-				output[i].close();
-				hd[i].error.zero();
-				string strLabel = "H:\\plik_";
-				strLabel += hd[i].devicename;
-				strLabel += "\\f";
-				cStr(strLabel, Freq[Freq_count], 2);
-
-				strLabel += ".txt";
-				const char * c = strLabel.c_str();
-
-				if (write_to_file)
-					cout<<"Output file name is: "<<strLabel<<endl;
-
-				output[i].open (c);
-			}
-		}
-		else
-		{
-			simulationRunning = false;
-		}
 
+	// the servo loop moves the sweep on, just report it
+	static int shownFreq = -1;
+	ServoStatus status;
+	servoStatus.read(status);
+	if (shownFreq != status.freq && status.freq < MAX_FREQ_NUM)
+	{
+		shownFreq = status.freq;
+		printSweepStep(shownFreq);
 	}
 
-    // inform the GLUT window to call updateGraphics again (next frame)
+    // frame count for the rate reported at exit
+    long long now = servo_time_ns();
+    if (framesDrawn++ == 0) firstFrameNs = now;
+
+    // inform the GLUT window to call updateGraphics again (next frame),
+    // right away or at the next frame time of the cap; a redraw of the
+    // window system does not move the frame clock
+    static long long nextFrameNs = 0;
     if (simulationRunning)
     {
-        glutPostRedisplay();
+        if (FrameRate <= 0)
+        {
+            glutPostRedisplay();
+        }
+        else if (!frameScheduled)
+        {
+            // absolute frame times, so the rate does not drift with the
+            // millisecond timer; no catch-up burst after a slow frame
+            nextFrameNs += (long long)(1e9 / FrameRate);
+            if (nextFrameNs < now) nextFrameNs = now;
+            frameScheduled = true;
+            glutTimerFunc((unsigned)((nextFrameNs - now) / 1000000), frameTimer, 0);
+        }
     }
 }
 
 //---------------------------------------------------------------------------
 
+void frameTimer(int value)
+{
+    // updateGraphics() schedules the frame after this one
+    frameScheduled = false;
+    glutPostRedisplay();
+}
+
+//---------------------------------------------------------------------------
+
 void updateHaptics(void)
 {
 	//plik=fopen("baza_RD.txt", "w"); 
+    // sweep frequency the loop is currently set up for
+    int sweepFreq = -1;
+
+    // priority, CPU and stack of this thread, before the first tick
+    if (UseRtProfile)
+    {
+        rt_servo_thread_setup(&rtProfile, &rtReport);
+        rtServoReady = true;
+    }
+
+    // first deadline is one period from now
+    servo_timer_start(&servoTimer);
+
     // main haptic simulation loop
     while(simulationRunning)
     {
-			Sleep(7);
+        // wait for the next absolute deadline
+        long long lateness = servo_timer_wait(&servoTimer);
+
+		double newTime = servo_timer_seconds(&servoTimer);
+        bool stepEnd = (newTime >= EndTime);
+
+        // a replay takes the clock, the end of the sweep steps and the
+        // parameter changes from the trace
+        if (replayBackend != NULL)
+        {
+            ReplayTick replayed;
+            if (!replayBackend->nextTick(&replayed))
+            {
+                simulationRunning = false;
+                break;
+            }
+            for (int p = 0; p < replayed.numParams; p++)
+            {
+                ParamCommand command = { replayed.param[p], COMMAND_SET, replayed.value[p] };
+                applyParam(servoTimer.ticks, replayed.paramTime, command);
+            }
+            newTime = replayed.time;
+            stepEnd = replayed.stepEnd;
+        }
+
+        // gain and mode changes take effect here, never within a tick
+        applyCommands(servoTimer.ticks, newTime);
+
+        // end of a sweep step: restart the clock on the next frequency,
+        // or stop after the last one
+        if (stepEnd)
+        {
+            if (RecordPath != NULL)
+            {
+                telemetry_input_step(servoTimer.ticks, newTime);
+            }
+
+            // what each device saw at the frequency of the step
+            for (int j = 0; j < numHapticDevices; j++)
+            {
+                FreqResponseEstimate estimate;
+                if (isLocal(j) && freq_response_estimate(responses[j], &estimate))
+                {
+                    telemetry_response(j, servoTimer.ticks, newTime, Freq_count, estimate);
+                }
+            }
+
+            Freq_count++;
+            if (Freq_count >= MAX_FREQ_NUM)
+            {
+                simulationRunning = false;
+                break;
+            }
+
+            servo_timer_reset_clock(&servoTimer);
+            if (replayBackend == NULL)
+            {
+                newTime = servo_timer_seconds(&servoTimer);
+            }
+            for (int j = 0; j < numHapticDevices; j++)
+            {
+                coupled.integral[j].zero();
+            }
+        }
+
+        // follow the sweep at a tick boundary when it moved on
+        if (sweepFreq != Freq_count && Freq_count < MAX_FREQ_NUM)
+        {
+            // the simulated operators move at the sweep frequency
+            if (simBackend != NULL)
+            {
+                for (int j = 0; j < numHapticDevices; j++)
+                {
+                    simBackend->device(j)->hand.freq = Freq[Freq_count];
+                }
+            }
+
+            // and the response is measured at it
+            for (int j = 0; j < numHapticDevices; j++)
+            {
+                freq_response_reset(&responses[j], Freq[Freq_count], ServoRate);
+            }
+
+            // switch the binary logs
+            if (write_to_file)
+            {
+                open_device_logs(servoTimer.ticks);
+            }
+            sweepFreq = Freq_count;
+        }
+
+        // a log the rotator was too busy to prepare, until it takes it
+        if (write_to_file)
+        {
+            retry_device_logs();
+        }
+
+        // newest state of the device on the other side of the link
+        if (transport != NULL)
+        {
+            receiveRemote();
+        }
+
         // for each device
         int i=0;
-		double newTime = clock->getCurrentTimeSeconds();
         while (i < numHapticDevices)
         {
-			hdlMakeCurrent(hd[i].handle);
+            // the remote device is only read from the link
+            if (!isLocal(i))
+            {
+                i++;
+                continue;
+            }
+
+			// each phase below is timed into tickProfile
+			long long phaseStart = servo_time_ns();
+
+			// advance simulated devices to the current time
+			backend->update(backendIndex(i), newTime);
 
             // read position of haptic device
             cVector3d newPosition;
-			cVector3d errorPosition;
+			cVector3d errorPosition(0, 0, 0);
             //hapticDevices[i]->getPosition(newPosition);
 			double positionServo[3];
 			//double force[3];
-			hdlToolPosition(positionServo);
-			newPosition.x = positionServo[2];
-			newPosition.y = positionServo[0];
-			newPosition.z = positionServo[1];
+			backend->getPosition(backendIndex(i), positionServo);
+			if (RecordPath != NULL)
+			{
+				telemetry_input(i, servoTimer.ticks, newTime, positionServo);
+			}
+			newPosition = teleop_app_position(positionServo);
+			phaseStart = profile_mark(&tickProfile, i, PHASE_READ, phaseStart);
 
 			
 
-            // update position and orientation of cursor
-            cursors[i]->setPos(newPosition);
             //cursors[i]->setRot(newRotation);
 
             // read linear velocity from device
             cVector3d linearVelocity;
-			cVector3d errorVelocity;
-			newPosition.subr(hd[i].pos, linearVelocity);
+			cVector3d errorVelocity(0, 0, 0);
 			double interval = newTime - hd[i].time;
 			//cout<<interval<<endl;
-			if (interval>0)
-				linearVelocity.div(interval);
+			if (VelocityType == VELOCITY_DIFFERENCE)
+				linearVelocity = teleop_velocity(newPosition, coupled.pos[i], interval);
 			else
-				linearVelocity.zero();
+				linearVelocity = velocity_estimate(&velocityEstimator, i, newTime, newPosition);
             //hapticDevices[i]->getLinearVelocity(linearVelocity);
+			phaseStart = profile_mark(&tickProfile, i, PHASE_VELOCITY, phaseStart);
 
-			
-            // update arrow
-            velocityVectors[i]->m_pointA = newPosition;
-            velocityVectors[i]->m_pointB = cAdd(newPosition, linearVelocity);
 
 
+            // samples of the other devices that reached this one by now
+            if (UseDelay)
+            {
+                delay_deliver(&delayEmulator, delayClock(), &delayed);
+            }
+
             // compute a reaction force
             cVector3d newForce (0,0,0);
 			double calc_force[3];
+			TeleopGains gains = { Kp, Kd, Ki };
             // apply force field
             if (useForceField)
             {
 				if (newTime<StartTime)
 				{
-					newPosition.add(0, 0, 0);
-					calc_force[0] = -Kp*newPosition.y - 2*Kd*linearVelocity.y;
-					calc_force[1] = -Kp*newPosition.z - 2*Kd*linearVelocity.z;
-					calc_force[2] = -Kp*newPosition.x - 2*Kd*linearVelocity.x;
+					teleop_centering_force(gains, newPosition, linearVelocity, calc_force);
 				}
 				else if(newTime<EndTime)
 				{
@@ -870,15 +1744,13 @@ void updateHaptics(void)
 					force[1] = -Kp*errorPosition.z - Kd*errorVelocity.z - Ki*hd[i].error.z;
 					force[2] = -Kp*errorPosition.x - Kd*errorVelocity.x - Ki*hd[i].error.x;*/
 
-errorPosition = newPosition - hd[1-i].pos;
-					//errorPosition.add(0, -hd[1-i].pos.y, 0);
-					errorVelocity = linearVelocity - hd[1-i].vel;
-					//errorVelocity.add(0, -hd[1-i].vel.y, 0);
-					hd[i].error +=errorPosition;
-
-					calc_force[0] = -Kp*errorPosition.y - Kd*errorVelocity.y - Ki*hd[i].error.y;
-					calc_force[1] = -Kp*errorPosition.z - Kd*errorVelocity.z - Ki*hd[i].error.z;
-					calc_force[2] = -Kp*errorPosition.x - Kd*errorVelocity.x - Ki*hd[i].error.x;
+					// weighted errors to the neighbours in the coupling graph;
+					// devices earlier in this tick already hold their new state,
+					// unless the emulated channel still holds it back
+					coupling_error(&couplingGraph, i, UseDelay ? &delayed : &coupled,
+					               newPosition, linearVelocity, errorPosition, errorVelocity);
+					teleop_error_force(gains, errorPosition, errorVelocity,
+					                   coupled.integral[i], calc_force);
 
 
 				}
@@ -895,16 +1767,17 @@ errorPosition = newPosition - hd[1-i].pos;
 
 
 
-				/*cVector3d Fg = gravity_compensate(newPosition);
-				force[0] += Fg.y;
-				force[1] += Fg.z;
-				force[2] += Fg.x;*/
+				// smoothed coupling force, see -filter
+				force_filter_update3(&forceFilter, i, calc_force, force[i]);
 
-
-				force[i][0]= calc_force[0];// calc_avg_force(i,0, calc_force[0]);// (calc_force[0] + force[i][0])/2;
-				force[i][1]= calc_force[1];// calc_avg_force(i,1, calc_force[1]);// (calc_force[1] + force[i][1])/2;
-				force[i][2]= calc_force[2];// calc_avg_force(i,2, calc_force[2]);// (calc_force[2] + force[i][2])/2;
-				print_avg_force();
+				// tabulated gravity_compensate(), see -gravity
+				if (GravityLutSize > 0)
+				{
+					cVector3d Fg = gravity_lut_eval(&gravityLut, newPosition);
+					force[i][0] += Fg.y;
+					force[i][1] += Fg.z;
+					force[i][2] += Fg.x;
+				}
 				//czy uzyc stalej sily do testow - zmiana wart sil - q,w, a,s, z,x 
 				int const_force = false;
 
@@ -927,17 +1800,48 @@ errorPosition = newPosition - hd[1-i].pos;
 					}
 				}
 
-			printf("pos %d %lf %lf %lf %lf %lf\n", i, newPosition.x, newPosition.y, newPosition.z, errorPosition.length(), errorVelocity.length());
-//fprintf(plik,"%d\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", i, newPosition.x, newPosition.y, newPosition.z, linearVelocity.x, linearVelocity.y, linearVelocity.z,
-				//calc_force[0],calc_force[1],calc_force[2]);
-				if(errorPosition.length() > 0.008 && errorVelocity.length() > 0.001){
+				// running response at the sweep frequency while coupled,
+				// position and force on the application axes
+				if (newTime >= StartTime)
+				{
+					double responsePos[3] = { newPosition.x, newPosition.y, newPosition.z };
+					double responseForce[3] = { force[i][2], force[i][0], force[i][1] };
+					freq_response_add(&responses[i], newTime, responsePos, responseForce);
+				}
+
+				phaseStart = profile_mark(&tickProfile, i, PHASE_FORCE, phaseStart);
+
+				// hand the sample to the telemetry writer thread
+				if (write_to_file)
+				{
+					TelemetryRecord record;
+					record.kind = TELEMETRY_SAMPLE;
+					record.device = i;
+					record.tick = servoTimer.ticks;
+					record.time = newTime;
+					record.sample.pos[0] = newPosition.x;   record.sample.pos[1] = newPosition.y;   record.sample.pos[2] = newPosition.z;
+					record.sample.vel[0] = linearVelocity.x; record.sample.vel[1] = linearVelocity.y; record.sample.vel[2] = linearVelocity.z;
+					record.sample.errorPos[0] = errorPosition.x; record.sample.errorPos[1] = errorPosition.y; record.sample.errorPos[2] = errorPosition.z;
+					record.sample.errorVel[0] = errorVelocity.x; record.sample.errorVel[1] = errorVelocity.y; record.sample.errorVel[2] = errorVelocity.z;
+					record.sample.force[0] = force[i][0];   record.sample.force[1] = force[i][1];   record.sample.force[2] = force[i][2];
+					telemetry_push(record);
+				}
+				phaseStart = profile_mark(&tickProfile, i, PHASE_LOG, phaseStart);
+
+				if(teleop_should_apply(errorPosition, errorVelocity)){
 
-					hdlSetToolForce(force[i]);
+					backend->setForce(backendIndex(i), force[i]);
 					//Sleep(1);
+					phaseStart = profile_mark(&tickProfile, i, PHASE_WRITE, phaseStart);
 
 				}
-				hd[i].pos = newPosition;
-				hd[i].vel = linearVelocity;
+				coupled.pos[i] = newPosition;
+				coupled.vel[i] = linearVelocity;
+				if (UseDelay)
+				{
+					delay_push(&delayEmulator, i, servoTimer.ticks, delayClock(),
+					           newPosition, linearVelocity);
+				}
 				hd[i].time = newTime;
 				hd[i].force.x = force[i][2];
 				hd[i].force.y = force[i][0];
@@ -945,221 +1849,246 @@ errorPosition = newPosition - hd[1-i].pos;
 
 			}
 
+			// publish the tick for the graphics and status output
+			DeviceSnapshot state;
+			state.tick = servoTimer.ticks;
+			state.time = newTime;
+			state.pos[0] = newPosition.x;     state.pos[1] = newPosition.y;     state.pos[2] = newPosition.z;
+			state.vel[0] = linearVelocity.x;  state.vel[1] = linearVelocity.y;  state.vel[2] = linearVelocity.z;
+			state.force[0] = hd[i].force.x;   state.force[1] = hd[i].force.y;   state.force[2] = hd[i].force.z;
+			state.Kp = Kp;  state.Kd = Kd;  state.Ki = Ki;
+			state.response = responses[i];
+			snapshots[i].write(state);
+
+			// and for the other side of the link
+			if (transport != NULL)
+			{
+				TransportPacket packet;
+				memset(&packet, 0, sizeof(packet));
+				packet.device = i;
+				packet.tick = servoTimer.ticks;
+				packet.time = newTime;
+				packet.pos[0] = newPosition.x;     packet.pos[1] = newPosition.y;     packet.pos[2] = newPosition.z;
+				packet.vel[0] = linearVelocity.x;  packet.vel[1] = linearVelocity.y;  packet.vel[2] = linearVelocity.z;
+				transport->send(packet);
+			}
+			profile_mark(&tickProfile, i, PHASE_PUBLISH, phaseStart);
+
             // increment counter
             i++;
 
 
         }
 
+        // the whole tick, and whether it ran past the next deadline
+        profile_tick(&tickProfile, lateness, servo_time_ns() - servoTimer.lastWakeNs);
+
+        // counters for the status output and the graphics
+        ServoStatus status;
+        status.ticks    = servoTimer.ticks;
+        status.overruns = servoTimer.overruns;
+        status.time     = newTime;
+        status.freq     = Freq_count;
+        servoStatus.write(status);
+
     }
     
     // exit haptics thread
+    if (UseRtProfile && rtReport.faultsAtStart >= 0)
+    {
+        rtServoFaults = rt_thread_faults() - rtReport.faultsAtStart;
+    }
 
+    simulationFinished = true;
+}
 
+//---------------------------------------------------------------------------
 
-    simulationFinished = true;
+bool isLocal(int i)
+{
+    return (transport == NULL || i == LocalSide);
 }
 
 //---------------------------------------------------------------------------
-// User defined functions
-cVector3d gravity_compensate(cVector3d newPosition)
+
+int backendIndex(int i)
 {
-		//Get position of a Falcon end effector in its co-ordinate frame and transfer it to the Base frame
-		//co-ordinate frame
-		const double Pzo = 0.134;	//	Zero-Configuration z-offset
-		double px = (newPosition.y);
-		double py = (newPosition.z);
-		double pz = (newPosition.x) + Pzo;
+    return (transport != NULL && !UseSimulation) ? 0 : i;
+}
 
-		/////////////////////////////////////////////////////////////////////////////////////////////////////////
-		//Computing the position of point P with respect to individial motor co-ordinate frames
-		//Transfering from Base frame co-ordinate frame to motor co-ordinate frame
-		////////////////////////////////////////////////////////////////////////////////////////////////////////
-		const double r   = 0.03723;	//	Radius of Back Plate
-		const double Pvo = 0.022;   //  Zero-Configuration v-offset
+//---------------------------------------------------------------------------
+
+void receiveRemote(void)
+{
+    int remote = 1 - LocalSide;
+    TransportPacket packet;
+    if (transport->receive(packet))
+    {
+        coupled.pos[remote] = cVector3d(packet.pos[0], packet.pos[1], packet.pos[2]);
+        coupled.vel[remote] = cVector3d(packet.vel[0], packet.vel[1], packet.vel[2]);
 
-		//Other parameters
-		const double pi = 3.141592653589793;
-		int j;
+        // emulated delay on top of the link's own
+        if (UseDelay)
+        {
+            delay_push(&delayEmulator, remote, packet.tick, delayClock(),
+                       coupled.pos[remote], coupled.vel[remote]);
+        }
 
-		//Motor Joint Angles    (Unit: radians)
-		const double phi[3] = {105.0*pi/180.0, -15.0*pi/180.0, -135.0*pi/180.0};
+        // the graphics show the remote device as of its own tick
+        DeviceSnapshot state;
+        memset(&state, 0, sizeof(state));
+        state.tick = packet.tick;
+        state.time = packet.time;
+        for (int k = 0; k < 3; k++)
+        {
+            state.pos[k] = packet.pos[k];
+            state.vel[k] = packet.vel[k];
+        }
+        state.Kp = Kp;  state.Kd = Kd;  state.Ki = Ki;
+        snapshots[remote].write(state);
+    }
+    linkStats.write(transport->getStats());
+}
 
-		//Motor co-ordinate frames
-		double Pv[3], Pw[3], Pu[3];
+//---------------------------------------------------------------------------
 
+double delayClock(void)
+{
+    if (VirtualTime)
+        return (servoTimer.ticks / ServoRate);
+    return (servo_time_ns() * 1e-9);
+}
 
-		for(j=0;j<3;j++)
-		{
-			Pu[j] = (cos(phi[j]) * px)  + (sin(phi[j])* py)  - r;	
-			Pv[j] = -(sin(phi[j])* px)  + (cos(phi[j]) * py) + Pvo;
-			Pw[j] = pz;
-		}
+//---------------------------------------------------------------------------
 
+void applyCommands(long long tick, double time)
+{
+    ParamCommand command;
+    while (command_pop(&command))
+    {
+        // a replay takes its changes from the trace only
+        if (replayBackend != NULL) continue;
 
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////
-		//Computing Inverse Kinematics
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////
-		double T1[3];
-		double L0[3], L1[3], L2[3];
-		double theta1[3], theta2[3], theta3[3]; // Joint Angles
+        applyParam(tick, time, command);
+    }
+}
 
-		//Dimensions of different parameters (Unit: meter)
-		const double s  =  0.025;    // Back plate Actuator Offset
-		const double b  =  0.103;    // Length of Parallel Link
-		const double a  =  0.060;    // Length of Curved Link
-		const double d  =  0.011;    // Length of Joint Link    
-		const double c	=  0.0157;	 //	Radius of Front Plate
+//---------------------------------------------------------------------------
 
-		for(j=0;j<3;j++)
-		{
-			//Calculating theta3
-			theta3[j] = acos( (Pv[j] - s) /b);
-
-			L0[j] = pow(Pw[j],2.0) + pow(Pu[j],2) + (2.0 * c * Pu[j]) - (4.0 * pow(d,2)) - (pow(b,2) * pow(sin(theta3[j]),2)) - (4.0 * b * d * sin(theta3[j])) - (2.0 * a * Pu[j]) + pow((a-c),2);
-			L1[j] = -4.0 * a * Pw[j];
-			L2[j] = pow(Pw[j],2.0) + pow(Pu[j],2) + (2.0 * c * Pu[j]) - (4.0 * pow(d,2)) - (pow(b,2) * pow(sin(theta3[j]),2)) - (4.0 * b * d * sin(theta3[j])) + (2.0 * a * Pu[j]) + pow((a+c),2);
-			T1[j] = (-L1[j] - sqrt(pow(L1[j],2) - (4.0*L2[j]*L0[j]))) / (2.0*L2[j]);
-
-			//Calculating theta1
-			theta1[j] = 2.0 * atan(T1[j]);
-       
-			//Calculating theta2
-			theta2[j] = atan((Pw[j] - (a * sin(theta1[j])))/(Pu[j] - (a * cos(theta1[j])) + c) );
-		}
+void applyParam(long long tick, double time, const ParamCommand& command)
+{
+    double* value;
+    bool* flag;
+    if (!paramVariable(command.param, &value, &flag)) return;
+
+    double oldValue = (value != NULL) ? *value : (*flag ? 1.0 : 0.0);
+    double newValue = command_apply(command, oldValue);
+    if (value != NULL)
+        *value = newValue;
+    else
+        *flag = (newValue != 0);
+    telemetry_param(tick, time, command.param, oldValue, newValue);
+}
 
-		////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		//Computing the Jacobian Matrix
-		////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		cMatrix3d JF;
-		double JF1[3], JF2[3], JF3[3];
-		for(j=0;j<3;j++)
-		{
-			JF1[j] =	cos(theta2[j]) * sin(theta3[j]) * cos(phi[j])      - cos(theta3[j]) * sin(phi[j]);
-			JF2[j] =	cos(theta3[j]) * cos(phi[j])    + cos(theta2[j]) * sin(theta3[j]) * sin(phi[j]);
-			JF3[j] =	sin(theta2[j]) * sin(theta3[j]);
-		}
-		JF.set(JF1[0],JF2[0],JF3[0],JF1[1],JF2[1],JF3[1],JF1[2],JF2[2],JF3[2]);
+//---------------------------------------------------------------------------
 
-		/////////////////////////////////////////////////////
-		cMatrix3d JI;
-		double JI1[3];
-		for(j=0;j<3;j++)
-		{
-			JI1[j] =	a*sin(theta2[j] - theta1[j])*sin(theta3[j]);
-		}
-		JI.set(JI1[0],0.0,0.0,0.0,JI1[1],0.0,0.0,0.0,JI1[2]);
-
-		/////////////////////////////////////////////////////
-		cMatrix3d J;
-		cMatrix3d Jinv;
-		cMatrix3d JIinv;
-		cMatrix3d JT;
-		JI.invertr(JIinv);
-		JIinv.mulr(JF,J);
-		J.transr(JT);
-		cMatrix3d JTinv;
-		JT.invertr(JTinv);
-
-		///////////////////////////////////////////////////////////////////////////////////////////////////////
-		//Computing Gravitational Torque
-		///////////////////////////////////////////////////////////////////////////////////////////////////////
-		//Masses of different parts of Falcon (Units in kilograms)
-		const double me = 0.052;	//  Mass of modified falcon grip
-		const double mc = 0.03278;  //  Mass of moving plate
-		const double mb = 0.00841;  //  Mass of parallel link
-		const double md = 0.01037;  //  Mass of joint link
-		const double ma = 0.08935;  //  Mass of curved link
-	    cVector3d Ga_Torque;        //Gravitational Torque
-		cVector3d Gb_Torque;        //Gravitational Torque
-		cVector3d Gc_Torque;        //Gravitational Torque
-		cVector3d Tg;               //Total gravitational torque
-
-		//Different lengths of Falcon Parts(Units in meter)
-		const double q   = 0.022;   //  Length of center of mass of curved link from motor joint
-
-		//Other variables defined
-		const double g  = 9.815; //Magnitude of Gravity - m/s^2
-
-		double m_a = g * ma * q;
-		Ga_Torque.set( m_a * sin((100.0*3.14/180.0) - theta1[0]) * sin(phi[0]) , m_a * sin((100.0*3.14/180.0) - theta1[1]) * sin(phi[1]) , m_a * sin((100.0*3.14/180.0) - theta1[2]) * sin(phi[2]) );
-
-		double m_b = a * g * (mb + md);
-		Gb_Torque.set( m_b * sin(theta1[0]) * sin(phi[0]) , m_b * sin(theta1[1]) * sin(phi[1]) , m_b * sin(theta1[2]) * sin(phi[2]) );
-		cVector3d Gc_Force;
-		Gc_Force.x = 0.0;
-		Gc_Force.y = (3.0* (mb+md) + mc + me) * g;
-		Gc_Force.z = 0.0;
-		JTinv.mulr(Gc_Force,Gc_Torque);
-
-		// Computing total gravitational torque
-		Tg = Ga_Torque - Gb_Torque + Gc_Torque;
-
-		// Computing the required gravity force from gravitational torque
-		cVector3d Gravity;
-		JT.mulr(Tg,Gravity);
-
-		// Converting from back plate to Falcons Co-ordinate system
-		cVector3d Fg;
-		Fg.set(Gravity.z,Gravity.x,Gravity.y);
-		return Fg;
+bool paramVariable(int param, double** value, bool** flag)
+{
+    *value = NULL;
+    *flag = NULL;
+    switch (param)
+    {
+        case PARAM_KP:              *value = &Kp; break;
+        case PARAM_KI:              *value = &Ki; break;
+        case PARAM_KD:              *value = &Kd; break;
+        case PARAM_ENABLE_HAPTICS:  *flag = &EnableHaptics; break;
+        case PARAM_FORCE_FIELD:     *flag = &useForceField; break;
+        case PARAM_TEST_FORCE_0:    *value = &last_force[1][0]; break;
+        case PARAM_TEST_FORCE_1:    *value = &last_force[1][1]; break;
+        case PARAM_TEST_FORCE_2:    *value = &last_force[1][2]; break;
+        default:                    return (false);
+    }
+    return (true);
 }
 
-double zaokraglanie(double x)
+//---------------------------------------------------------------------------
+
+void log_file_name(int device, int freq, char* path, int size)
 {
- int y = x * 10000; // przesuwamy przecinek o 4 miejsca i pozbywamy sie reszty za przecinkiem - y jest calkowite
- if (y % 10 >= 5) y += 10; // jezeli cyfra jednosci >= 5
- return (y / 10) * 0.001; // usuwamy ostatnia cyfre i zamieniamy na liczbe zmiennoprzecinkowa
-} 
+	snprintf(path, size, "H:\\plik_%s\\f%.2f.bin", hd[device].devicename, Freq[freq]);
+}
 
-int empty_avg_force(){
-	int haptics = 2;
+//---------------------------------------------------------------------------
 
-	//i - liczba haptikow
-	//k - kierunki x,y,z - oznaczone 0,1,2
-	//j - kontener na ostatnie wyniki np 100
-	for(int i = 0; i< haptics; i++){
-		for(int k = 0; k<3; k++){
+void open_device_logs(long long tick)
+{
+	for (int i = 0; i < numHapticDevices; i++)
+	{
+		if (!isLocal(i)) continue;
 
-		for(int j = 0; j< AVG; j++){
+		char path[TELEMETRY_MAX_PATH];
+		log_file_name(i, Freq_count, path, sizeof(path));
 
-			avg_force[i][k][j] = 0;
-		}
-		}
+		BinLogHeader header;
+		binlog_init_header(&header, hd[i].devicename, Freq[Freq_count], Kp, Kd, Ki, ServoRate, AXIS_MAP);
+		telemetry_open_log(i, tick, path, header);
 	}
-	return 1;
-}
 
-double calc_avg_force(int which_haptic, int which_axis,double last_force){
+	// have the next step's files created while this one runs
+	if (Freq_count + 1 < MAX_FREQ_NUM)
+	{
+		prepare_device_logs(Freq_count + 1);
+	}
+}
 
-	double tmp_force = 0;
-	//przesun wszystkie wartosci o jedno miejsce 'w dol'
-	for(int i = 0; i < AVG - 1; i++){
+//---------------------------------------------------------------------------
 
-		avg_force[which_haptic][which_axis][i] = avg_force[which_haptic][which_axis][i+1];
+void prepare_device_logs(int freq)
+{
+	for (int i = 0; i < numHapticDevices; i++)
+	{
+		if (!isLocal(i)) continue;
+		prepare_device_log(i, freq);
 	}
+}
 
-	//dodaj na koniec last_force
-	avg_force[which_haptic][which_axis][AVG - 1] = last_force;
+//---------------------------------------------------------------------------
 
-	//oblicz srednia
-	for(int i = 0; i < AVG; i++){
-		tmp_force += avg_force[which_haptic][which_axis][i];
-	}
-	return tmp_force/(AVG+1);
-	
+void prepare_device_log(int device, int freq)
+{
+	char path[TELEMETRY_MAX_PATH];
+	log_file_name(device, freq, path, sizeof(path));
+
+	// gains as of now, the switch brings them up to date
+	BinLogHeader header;
+	binlog_init_header(&header, hd[device].devicename, Freq[freq], Kp, Kd, Ki, ServoRate, AXIS_MAP);
+	prepareRetry[device] = telemetry_prepare_log(device, path, header, (long long)(EndTime * ServoRate)) ? -1 : freq;
 }
 
-void print_avg_force(){
-int haptics = 2;
-	for(int i = 0; i< haptics; i++){
-for(int k = 0; k<3; k++){
-		for(int j = 0; j< AVG; j++){
+//---------------------------------------------------------------------------
+
+void retry_device_logs(void)
+{
+	for (int i = 0; i < numHapticDevices; i++)
+	{
+		if (!isLocal(i) || prepareRetry[i] < 0) continue;
 
-			fprintf(plik,"%d\t%lf\n",i,avg_force[i][k][j]);
+		// once the step has started, its switch opened the file in place
+		// (and the writer reported it)
+		if (prepareRetry[i] <= Freq_count)
+		{
+			prepareRetry[i] = -1;
+			continue;
 		}
-}
-		fprintf(plik,"\n");
+		prepare_device_log(i, prepareRetry[i]);
 	}
 }
 
+//---------------------------------------------------------------------------
+// User defined functions
+double zaokraglanie(double x)
+{
+ int y = x * 10000; // przesuwamy przecinek o 4 miejsca i pozbywamy sie reszty za przecinkiem - y jest calkowite
+ if (y % 10 >= 5) y += 10; // jezeli cyfra jednosci >= 5
+ return (y / 10) * 0.001; // usuwamy ostatnia cyfre i zamieniamy na liczbe zmiennoprzecinkowa
+} 
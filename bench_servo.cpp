@@ -0,0 +1,722 @@
+//===========================================================================
+/*
+    bench_servo.cpp
+
+    Micro-benchmarks of the pieces of a servo tick and of the label
+    building of the graphics loop. Each benchmark is timed in batches of
+    operations (a batch takes at least BENCH_MIN_BATCH_NS); the table
+    shows ns per operation at the median and 99th percentile batch.
+
+    The servo benchmarks carry the number of calls a two-device tick
+    makes when the feature is on; their p99 sum is checked against the
+    tick budget (1 / rate), so a change that would blow the period shows
+    up here before it reaches a rig. Of the force filters and of the
+    velocity estimators a tick runs one, so only the most expensive of
+    each group is added in.
+
+    usage: bench_servo [-samples <n>] [-rate <Hz>] [-out <file>]
+                       [-baseline <file>] [-tolerance <%>]
+
+        -samples    timed batches per benchmark (default 1000)
+        -rate       servo rate for the tick budget (default 1000)
+        -out        write the results as tab-separated values
+        -baseline   compare the medians with a file written by -out
+        -tolerance  allowed slowdown against the baseline (default 25)
+
+    Before timing, gravity_compensate_batch() is checked against the
+    scalar gravity_compensate() on a grid that reaches well outside the
+    workspace, as offline workspace analysis uses it there.
+
+    Exit code 2 if a benchmark regressed, the tick budget is exceeded or
+    the batch gravity model disagrees with the scalar one.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "chai3d.h"
+#include "servo_timer.h"
+#include "telemetry.h"
+#include "teleop.h"
+#include "falcon_kinematics.h"
+#include "gravity_lut.h"
+#include "force_filter.h"
+#include "velocity_estimator.h"
+#include "delay_emulator.h"
+#include "tick_profile.h"
+#include "device_label.h"
+#include "binlog_codec.h"
+#include "freq_response.h"
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// shortest timed batch [ns], well above the cost of reading the clock
+const long long BENCH_MIN_BATCH_NS = 20000;
+
+// number of precomputed inputs, cycled through by the benchmarks
+const int BENCH_INPUTS = 1024;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct Bench
+{
+    const char* name;
+    const char* group;      // "servo", "graphics" or "offline"
+    int         perTick;    // calls per two-device servo tick when in use
+    const char* choice;     // alternatives a tick runs one of, NULL = none
+    double      (*run)(int count);
+
+    // results [ns per operation]
+    double      p50;
+    double      p99;
+    double      mean;
+};
+
+
+//---------------------------------------------------------------------------
+// BENCHMARK INPUTS
+//---------------------------------------------------------------------------
+
+// positions inside the workspace (application frame)
+static cVector3d inPos[BENCH_INPUTS];
+static cVector3d inVel[BENCH_INPUTS];
+static double inX[BENCH_INPUTS], inY[BENCH_INPUTS], inZ[BENCH_INPUTS];
+static double outX[BENCH_INPUTS], outY[BENCH_INPUTS], outZ[BENCH_INPUTS];
+
+static GravityLut lut;
+static ForceFilterBank avgFilter, biquadFilter, medianFilter;
+static VelocityEstimatorBank foawVelocity, kalmanVelocity, levantVelocity;
+static DelayEmulator delayEmulator;
+static CouplingState delayedState;
+static TickProfile tickProfile;
+
+// one chunk of a 1 Hz sweep at 1 kHz, and room for its encoding
+static BinLogSample inSamples[BINLOG_RECORDS_PER_CHUNK];
+static std::vector<unsigned char> encoded;
+static const BinLogPrecision benchPrecision = { 1e-9, 1e-6, 1e-5, 1e-4, 1e-6 };
+
+// response of two devices at 1 Hz, and one read out after ten seconds
+static FreqResponse responses[2];
+static FreqResponseEstimate benchEstimate;
+
+// largest allowed difference of the batch and scalar gravity models [N]
+const double BENCH_GRAVITY_TOLERANCE = 1e-6;
+
+// results are summed here so the compiler cannot drop the work
+static volatile double sink;
+
+//---------------------------------------------------------------------------
+
+static void make_inputs()
+{
+    srand(1);
+    int n = 0;
+    while (n < BENCH_INPUTS)
+    {
+        cVector3d p((rand() % 1001 - 500) * 1e-4,
+                    (rand() % 1001 - 500) * 1e-4,
+                    (rand() % 1001 - 500) * 1e-4);
+        if (!falcon_in_workspace(p)) continue;
+        inPos[n] = p;
+        inVel[n] = cVector3d((rand() % 201 - 100) * 1e-3,
+                             (rand() % 201 - 100) * 1e-3,
+                             (rand() % 201 - 100) * 1e-3);
+        inX[n] = p.x;
+        inY[n] = p.y;
+        inZ[n] = p.z;
+        n++;
+    }
+
+    static const double pi = 3.141592653589793;
+    for (int k = 0; k < (int)BINLOG_RECORDS_PER_CHUNK; k++)
+    {
+        BinLogSample& s = inSamples[k];
+        s.tick = k;
+        s.time = k * 0.001;
+        for (int j = 0; j < 3; j++)
+        {
+            double phase = 2.0 * pi * s.time + j;
+            s.pos[j]      = (float)(0.03 * sin(phase));
+            s.vel[j]      = (float)(0.03 * 2.0 * pi * cos(phase));
+            s.force[j]    = (float)(-140.0 * 0.001 * sin(phase - 0.1));
+            s.errorPos[j] = (float)(0.001 * sin(phase - 0.1));
+        }
+    }
+    encoded.resize(codec_bound(BINLOG_RECORDS_PER_CHUNK));
+
+    for (int d = 0; d < 2; d++)
+    {
+        freq_response_reset(&responses[d], 1.0, 1000.0);
+    }
+    for (int k = 0; k < 10000; k++)
+    {
+        const BinLogSample& s = inSamples[k % BINLOG_RECORDS_PER_CHUNK];
+        double pos[3] = { s.pos[0], s.pos[1], s.pos[2] };
+        double force[3] = { s.force[0], s.force[1], s.force[2] };
+        freq_response_add(&responses[0], k * 0.001, pos, force);
+    }
+    freq_response_estimate(responses[0], &benchEstimate);
+}
+
+//---------------------------------------------------------------------------
+
+// largest difference of gravity_compensate_batch() to the scalar model on
+// a +-0.1 m grid, over the points where both are finite [N]
+static double check_gravity_batch(int* compared)
+{
+    const int steps = 21;
+    std::vector<double> x, y, z;
+    for (int i = 0; i < steps; i++)
+    for (int j = 0; j < steps; j++)
+    for (int k = 0; k < steps; k++)
+    {
+        x.push_back(-0.1 + 0.01 * i);
+        y.push_back(-0.1 + 0.01 * j);
+        z.push_back(-0.1 + 0.01 * k);
+    }
+    int count = (int)x.size();
+    std::vector<double> fx(count), fy(count), fz(count);
+    gravity_compensate_batch(count, &x[0], &y[0], &z[0], &fx[0], &fy[0], &fz[0]);
+
+    double worst = 0;
+    *compared = 0;
+    for (int n = 0; n < count; n++)
+    {
+        cVector3d exact = gravity_compensate(cVector3d(x[n], y[n], z[n]));
+        double e[3] = { exact.x, exact.y, exact.z };
+        double d[3] = { fx[n] - exact.x, fy[n] - exact.y, fz[n] - exact.z };
+        bool finite = true;
+        for (int k = 0; k < 3; k++)
+        {
+            finite = finite && fabs(e[k]) < 1e30 && fabs(d[k]) < 1e30;
+        }
+        if (!finite) continue;
+        (*compared)++;
+        for (int k = 0; k < 3; k++)
+        {
+            if (fabs(d[k]) > worst) worst = fabs(d[k]);
+        }
+    }
+    return worst;
+}
+
+
+//---------------------------------------------------------------------------
+// BENCHMARKS
+//---------------------------------------------------------------------------
+
+static double bench_gravity(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        acc += gravity_compensate(inPos[n & (BENCH_INPUTS - 1)]).z;
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// one operation = one position of a full batch of BENCH_INPUTS
+static double bench_gravity_batch(int count)
+{
+    double acc = 0;
+    for (int done = 0; done < count; done += BENCH_INPUTS)
+    {
+        int len = (count - done < BENCH_INPUTS) ? count - done : BENCH_INPUTS;
+        gravity_compensate_batch(len, inX, inY, inZ, outX, outY, outZ);
+        acc += outZ[len - 1];
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+static double bench_gravity_lut(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        acc += gravity_lut_eval(&lut, inPos[n & (BENCH_INPUTS - 1)]).z;
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+static double run_filter(ForceFilterBank* bank, int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        acc += force_filter_update(bank, n % 6, inX[n & (BENCH_INPUTS - 1)]);
+    }
+    return acc;
+}
+
+static double bench_filter_avg(int count)    { return run_filter(&avgFilter, count); }
+static double bench_filter_biquad(int count) { return run_filter(&biquadFilter, count); }
+static double bench_filter_median(int count) { return run_filter(&medianFilter, count); }
+
+//---------------------------------------------------------------------------
+
+static double bench_velocity(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        int k = n & (BENCH_INPUTS - 1);
+        acc += teleop_velocity(inPos[k], inPos[(k + 1) & (BENCH_INPUTS - 1)], 0.001).x;
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// two devices sampled 1 ms apart, moving steadily so that the adaptive
+// window spans its full length (its worst case); the clock keeps running
+// across batches so that the estimators never restart
+static double run_estimator(VelocityEstimatorBank* bank, int count)
+{
+    static double time = 0;
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        int dev = n & 1;
+        if (dev == 0) time += 0.001;
+        cVector3d position(0.05 * sin(time), 0.05 * cos(time), 0.01 * dev);
+        acc += velocity_estimate(bank, dev, time, position).x;
+    }
+    return acc;
+}
+
+static double bench_velocity_foaw(int count)   { return run_estimator(&foawVelocity, count); }
+static double bench_velocity_kalman(int count) { return run_estimator(&kalmanVelocity, count); }
+static double bench_velocity_levant(int count) { return run_estimator(&levantVelocity, count); }
+
+//---------------------------------------------------------------------------
+
+// one device's turn through the emulated channel: delivery of what is
+// due, then its own sample; 20 ms with Gaussian jitter and reordering
+// keeps a few dozen samples in the queue, as in a -delay run
+static double bench_delay(int count)
+{
+    static long long tick = 0;
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        int dev = n & 1;
+        if (dev == 0) tick++;
+        int k = n & (BENCH_INPUTS - 1);
+        acc += delay_deliver(&delayEmulator, tick * 0.001, &delayedState);
+        delay_push(&delayEmulator, dev, tick, tick * 0.001, inPos[k], inVel[k]);
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// the PID block of updateHaptics(): coupling force and apply decision
+static double bench_coupling(int count)
+{
+    TeleopGains gains = { 140.0, 1.0, 3.0 };
+    cVector3d integral(0, 0, 0);
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        int k = n & (BENCH_INPUTS - 1);
+        int other = (k + 1) & (BENCH_INPUTS - 1);
+        cVector3d errorPosition, errorVelocity;
+        double force[3];
+        teleop_coupling_force(gains, inPos[k], inVel[k], inPos[other], inVel[other],
+                              integral, errorPosition, errorVelocity, force);
+        if (teleop_should_apply(errorPosition, errorVelocity))
+        {
+            acc += force[0];
+        }
+        if ((n & 255) == 0) integral.zero();
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// producer side of the per-tick logging path; the writer thread drains
+// the rings in the background as it does in the application
+static double bench_telemetry(int count)
+{
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = TELEMETRY_SAMPLE;
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        record.device = n & 1;
+        record.tick = n;
+        record.sample.pos[0] = inX[n & (BENCH_INPUTS - 1)];
+        acc += telemetry_push(record) ? 1 : 0;
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// compression of the binary logs on the writer thread, per sample
+static double bench_codec(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n += BINLOG_RECORDS_PER_CHUNK)
+    {
+        int chunk = (count - n < (int)BINLOG_RECORDS_PER_CHUNK) ? count - n : BINLOG_RECORDS_PER_CHUNK;
+        acc += (double)codec_encode(benchPrecision, inSamples, chunk, &encoded[0]);
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// the per-tick update of the response of one device
+static double bench_response(int count)
+{
+    for (int n = 0; n < count; n++)
+    {
+        const cVector3d& pos = inPos[n & (BENCH_INPUTS - 1)];
+        const cVector3d& vel = inVel[n & (BENCH_INPUTS - 1)];
+        double p[3] = { pos.x, pos.y, pos.z };
+        double f[3] = { vel.x, vel.y, vel.z };
+        freq_response_add(&responses[1], n * 0.001, p, f);
+    }
+    return responses[1].s1[0];
+}
+
+//---------------------------------------------------------------------------
+
+// reading the amplitudes and phases out, once per device and frame
+static double bench_response_estimate(int count)
+{
+    double acc = 0;
+    FreqResponseEstimate estimate;
+    for (int n = 0; n < count; n++)
+    {
+        freq_response_estimate(responses[0], &estimate);
+        acc += estimate.posAmp[0];
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+static double bench_clock(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        acc += (double)servo_time_ns();
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// end of one timed phase: a clock read and a histogram update
+static double bench_profile(int count)
+{
+    long long start = servo_time_ns();
+    for (int n = 0; n < count; n++)
+    {
+        start = profile_mark(&tickProfile, n & 1, n % PHASE_COUNT, start);
+    }
+    return (double)start;
+}
+
+//---------------------------------------------------------------------------
+
+// one device label of updateGraphics()
+static double bench_label(int count)
+{
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        const cVector3d& pos = inPos[n & (BENCH_INPUTS - 1)];
+        int i = n & 1;
+        double newTime = n * 0.001;
+        double Kp = 140.0, Ki = 3.0, Kd = 1.0;
+
+        std::string strID;
+        cStr(strID, i);
+        std::string strLabel = "#" + strID + "  x: ";
+        cStr(strLabel, pos.x, 5);
+        strLabel = strLabel + "   y: ";
+        cStr(strLabel, pos.y, 5);
+        strLabel = strLabel + "  z: ";
+        cStr(strLabel, pos.z, 5);
+        strLabel = strLabel + "  t: ";
+        cStr(strLabel, newTime, 2);
+        strLabel = strLabel + "  Kp: ";
+        cStr(strLabel, Kp, 2);
+        strLabel = strLabel + "  Ki: ";
+        cStr(strLabel, Ki, 2);
+        strLabel = strLabel + "  Kd: ";
+        cStr(strLabel, Kd, 2);
+
+        acc += strLabel.size();
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+// the same label from a fixed buffer; every value changes on every call,
+// the worst case, as a frame rarely repeats all of them
+static double bench_label_fixed(int count)
+{
+    static DeviceLabel label[2];
+    double acc = 0;
+    for (int n = 0; n < count; n++)
+    {
+        const cVector3d& pos = inPos[n & (BENCH_INPUTS - 1)];
+        double force[3] = { pos.x, pos.y, pos.z };
+        benchEstimate.posPhase[benchEstimate.axis] = n * 0.01;
+        if (device_label_update(&label[n & 1], n & 1, force, n * 0.01, 140.0, 3.0, 1.0, &benchEstimate))
+        {
+            acc += label[n & 1].text[0];
+        }
+    }
+    return acc;
+}
+
+//---------------------------------------------------------------------------
+
+static Bench benches[] =
+{
+    { "gravity_compensate",       "offline",  0, NULL,       bench_gravity },
+    { "gravity_compensate_batch", "offline",  0, NULL,       bench_gravity_batch },
+    { "gravity_lut_eval",         "servo",    2, NULL,       bench_gravity_lut },
+    { "force_filter_avg",         "servo",    6, "filter",   bench_filter_avg },
+    { "force_filter_biquad",      "servo",    6, "filter",   bench_filter_biquad },
+    { "force_filter_median",      "servo",    6, "filter",   bench_filter_median },
+    { "teleop_velocity",          "servo",    2, "velocity", bench_velocity },
+    { "velocity_foaw",            "servo",    2, "velocity", bench_velocity_foaw },
+    { "velocity_kalman",          "servo",    2, "velocity", bench_velocity_kalman },
+    { "velocity_levant",          "servo",    2, "velocity", bench_velocity_levant },
+    { "delay_emulator",           "servo",    2, NULL,       bench_delay },
+    { "teleop_coupling_force",    "servo",    2, NULL,       bench_coupling },
+    { "telemetry_push",           "servo",    2, NULL,       bench_telemetry },
+    { "servo_time_ns",            "servo",    2, NULL,       bench_clock },
+    { "profile_mark",             "servo",   12, NULL,       bench_profile },
+    { "freq_response_add",        "servo",    2, NULL,       bench_response },
+    { "freq_response_estimate",   "graphics", 0, NULL,       bench_response_estimate },
+    { "binlog_codec_encode",      "offline",  0, NULL,       bench_codec },
+    { "label_cStr",               "graphics", 0, NULL,       bench_label },
+    { "device_label_update",      "graphics", 0, NULL,       bench_label_fixed },
+};
+
+static const int numBenches = sizeof(benches) / sizeof(benches[0]);
+
+
+//---------------------------------------------------------------------------
+// MEASUREMENT
+//---------------------------------------------------------------------------
+
+static void measure(Bench* bench, int samples)
+{
+    // grow the batch until it is long enough to time reliably
+    int batch = 1;
+    while (true)
+    {
+        long long t0 = servo_time_ns();
+        sink = sink + bench->run(batch);
+        long long t = servo_time_ns() - t0;
+        if (t >= BENCH_MIN_BATCH_NS || batch >= (1 << 24)) break;
+        batch *= 2;
+    }
+
+    std::vector<double> ns(samples);
+    double sum = 0;
+    for (int k = 0; k < samples; k++)
+    {
+        long long t0 = servo_time_ns();
+        sink = sink + bench->run(batch);
+        ns[k] = (double)(servo_time_ns() - t0) / batch;
+        sum += ns[k];
+    }
+
+    std::sort(ns.begin(), ns.end());
+    bench->p50  = ns[samples / 2];
+    bench->p99  = ns[(samples * 99) / 100];
+    bench->mean = sum / samples;
+}
+
+//---------------------------------------------------------------------------
+
+// median of a benchmark in a file written by -out, < 0 if not listed
+static double baseline_p50(const char* path, const char* name)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return (-1);
+
+    char line[512];
+    double result = -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#') continue;
+        char fileName[128], group[32];
+        int perTick;
+        double p50;
+        if (sscanf(line, "%127s %31s %d %lf", fileName, group, &perTick, &p50) == 4 &&
+            strcmp(fileName, name) == 0)
+        {
+            result = p50;
+            break;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int samples = 1000;
+    double rate = SERVO_DEFAULT_RATE;
+    const char* outPath = NULL;
+    const char* basePath = NULL;
+    double tolerance = 25.0;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-samples") == 0 && a+1 < argc)
+            samples = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-rate") == 0 && a+1 < argc)
+            rate = atof(argv[++a]);
+        else if (strcmp(argv[a], "-out") == 0 && a+1 < argc)
+            outPath = argv[++a];
+        else if (strcmp(argv[a], "-baseline") == 0 && a+1 < argc)
+            basePath = argv[++a];
+        else if (strcmp(argv[a], "-tolerance") == 0 && a+1 < argc)
+            tolerance = atof(argv[++a]);
+        else
+        {
+            printf("usage: bench_servo [-samples <n>] [-rate <Hz>] [-out <file>]\n");
+            printf("                   [-baseline <file>] [-tolerance <%%>]\n");
+            return (1);
+        }
+    }
+    if (samples < 100) samples = 100;
+    if (rate <= 0) rate = SERVO_DEFAULT_RATE;
+
+    // inputs, gravity table and a telemetry writer, as in the application
+    make_inputs();
+    gravity_lut_build(&lut, GRAVITY_LUT_DEFAULT_SIZE);
+    force_filter_init(&avgFilter, FILTER_MOVING_AVERAGE, 16, 0, rate, 6);
+    force_filter_init(&biquadFilter, FILTER_BIQUAD, 4, 50.0, rate, 6);
+    force_filter_init(&medianFilter, FILTER_MEDIAN, 7, 0, rate, 6);
+    velocity_init(&foawVelocity, VELOCITY_ADAPTIVE, 2);
+    velocity_init(&kalmanVelocity, VELOCITY_KALMAN, 2);
+    velocity_init(&levantVelocity, VELOCITY_LEVANT, 2);
+    profile_init(&tickProfile, 2, rate, true);
+    delay_init(&delayEmulator, 2, 0.020);
+    delayEmulator.jitterType = DELAY_JITTER_GAUSS;
+    delayEmulator.jitter = 0.002;
+    delayEmulator.reorderRate = 0.01;
+    delayEmulator.reorderHold = 0.005;
+    telemetry_start("bench_telemetry.txt", 2, 1, 0, false, NULL);
+
+    // the batch model must match the scalar one, inside the workspace or not
+    int compared;
+    double gravityError = check_gravity_batch(&compared);
+    bool gravityFailed = !(gravityError <= BENCH_GRAVITY_TOLERANCE);
+
+    for (int b = 0; b < numBenches; b++)
+    {
+        measure(&benches[b], samples);
+    }
+
+    telemetry_stop();
+    remove("bench_telemetry.txt");
+
+    // table and tick budget
+    printf("%-26s %-9s %8s %10s %10s %10s\n", "benchmark", "group", "per tick", "p50 ns", "p99 ns", "mean ns");
+    double tickNs = 0;
+    for (int b = 0; b < numBenches; b++)
+    {
+        const Bench& r = benches[b];
+        printf("%-26s %-9s %8d %10.1f %10.1f %10.1f\n", r.name, r.group, r.perTick, r.p50, r.p99, r.mean);
+
+        // of alternatives only the most expensive one counts
+        bool worst = true;
+        for (int o = 0; o < numBenches && r.choice != NULL; o++)
+        {
+            const Bench& other = benches[o];
+            if (o == b || other.choice == NULL || strcmp(other.choice, r.choice) != 0) continue;
+            double cost = other.perTick * other.p99;
+            if (cost > r.perTick * r.p99 || (cost == r.perTick * r.p99 && o < b)) worst = false;
+        }
+        if (worst) tickNs += r.perTick * r.p99;
+    }
+    double budgetNs = 1e9 / rate;
+    bool failed = false;
+    printf("gravity_compensate_batch vs scalar: max %.3g N over %d points\n", gravityError, compared);
+    if (gravityFailed)
+    {
+        printf("FAIL: batch gravity model differs from gravity_compensate()\n");
+        failed = true;
+    }
+    printf("servo tick estimate (p99, all features on, worst filter and estimator): %.2f us of %.2f us budget\n",
+           tickNs / 1000.0, budgetNs / 1000.0);
+    if (tickNs > budgetNs)
+    {
+        printf("FAIL: tick budget exceeded\n");
+        failed = true;
+    }
+
+    // compare with the baseline
+    if (basePath != NULL)
+    {
+        for (int b = 0; b < numBenches; b++)
+        {
+            double base = baseline_p50(basePath, benches[b].name);
+            if (base <= 0) continue;
+            double change = (benches[b].p50 / base - 1.0) * 100.0;
+            bool regressed = change > tolerance;
+            printf("%-26s %10.1f -> %10.1f ns  %+6.1f %%%s\n", benches[b].name,
+                   base, benches[b].p50, change, regressed ? "  REGRESSION" : "");
+            failed = failed || regressed;
+        }
+    }
+
+    // machine-readable results
+    if (outPath != NULL)
+    {
+        FILE* out = fopen(outPath, "w");
+        if (out == NULL)
+        {
+            printf("Could not write %s\n", outPath);
+            return (1);
+        }
+        fprintf(out, "# bench_servo, rate %.0f Hz, %d samples\n", rate, samples);
+        fprintf(out, "# name\tgroup\tper_tick\tp50_ns\tp99_ns\tmean_ns\n");
+        for (int b = 0; b < numBenches; b++)
+        {
+            const Bench& r = benches[b];
+            fprintf(out, "%s\t%s\t%d\t%.2f\t%.2f\t%.2f\n", r.name, r.group, r.perTick, r.p50, r.p99, r.mean);
+        }
+        fprintf(out, "tick_estimate\tservo\t1\t%.2f\t%.2f\t%.2f\n", tickNs, tickNs, tickNs);
+        fclose(out);
+    }
+
+    return (failed ? 2 : 0);
+}
@@ -0,0 +1,549 @@
+//===========================================================================
+/*
+    binlog.cpp
+
+    Binary per-device, per-frequency log files.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "binlog.h"
+#include "binlog_codec.h"
+#include <stdlib.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+//---------------------------------------------------------------------------
+
+static const char BINLOG_MAGIC[8] = "FALCLOG";
+
+//---------------------------------------------------------------------------
+
+void binlog_init_header(BinLogHeader* header, const char* device, double freq,
+                        double Kp, double Kd, double Ki, double servoRate,
+                        const int axisMap[3])
+{
+    memset(header, 0, sizeof(BinLogHeader));
+    memcpy(header->magic, BINLOG_MAGIC, sizeof(header->magic));
+    header->version         = BINLOG_VERSION;
+    header->headerSize      = sizeof(BinLogHeader);
+    header->recordSize      = sizeof(BinLogSample);
+    header->recordsPerChunk = BINLOG_RECORDS_PER_CHUNK;
+    strncpy(header->device, device, sizeof(header->device) - 1);
+    header->freq      = freq;
+    header->Kp        = Kp;
+    header->Kd        = Kd;
+    header->Ki        = Ki;
+    header->servoRate = servoRate;
+    for (int k = 0; k < 3; k++)
+    {
+        header->axisMap[k] = axisMap[k];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool binlog_open(BinLogWriter* writer, const char* path, const BinLogHeader& header,
+                 const BinLogPrecision* packing)
+{
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        return (false);
+    }
+
+    // chunks are written whole, a large stdio buffer batches them further
+    setvbuf(writer->file, NULL, _IOFBF, 1 << 20);
+
+    writer->header = header;
+    writer->header.indexOffset = 0;
+    writer->header.numChunks   = 0;
+    writer->header.numRecords  = 0;
+    writer->packed = (packing != NULL);
+    if (writer->packed)
+    {
+        writer->header.version    = BINLOG_VERSION_PACKED;
+        writer->header.headerSize = sizeof(BinLogHeader) + sizeof(BinLogPrecision);
+        writer->precision = *packing;
+        writer->encoded.resize(codec_bound(BINLOG_RECORDS_PER_CHUNK));
+    }
+    fwrite(&writer->header, sizeof(BinLogHeader), 1, writer->file);
+    if (writer->packed)
+    {
+        fwrite(&writer->precision, sizeof(BinLogPrecision), 1, writer->file);
+    }
+
+    writer->chunk.magic = BINLOG_CHUNK_MAGIC;
+    writer->chunk.count = 0;
+    writer->index.clear();
+    writer->reserved = 0;
+    writer->offset = writer->header.headerSize;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void binlog_update_header(BinLogWriter* writer, const BinLogHeader& header)
+{
+    BinLogHeader current = writer->header;
+    writer->header = header;
+    writer->header.version     = current.version;
+    writer->header.headerSize  = current.headerSize;
+    writer->header.indexOffset = current.indexOffset;
+    writer->header.numChunks   = current.numChunks;
+    writer->header.numRecords  = current.numRecords;
+}
+
+//---------------------------------------------------------------------------
+
+void binlog_reserve(BinLogWriter* writer, uint64_t records)
+{
+    if (writer->file == NULL) return;
+
+    uint64_t chunks = (records + BINLOG_RECORDS_PER_CHUNK - 1) / BINLOG_RECORDS_PER_CHUNK;
+    writer->index.reserve((size_t)chunks);
+
+    uint64_t bytes = sizeof(BinLogHeader) +
+                     chunks * (sizeof(BinLogChunkHeader) + BINLOG_RECORDS_PER_CHUNK * sizeof(BinLogSample)) +
+                     chunks * sizeof(BinLogIndexEntry);
+    if (bytes > BINLOG_MAX_RESERVE) bytes = BINLOG_MAX_RESERVE;
+
+    // the file size stays that of the data written, a reader never sees
+    // the reserved space
+#if defined(_WIN32)
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)bytes;
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(writer->file));
+    if (SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)))
+    {
+        writer->reserved = bytes;
+    }
+#elif defined(__linux__)
+    if (fallocate(fileno(writer->file), FALLOC_FL_KEEP_SIZE, 0, (off_t)bytes) == 0)
+    {
+        writer->reserved = bytes;
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+static void binlog_flush_chunk(BinLogWriter* writer)
+{
+    if (writer->chunk.count == 0) return;
+
+    BinLogIndexEntry entry;
+    entry.t0     = writer->chunk.t0;
+    entry.t1     = writer->chunk.t1;
+    entry.offset = writer->offset;
+    entry.count  = writer->chunk.count;
+    writer->index.push_back(entry);
+
+    if (writer->packed)
+    {
+        BinLogPackedChunkHeader packed;
+        packed.magic = BINLOG_PACKED_MAGIC;
+        packed.count = writer->chunk.count;
+        packed.t0    = writer->chunk.t0;
+        packed.t1    = writer->chunk.t1;
+        packed.bytes = codec_encode(writer->precision, writer->samples, writer->chunk.count,
+                                    &writer->encoded[0]);
+        fwrite(&packed, sizeof(BinLogPackedChunkHeader), 1, writer->file);
+        fwrite(&writer->encoded[0], 1, (size_t)packed.bytes, writer->file);
+        writer->offset += sizeof(BinLogPackedChunkHeader) + packed.bytes;
+    }
+    else
+    {
+        fwrite(&writer->chunk, sizeof(BinLogChunkHeader), 1, writer->file);
+        fwrite(writer->samples, sizeof(BinLogSample), writer->chunk.count, writer->file);
+        writer->offset += sizeof(BinLogChunkHeader) + writer->chunk.count * sizeof(BinLogSample);
+    }
+
+    writer->header.numChunks++;
+    writer->header.numRecords += writer->chunk.count;
+    writer->chunk.count = 0;
+}
+
+//---------------------------------------------------------------------------
+
+void binlog_append(BinLogWriter* writer, const BinLogSample& sample)
+{
+    if (writer->chunk.count == 0)
+    {
+        writer->chunk.t0 = sample.time;
+    }
+    writer->chunk.t1 = sample.time;
+    writer->samples[writer->chunk.count++] = sample;
+
+    if (writer->chunk.count == BINLOG_RECORDS_PER_CHUNK)
+    {
+        binlog_flush_chunk(writer);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void binlog_close(BinLogWriter* writer)
+{
+    if (writer->file == NULL) return;
+
+    binlog_flush_chunk(writer);
+
+    // trailing index right after the last chunk, then patch the header
+    // to point at it
+    writer->header.indexOffset = writer->offset;
+    if (!writer->index.empty())
+    {
+        fwrite(&writer->index[0], sizeof(BinLogIndexEntry), writer->index.size(), writer->file);
+    }
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(&writer->header, sizeof(BinLogHeader), 1, writer->file);
+
+#if defined(__linux__)
+    // give back the unused part of a reservation; Windows drops it when
+    // the file is closed
+    if (writer->reserved > 0)
+    {
+        fflush(writer->file);
+        off_t end = (off_t)(writer->header.indexOffset + writer->index.size() * sizeof(BinLogIndexEntry));
+        if (ftruncate(fileno(writer->file), end) != 0)
+        {
+            // only the reserved blocks stay allocated, the data is intact
+        }
+    }
+#endif
+
+    fclose(writer->file);
+    writer->file = NULL;
+}
+
+//---------------------------------------------------------------------------
+
+bool binlog_is_open(const BinLogWriter* writer)
+{
+    return (writer->file != NULL);
+}
+
+//---------------------------------------------------------------------------
+// READER
+//---------------------------------------------------------------------------
+
+static bool map_file(BinLogReader* reader, const char* path)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return (false);
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return (false);
+    }
+    reader->data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    reader->size = (size_t)size.QuadPart;
+    reader->handle[0] = file;
+    reader->handle[1] = mapping;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return (false);
+
+    struct stat st;
+    fstat(fd, &st);
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return (false);
+
+    reader->data = (const unsigned char*)data;
+    reader->size = st.st_size;
+    reader->handle[0] = NULL;
+    reader->handle[1] = NULL;
+#endif
+    return (reader->data != NULL);
+}
+
+//---------------------------------------------------------------------------
+
+static const BinLogChunkHeader* chunk_at(const BinLogReader* reader, uint64_t c)
+{
+    return (const BinLogChunkHeader*)(reader->data + reader->header->headerSize + c * reader->chunkBytes);
+}
+
+//---------------------------------------------------------------------------
+
+// the trailing index of a closed file lies inside the file, and so does
+// every chunk it lists; chunks are full up to the last one. A packed
+// chunk must also carry the magic, count and size its decoding relies on
+static bool index_fits(const BinLogReader* reader)
+{
+    const BinLogHeader* header = reader->header;
+    uint64_t indexOffset = header->indexOffset;
+    if (indexOffset < header->headerSize || indexOffset > reader->size ||
+        header->numChunks > (reader->size - indexOffset) / sizeof(BinLogIndexEntry))
+    {
+        return (false);
+    }
+
+    const BinLogIndexEntry* index = (const BinLogIndexEntry*)(reader->data + indexOffset);
+    uint64_t records = 0;
+    for (uint64_t c = 0; c < header->numChunks; c++)
+    {
+        uint64_t count = index[c].count;
+        uint64_t end;
+        if (header->version == BINLOG_VERSION_PACKED)
+        {
+            uint64_t offset = index[c].offset;
+            if (offset < header->headerSize || offset > indexOffset ||
+                indexOffset - offset < sizeof(BinLogPackedChunkHeader))
+            {
+                return (false);
+            }
+            const BinLogPackedChunkHeader* chunk = (const BinLogPackedChunkHeader*)(reader->data + offset);
+            if (chunk->magic != BINLOG_PACKED_MAGIC || chunk->count != count ||
+                chunk->bytes > indexOffset - offset - sizeof(BinLogPackedChunkHeader))
+            {
+                return (false);
+            }
+            end = offset + sizeof(BinLogPackedChunkHeader) + chunk->bytes;
+        }
+        else
+        {
+            end = header->headerSize + c * reader->chunkBytes +
+                  sizeof(BinLogChunkHeader) + count * header->recordSize;
+        }
+        if (count > header->recordsPerChunk ||
+            (count < header->recordsPerChunk && c + 1 < header->numChunks) ||
+            end > indexOffset)
+        {
+            return (false);
+        }
+        records += count;
+    }
+    return (records == header->numRecords);
+}
+
+//---------------------------------------------------------------------------
+
+static bool open_packed(BinLogReader* reader)
+{
+    const BinLogHeader* header = reader->header;
+    if (header->headerSize < sizeof(BinLogHeader) + sizeof(BinLogPrecision) ||
+        header->headerSize > reader->size ||
+        header->recordsPerChunk != BINLOG_RECORDS_PER_CHUNK)
+    {
+        return (false);
+    }
+    reader->precision = (const BinLogPrecision*)(reader->data + sizeof(BinLogHeader));
+
+    reader->decoded = (BinLogDecodedChunk*)malloc(sizeof(BinLogDecodedChunk));
+    if (reader->decoded == NULL) return (false);
+    reader->decoded->chunk = UINT64_MAX;
+
+    if (index_fits(reader))
+    {
+        reader->index      = (const BinLogIndexEntry*)(reader->data + header->indexOffset);
+        reader->numChunks  = header->numChunks;
+        reader->numRecords = header->numRecords;
+        return (true);
+    }
+
+    // unclosed file, or an index that does not fit the file: walk the
+    // chunk headers up to the first incomplete or short one
+    size_t capacity = 0;
+    size_t offset = header->headerSize;
+    while (offset + sizeof(BinLogPackedChunkHeader) <= reader->size)
+    {
+        const BinLogPackedChunkHeader* chunk = (const BinLogPackedChunkHeader*)(reader->data + offset);
+        if (chunk->magic != BINLOG_PACKED_MAGIC ||
+            chunk->count > BINLOG_RECORDS_PER_CHUNK ||
+            chunk->bytes > reader->size - offset - sizeof(BinLogPackedChunkHeader))
+        {
+            break;
+        }
+
+        if (reader->numChunks == capacity)
+        {
+            capacity = (capacity == 0) ? 256 : 2 * capacity;
+            BinLogIndexEntry* grown = (BinLogIndexEntry*)realloc(reader->scanned, capacity * sizeof(BinLogIndexEntry));
+            if (grown == NULL) return (false);
+            reader->scanned = grown;
+        }
+        BinLogIndexEntry& entry = reader->scanned[reader->numChunks++];
+        entry.t0     = chunk->t0;
+        entry.t1     = chunk->t1;
+        entry.offset = offset;
+        entry.count  = chunk->count;
+        reader->numRecords += chunk->count;
+
+        offset += sizeof(BinLogPackedChunkHeader) + (size_t)chunk->bytes;
+
+        // binlog_sample() counts on full chunks: a short one is the last
+        if (chunk->count < BINLOG_RECORDS_PER_CHUNK) break;
+    }
+    reader->index = reader->scanned;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool binlog_open_read(BinLogReader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(BinLogReader));
+    if (!map_file(reader, path)) return (false);
+
+    const BinLogHeader* header = (const BinLogHeader*)reader->data;
+    if (reader->size < sizeof(BinLogHeader))
+    {
+        binlog_close_read(reader);
+        return (false);
+    }
+    if (memcmp(header->magic, BINLOG_MAGIC, sizeof(header->magic)) != 0 ||
+        (header->version != BINLOG_VERSION && header->version != BINLOG_VERSION_PACKED) ||
+        header->recordSize != sizeof(BinLogSample))
+    {
+        binlog_close_read(reader);
+        return (false);
+    }
+
+    reader->header = header;
+    reader->chunkBytes = sizeof(BinLogChunkHeader) + (size_t)header->recordsPerChunk * header->recordSize;
+
+    if (header->version == BINLOG_VERSION_PACKED)
+    {
+        if (!open_packed(reader))
+        {
+            binlog_close_read(reader);
+            return (false);
+        }
+    }
+    else if (header->headerSize < sizeof(BinLogHeader) || header->headerSize > reader->size)
+    {
+        binlog_close_read(reader);
+        return (false);
+    }
+    else if (index_fits(reader))
+    {
+        // closed file, the trailing index lists the chunks
+        reader->index      = (const BinLogIndexEntry*)(reader->data + header->indexOffset);
+        reader->numChunks  = header->numChunks;
+        reader->numRecords = header->numRecords;
+    }
+    else
+    {
+        // unclosed file, or an index that does not fit the file: count
+        // the whole chunks, then a short last one if it was written out
+        size_t body = reader->size - header->headerSize;
+        uint64_t whole = body / reader->chunkBytes;
+        reader->numChunks = 0;
+        while (reader->numChunks < whole &&
+               chunk_at(reader, reader->numChunks)->magic == BINLOG_CHUNK_MAGIC &&
+               chunk_at(reader, reader->numChunks)->count == header->recordsPerChunk)
+        {
+            reader->numChunks++;
+        }
+        size_t rest = body - (size_t)reader->numChunks * reader->chunkBytes;
+        if (rest >= sizeof(BinLogChunkHeader))
+        {
+            const BinLogChunkHeader* last = chunk_at(reader, reader->numChunks);
+            if (last->magic == BINLOG_CHUNK_MAGIC && last->count <= header->recordsPerChunk &&
+                sizeof(BinLogChunkHeader) + (size_t)last->count * header->recordSize <= rest)
+            {
+                reader->numChunks++;
+            }
+        }
+        reader->numRecords = 0;
+        if (reader->numChunks > 0)
+        {
+            reader->numRecords = (reader->numChunks - 1) * header->recordsPerChunk +
+                                 chunk_at(reader, reader->numChunks - 1)->count;
+        }
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void binlog_close_read(BinLogReader* reader)
+{
+    if (reader->data == NULL) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(reader->data);
+    CloseHandle((HANDLE)reader->handle[1]);
+    CloseHandle((HANDLE)reader->handle[0]);
+#else
+    munmap((void*)reader->data, reader->size);
+#endif
+    reader->data = NULL;
+
+    free(reader->scanned);
+    free(reader->decoded);
+    reader->scanned = NULL;
+    reader->decoded = NULL;
+}
+
+//---------------------------------------------------------------------------
+
+const BinLogSample* binlog_sample(const BinLogReader* reader, uint64_t k)
+{
+    uint64_t perChunk = reader->header->recordsPerChunk;
+    if (reader->decoded == NULL)
+    {
+        const BinLogChunkHeader* chunk = chunk_at(reader, k / perChunk);
+        return (const BinLogSample*)(chunk + 1) + (k % perChunk);
+    }
+
+    BinLogDecodedChunk* decoded = reader->decoded;
+    uint64_t c = k / perChunk;
+    if (decoded->chunk != c)
+    {
+        const BinLogIndexEntry& entry = reader->index[c];
+        const BinLogPackedChunkHeader* chunk = (const BinLogPackedChunkHeader*)(reader->data + entry.offset);
+        if (!codec_decode(*reader->precision, (const unsigned char*)(chunk + 1), (size_t)chunk->bytes,
+                          decoded->samples, (int)chunk->count))
+        {
+            // damaged chunk: zeros rather than garbage
+            memset(decoded->samples, 0, sizeof(decoded->samples));
+        }
+        decoded->chunk = c;
+    }
+    return &decoded->samples[k % perChunk];
+}
+
+//---------------------------------------------------------------------------
+
+uint64_t binlog_seek(const BinLogReader* reader, double t)
+{
+    // first chunk whose last sample is at or after t
+    uint64_t lo = 0;
+    uint64_t hi = reader->numChunks;
+    while (lo < hi)
+    {
+        uint64_t mid = (lo + hi) / 2;
+        double t1 = (reader->index != NULL) ? reader->index[mid].t1 : chunk_at(reader, mid)->t1;
+        if (t1 < t) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == reader->numChunks) return (reader->numRecords);
+
+    // first sample at or after t inside that chunk
+    uint64_t first = lo * reader->header->recordsPerChunk;
+    uint64_t last  = first + ((reader->index != NULL) ? reader->index[lo].count : chunk_at(reader, lo)->count);
+    while (first < last)
+    {
+        uint64_t mid = (first + last) / 2;
+        if (binlog_sample(reader, mid)->time < t) first = mid + 1;
+        else last = mid;
+    }
+    return (first);
+}
@@ -0,0 +1,212 @@
+//===========================================================================
+/*
+    binlog.h
+
+    Binary per-device, per-frequency log files.
+
+    Layout:
+        BinLogHeader                              (fixed size)
+        chunk 0: BinLogChunkHeader + samples      (recordsPerChunk samples)
+        chunk 1: ...
+        chunk n: BinLogChunkHeader + samples      (last chunk may be short)
+        BinLogIndexEntry[numChunks]               (written when closed)
+
+    Every chunk except the last holds exactly recordsPerChunk samples, so
+    sample k lives in chunk k / recordsPerChunk and chunks sit at a fixed
+    stride. Each chunk header carries the time span of its samples; the
+    trailing index repeats them so a reader can binary-search a time
+    window without touching the sample data. Files that were not closed
+    (crash, power loss) have indexOffset == 0 and are read through the
+    chunk headers instead, as is a file whose index or chunks it lists
+    do not fit in the file.
+
+    Packed files (version BINLOG_VERSION_PACKED) hold the same samples
+    compressed, see binlog_codec.h:
+        BinLogHeader + BinLogPrecision            (headerSize)
+        chunk 0: BinLogPackedChunkHeader + bytes  (recordsPerChunk samples)
+        ...
+        BinLogIndexEntry[numChunks]               (written when closed)
+
+    Their chunks vary in size, so the index (or, in an unclosed file, a
+    walk over the chunk headers) is the only way to a chunk.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+const uint32_t BINLOG_VERSION           = 1;
+const uint32_t BINLOG_VERSION_PACKED    = 2;
+const uint32_t BINLOG_CHUNK_MAGIC       = 0x4b4e4843;   // "CHNK"
+const uint32_t BINLOG_PACKED_MAGIC      = 0x4b434150;   // "PACK"
+const uint32_t BINLOG_RECORDS_PER_CHUNK = 1024;
+
+// largest disk pre-allocation of binlog_reserve() [bytes]
+const uint64_t BINLOG_MAX_RESERVE       = 1ULL << 30;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+#pragma pack(push, 8)
+
+struct BinLogHeader
+{
+    char     magic[8];          // "FALCLOG" + '\0'
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(BinLogHeader)
+    uint32_t recordSize;        // sizeof(BinLogSample)
+    uint32_t recordsPerChunk;
+    char     device[32];        // device name, e.g. "FALCON_1"
+    double   freq;              // sweep frequency [Hz]
+    double   Kp;                // coupling gains at the start of the file
+    double   Kd;
+    double   Ki;
+    double   servoRate;         // nominal servo rate [Hz]
+    int32_t  axisMap[3];        // HDAL axis stored as sample x, y, z
+    int32_t  reserved;
+    uint64_t indexOffset;       // file offset of the chunk index, 0 if not closed
+    uint64_t numChunks;
+    uint64_t numRecords;
+};
+
+struct BinLogChunkHeader
+{
+    uint32_t magic;             // BINLOG_CHUNK_MAGIC
+    uint32_t count;             // samples in this chunk
+    double   t0;                // time of the first sample [s]
+    double   t1;                // time of the last sample [s]
+};
+
+// quantization steps of a packed file, right after its header
+struct BinLogPrecision
+{
+    double   time;              // [s]
+    double   pos;               // [m]
+    double   vel;               // [m/s]
+    double   force;             // [N]
+    double   error;             // [m]
+};
+
+struct BinLogPackedChunkHeader
+{
+    uint32_t magic;             // BINLOG_PACKED_MAGIC
+    uint32_t count;             // samples in this chunk
+    double   t0;                // time of the first sample [s]
+    double   t1;                // time of the last sample [s]
+    uint64_t bytes;             // encoded samples that follow
+};
+
+struct BinLogSample
+{
+    int64_t  tick;              // servo tick
+    double   time;              // servo time [s]
+    float    pos[3];            // position [m]
+    float    vel[3];            // velocity [m/s]
+    float    force[3];          // commanded force [N]
+    float    errorPos[3];       // position error to the coupled device [m]
+};
+
+struct BinLogIndexEntry
+{
+    double   t0;
+    double   t1;
+    uint64_t offset;            // file offset of the chunk header
+    uint64_t count;
+};
+
+#pragma pack(pop)
+
+//---------------------------------------------------------------------------
+
+struct BinLogWriter
+{
+    FILE*                         file;
+    BinLogHeader                  header;
+    BinLogChunkHeader             chunk;
+    BinLogSample                  samples[BINLOG_RECORDS_PER_CHUNK];
+    std::vector<BinLogIndexEntry> index;
+    uint64_t                      reserved;   // bytes pre-allocated on disk
+    uint64_t                      offset;     // file offset of the next chunk
+    bool                          packed;
+    BinLogPrecision               precision;  // of a packed file
+    std::vector<unsigned char>    encoded;    // chunk encoding buffer
+};
+
+// the chunk of a packed file that binlog_sample() decoded last
+struct BinLogDecodedChunk
+{
+    uint64_t                chunk;
+    BinLogSample            samples[BINLOG_RECORDS_PER_CHUNK];
+};
+
+struct BinLogReader
+{
+    const unsigned char*    data;       // mapped file
+    size_t                  size;
+    const BinLogHeader*     header;
+    const BinLogIndexEntry* index;      // NULL if a raw file was not closed
+    uint64_t                numChunks;
+    uint64_t                numRecords;
+    size_t                  chunkBytes; // stride between chunk headers
+    void*                   handle[2];  // platform file / mapping handles
+
+    // packed files only
+    const BinLogPrecision*  precision;
+    BinLogIndexEntry*       scanned;    // index rebuilt from an unclosed file
+    BinLogDecodedChunk*     decoded;
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// fill the fields of a header common to all files
+void binlog_init_header(BinLogHeader* header, const char* device, double freq,
+                        double Kp, double Kd, double Ki, double servoRate,
+                        const int axisMap[3]);
+
+// create a file and write its header; the samples are packed with the
+// given precision, or stored as they are if "packing" is NULL
+bool binlog_open(BinLogWriter* writer, const char* path, const BinLogHeader& header,
+                 const BinLogPrecision* packing);
+
+// take device, frequency and gains from "header" for the file being
+// written, which keeps its format and counts
+void binlog_update_header(BinLogWriter* writer, const BinLogHeader& header);
+
+// append one sample, writes a chunk whenever one is full
+void binlog_append(BinLogWriter* writer, const BinLogSample& sample);
+
+// make room for "records" samples up front: index capacity, and disk
+// space (without growing the file) where the platform supports it, so
+// that appending does not allocate; at most BINLOG_MAX_RESERVE bytes
+void binlog_reserve(BinLogWriter* writer, uint64_t records);
+
+// flush the last chunk, write the index and patch the header
+void binlog_close(BinLogWriter* writer);
+
+bool binlog_is_open(const BinLogWriter* writer);
+
+//---------------------------------------------------------------------------
+
+// map a file for reading
+bool binlog_open_read(BinLogReader* reader, const char* path);
+
+void binlog_close_read(BinLogReader* reader);
+
+// sample k of the file, 0 <= k < numRecords; in a packed file the
+// pointer is valid until a sample of another chunk is asked for
+const BinLogSample* binlog_sample(const BinLogReader* reader, uint64_t k);
+
+// index of the first sample with time >= t (numRecords if none)
+uint64_t binlog_seek(const BinLogReader* reader, double t);
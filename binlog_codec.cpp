@@ -0,0 +1,283 @@
+//===========================================================================
+/*
+    binlog_codec.cpp
+
+    Column-wise delta / delta-of-delta encoding of binary log chunks.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "binlog_codec.h"
+#include <math.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+// bytes of a 64 bit varint at most
+static const int VARINT_MAX = 10;
+
+//---------------------------------------------------------------------------
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// differences wrap around instead of overflowing
+static int64_t sub(int64_t a, int64_t b)
+{
+    return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+static int64_t add(int64_t a, int64_t b)
+{
+    return (int64_t)((uint64_t)a + (uint64_t)b);
+}
+
+//---------------------------------------------------------------------------
+
+static int bit_width(uint64_t v)
+{
+    int width = 0;
+    while (v != 0)
+    {
+        width++;
+        v >>= 1;
+    }
+    return width;
+}
+
+//---------------------------------------------------------------------------
+
+static unsigned char* put_varint(unsigned char* out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char)v;
+    return out;
+}
+
+static const unsigned char* get_varint(const unsigned char* in, const unsigned char* end, uint64_t* v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 7 * VARINT_MAX && in < end; shift += 7)
+    {
+        unsigned char byte = *in++;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return in;
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+
+struct BitWriter
+{
+    unsigned char* out;
+    uint64_t       acc;
+    int            count;       // bits in acc, < 8 between calls
+};
+
+static void put_bits(BitWriter* w, uint64_t v, int width)
+{
+    while (width > 0)
+    {
+        int n = (width < 32) ? width : 32;
+        w->acc |= (v & ((1ULL << n) - 1)) << w->count;
+        w->count += n;
+        v >>= n;
+        width -= n;
+        while (w->count >= 8)
+        {
+            *w->out++ = (unsigned char)w->acc;
+            w->acc >>= 8;
+            w->count -= 8;
+        }
+    }
+}
+
+static void flush_bits(BitWriter* w)
+{
+    if (w->count > 0) *w->out++ = (unsigned char)w->acc;
+    w->acc = 0;
+    w->count = 0;
+}
+
+//---------------------------------------------------------------------------
+
+struct BitReader
+{
+    const unsigned char* in;
+    const unsigned char* end;
+    uint64_t             acc;
+    int                  count;
+};
+
+static bool get_bits(BitReader* r, int width, uint64_t* v)
+{
+    *v = 0;
+    int shift = 0;
+    while (width > 0)
+    {
+        int n = (width < 32) ? width : 32;
+        while (r->count < n)
+        {
+            if (r->in == r->end) return (false);
+            r->acc |= (uint64_t)(*r->in++) << r->count;
+            r->count += 8;
+        }
+        *v |= (r->acc & ((1ULL << n) - 1)) << shift;
+        r->acc >>= n;
+        r->count -= n;
+        shift += n;
+        width -= n;
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+// quantization step of a column, 0 for the exact tick
+static double column_step(const BinLogPrecision& precision, int c)
+{
+    if (c == 0) return 0;
+    if (c == 1) return precision.time;
+    if (c < 5)  return precision.pos;
+    if (c < 8)  return precision.vel;
+    if (c < 11) return precision.force;
+    return precision.error;
+}
+
+static float* column_float(BinLogSample* s, int c)
+{
+    if (c < 5)  return &s->pos[c - 2];
+    if (c < 8)  return &s->vel[c - 5];
+    if (c < 11) return &s->force[c - 8];
+    return &s->errorPos[c - 11];
+}
+
+static float column_value(const BinLogSample& s, int c)
+{
+    return *column_float(const_cast<BinLogSample*>(&s), c);
+}
+
+//---------------------------------------------------------------------------
+
+static int64_t quantize(double v, double step)
+{
+    double q = v / step;
+    if (!(q > -9.0e18 && q < 9.0e18)) return (0);     // also NaN
+    return llround(q);
+}
+
+//---------------------------------------------------------------------------
+
+size_t codec_bound(int count)
+{
+    return CODEC_COLUMNS * (2 + 2 * VARINT_MAX + (size_t)count * 8 + 1);
+}
+
+//---------------------------------------------------------------------------
+
+size_t codec_encode(const BinLogPrecision& precision, const BinLogSample* samples, int count,
+                    unsigned char* out)
+{
+    unsigned char* start = out;
+    int64_t q[BINLOG_RECORDS_PER_CHUNK];
+    if (count > (int)BINLOG_RECORDS_PER_CHUNK) count = BINLOG_RECORDS_PER_CHUNK;
+
+    for (int c = 0; c < CODEC_COLUMNS; c++)
+    {
+        double step = column_step(precision, c);
+        for (int k = 0; k < count; k++)
+        {
+            if (c == 0)      q[k] = samples[k].tick;
+            else if (c == 1) q[k] = quantize(samples[k].time, step);
+            else             q[k] = quantize(column_value(samples[k], c), step);
+        }
+
+        // widest residual of either predictor
+        uint64_t any1 = 0;
+        uint64_t any2 = 0;
+        for (int k = 1; k < count; k++)
+        {
+            any1 |= zigzag(sub(q[k], q[k-1]));
+            if (k >= 2) any2 |= zigzag(sub(sub(q[k], q[k-1]), sub(q[k-1], q[k-2])));
+        }
+        int width1 = bit_width(any1);
+        int width2 = bit_width(any2);
+        int order = (count > 2 && width2 < width1) ? 2 : 1;
+        int width = (order == 2) ? width2 : width1;
+
+        *out++ = (unsigned char)order;
+        *out++ = (unsigned char)width;
+        if (count == 0) continue;
+        out = put_varint(out, zigzag(q[0]));
+        if (order == 2) out = put_varint(out, zigzag(sub(q[1], q[0])));
+
+        BitWriter w = { out, 0, 0 };
+        for (int k = order; k < count; k++)
+        {
+            int64_t r = sub(q[k], q[k-1]);
+            if (order == 2) r = sub(r, sub(q[k-1], q[k-2]));
+            put_bits(&w, zigzag(r), width);
+        }
+        flush_bits(&w);
+        out = w.out;
+    }
+    return (size_t)(out - start);
+}
+
+//---------------------------------------------------------------------------
+
+bool codec_decode(const BinLogPrecision& precision, const unsigned char* in, size_t size,
+                  BinLogSample* samples, int count)
+{
+    const unsigned char* end = in + size;
+    int64_t q[BINLOG_RECORDS_PER_CHUNK];
+    if (count > (int)BINLOG_RECORDS_PER_CHUNK) return (false);
+
+    for (int c = 0; c < CODEC_COLUMNS; c++)
+    {
+        if (end - in < 2) return (false);
+        int order = *in++;
+        int width = *in++;
+        if ((order != 1 && order != 2) || width > 64) return (false);
+        if (count == 0) continue;
+
+        uint64_t v;
+        if ((in = get_varint(in, end, &v)) == NULL) return (false);
+        q[0] = unzigzag(v);
+        if (order == 2)
+        {
+            if ((in = get_varint(in, end, &v)) == NULL) return (false);
+            q[1] = add(q[0], unzigzag(v));
+        }
+
+        BitReader r = { in, end, 0, 0 };
+        for (int k = order; k < count; k++)
+        {
+            if (!get_bits(&r, width, &v)) return (false);
+            int64_t d = unzigzag(v);
+            if (order == 2) d = add(d, sub(q[k-1], q[k-2]));
+            q[k] = add(q[k-1], d);
+        }
+        in = r.in;
+
+        double step = column_step(precision, c);
+        for (int k = 0; k < count; k++)
+        {
+            if (c == 0)      samples[k].tick = q[k];
+            else if (c == 1) samples[k].time = q[k] * step;
+            else             *column_float(&samples[k], c) = (float)(q[k] * step);
+        }
+    }
+    return (true);
+}
@@ -0,0 +1,55 @@
+//===========================================================================
+/*
+    binlog_codec.h
+
+    Compression of a chunk of binary log samples. The chunk is stored
+    column by column (tick, time, then the twelve float channels); every
+    column is quantized to its precision and predicted from the previous
+    samples:
+
+        order 1     r[k] = q[k] - q[k-1]                (quantized delta)
+        order 2     r[k] = q[k] - 2 q[k-1] + q[k-2]     (delta of delta)
+
+    whichever gives the smaller residuals in that chunk. The first values
+    are written as zigzag varints, the residuals zigzag bit-packed at the
+    width of the largest one. Ticks are exact and a steady servo clock
+    costs nothing (width 0); the signals of a smooth sweep take a few bits
+    per sample at the default precision.
+
+    Column layout:
+        uint8   order                   (1 or 2)
+        uint8   width                   residual bits (0..64)
+        varint  q[0]                    zigzag
+        varint  q[1] - q[0]             zigzag, order 2 only
+        bits    r[order] .. r[count-1]  width bits each, LSB first,
+                                        padded to a whole byte
+*/
+//===========================================================================
+#pragma once
+
+#include "binlog.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// tick, time, pos[3], vel[3], force[3], errorPos[3]
+const int CODEC_COLUMNS             = 14;
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// largest encoding of "count" samples [bytes]
+size_t codec_bound(int count);
+
+// encode "count" (<= BINLOG_RECORDS_PER_CHUNK) samples into "out", which
+// holds codec_bound(count) bytes; returns the bytes used
+size_t codec_encode(const BinLogPrecision& precision, const BinLogSample* samples, int count,
+                    unsigned char* out);
+
+// decode "count" samples from "size" bytes; false if the data is short
+// or malformed
+bool codec_decode(const BinLogPrecision& precision, const unsigned char* in, size_t size,
+                  BinLogSample* samples, int count);
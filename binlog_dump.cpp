@@ -0,0 +1,120 @@
+//===========================================================================
+/*
+    binlog_dump.cpp
+
+    Reader / converter for the binary log files written by 01-devices.
+    The file is memory mapped and the requested time window is located
+    through the chunk index, so only the samples inside it are touched.
+    Packed files are decoded one chunk at a time.
+
+    usage: binlog_dump <file> [-from <s>] [-to <s>] [-text] [-header]
+
+        -from, -to  time window in seconds (default: whole file)
+        -text       legacy "x y z t" rows (force and time), as in the old
+                    f<freq>.txt files
+        -header     print the file header only
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binlog.h"
+//---------------------------------------------------------------------------
+
+static void print_header(const BinLogReader& reader)
+{
+    const BinLogHeader* h = reader.header;
+    printf("# device   %s\n", h->device);
+    printf("# freq     %.4f Hz\n", h->freq);
+    printf("# gains    Kp %.3f  Kd %.3f  Ki %.3f\n", h->Kp, h->Kd, h->Ki);
+    printf("# servo    %.0f Hz\n", h->servoRate);
+    printf("# axes     x<-%d y<-%d z<-%d\n", h->axisMap[0], h->axisMap[1], h->axisMap[2]);
+    printf("# records  %llu in %llu chunks%s\n",
+           (unsigned long long)reader.numRecords, (unsigned long long)reader.numChunks,
+           (h->indexOffset != 0) ? "" : " (file was not closed, no index)");
+    if (reader.precision != NULL)
+    {
+        const BinLogPrecision* p = reader.precision;
+        printf("# packed   time %g s  pos %g m  vel %g m/s  force %g N  error %g m\n",
+               p->time, p->pos, p->vel, p->force, p->error);
+    }
+    if (reader.numRecords > 0)
+    {
+        printf("# time     %.6f .. %.6f s\n", binlog_sample(&reader, 0)->time,
+               binlog_sample(&reader, reader.numRecords - 1)->time);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: binlog_dump <file> [-from <s>] [-to <s>] [-text] [-header]\n");
+        return (1);
+    }
+
+    double from = -1e300;
+    double to = 1e300;
+    bool text = false;
+    bool headerOnly = false;
+    for (int a = 2; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-from") == 0 && a+1 < argc)
+            from = atof(argv[++a]);
+        else if (strcmp(argv[a], "-to") == 0 && a+1 < argc)
+            to = atof(argv[++a]);
+        else if (strcmp(argv[a], "-text") == 0)
+            text = true;
+        else if (strcmp(argv[a], "-header") == 0)
+            headerOnly = true;
+    }
+
+    BinLogReader reader;
+    if (!binlog_open_read(&reader, argv[1]))
+    {
+        printf("Could not read log file: %s\n", argv[1]);
+        return (1);
+    }
+
+    if (!text)
+    {
+        print_header(reader);
+    }
+    if (headerOnly)
+    {
+        binlog_close_read(&reader);
+        return (0);
+    }
+
+    if (!text)
+    {
+        printf("# tick\ttime\tpx\tpy\tpz\tvx\tvy\tvz\tfx\tfy\tfz\tex\tey\tez\n");
+    }
+
+    for (uint64_t k = binlog_seek(&reader, from); k < reader.numRecords; k++)
+    {
+        const BinLogSample* s = binlog_sample(&reader, k);
+        if (s->time > to) break;
+
+        if (text)
+        {
+            printf("%.5f %.5f %.5f %.5f\n", s->force[0], s->force[1], s->force[2], s->time);
+        }
+        else
+        {
+            printf("%lld\t%.6f\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g\n",
+                   (long long)s->tick, s->time,
+                   s->pos[0], s->pos[1], s->pos[2],
+                   s->vel[0], s->vel[1], s->vel[2],
+                   s->force[0], s->force[1], s->force[2],
+                   s->errorPos[0], s->errorPos[1], s->errorPos[2]);
+        }
+    }
+
+    binlog_close_read(&reader);
+    return (0);
+}
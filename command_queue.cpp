@@ -0,0 +1,63 @@
+//===========================================================================
+/*
+    command_queue.cpp
+
+    Parameter changes from the user interface to the servo loop.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "command_queue.h"
+#include "spsc_ring.h"
+//---------------------------------------------------------------------------
+
+static SpscRing<ParamCommand, COMMAND_QUEUE_SIZE> commands;
+
+//---------------------------------------------------------------------------
+
+bool command_post(int param, int op, double value)
+{
+    if (param < 0 || param >= PARAM_COUNT) return (false);
+
+    ParamCommand command;
+    command.param = param;
+    command.op = op;
+    command.value = value;
+    return commands.push(command);
+}
+
+//---------------------------------------------------------------------------
+
+bool command_pop(ParamCommand* command)
+{
+    return commands.pop(*command);
+}
+
+//---------------------------------------------------------------------------
+
+double command_apply(const ParamCommand& command, double current)
+{
+    switch (command.op)
+    {
+        case COMMAND_SET:
+            return command.value;
+        case COMMAND_ADD:
+            return current + command.value;
+        case COMMAND_TOGGLE:
+            return (current != 0) ? 0.0 : 1.0;
+    }
+    return current;
+}
+
+//---------------------------------------------------------------------------
+
+static const char* paramNames[PARAM_COUNT] =
+{
+    "Kp", "Ki", "Kd", "enable_haptics", "force_field",
+    "test_force_0", "test_force_1", "test_force_2"
+};
+
+const char* command_param_name(int param)
+{
+    return (param >= 0 && param < PARAM_COUNT) ? paramNames[param] : "unknown";
+}
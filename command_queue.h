@@ -0,0 +1,69 @@
+//===========================================================================
+/*
+    command_queue.h
+
+    Parameter changes from the user interface to the servo loop. The GLUT
+    thread posts commands into a bounded lock-free queue instead of writing
+    the gains and modes directly; the servo loop drains the queue at the
+    start of each tick, so every change takes effect between two ticks and
+    never in the middle of a force computation.
+
+    Commands are relative where the key is (add to Kp, toggle a mode), so
+    two quick key presses are never lost to a stale read of the value.
+    There is a single producer thread (the GLUT thread) and a single
+    consumer (the servo loop).
+*/
+//===========================================================================
+#pragma once
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// parameters
+const int PARAM_KP                  = 0;
+const int PARAM_KI                  = 1;
+const int PARAM_KD                  = 2;
+const int PARAM_ENABLE_HAPTICS      = 3;
+const int PARAM_FORCE_FIELD         = 4;
+const int PARAM_TEST_FORCE_0        = 5;    // constant test force of device 1,
+const int PARAM_TEST_FORCE_1        = 6;    // HDAL axes 0..2 [N]
+const int PARAM_TEST_FORCE_2        = 7;
+const int PARAM_COUNT               = 8;
+
+// operations
+const int COMMAND_SET               = 0;
+const int COMMAND_ADD               = 1;
+const int COMMAND_TOGGLE            = 2;    // flags only
+
+// queued commands, far more than a user can type between two ticks
+const unsigned COMMAND_QUEUE_SIZE   = 64;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct ParamCommand
+{
+    int    param;
+    int    op;
+    double value;
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// GLUT thread: queue a change, returns false if the queue is full
+bool command_post(int param, int op, double value);
+
+// servo thread: next queued change, false if there is none
+bool command_pop(ParamCommand* command);
+
+// value of a parameter after a command (flags are 0 or 1)
+double command_apply(const ParamCommand& command, double current);
+
+// parameter name for logs, e.g. "Kp", "force_field"
+const char* command_param_name(int param);
@@ -0,0 +1,215 @@
+//===========================================================================
+/*
+    coupling.cpp
+
+    Coupling graph of a multi-device session.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "coupling.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+// an edge list before it is sorted into rows
+struct EdgeList
+{
+    int    count;
+    int    from[COUPLING_MAX_EDGES];
+    int    to[COUPLING_MAX_EDGES];
+    double weight[COUPLING_MAX_EDGES];
+};
+
+//---------------------------------------------------------------------------
+
+static bool add_edge(EdgeList* list, int from, int to, double weight)
+{
+    if (from == to) return (false);
+    for (int e = 0; e < list->count; e++)
+    {
+        if (list->from[e] == from && list->to[e] == to) return (false);
+    }
+    if (list->count == COUPLING_MAX_EDGES) return (false);
+
+    list->from[list->count] = from;
+    list->to[list->count] = to;
+    list->weight[list->count] = weight;
+    list->count++;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+// compressed rows of the edge list, in device order and, within a row,
+// in the order the edges were added
+static void build_rows(CouplingGraph* graph, const EdgeList* list)
+{
+    memset(graph->first, 0, sizeof(graph->first));
+    for (int e = 0; e < list->count; e++)
+    {
+        graph->first[list->from[e] + 1]++;
+    }
+    for (int i = 0; i < graph->numDevices; i++)
+    {
+        graph->first[i + 1] += graph->first[i];
+    }
+
+    int next[COUPLING_MAX_DEVICES];
+    memcpy(next, graph->first, sizeof(next));
+    for (int e = 0; e < list->count; e++)
+    {
+        int slot = next[list->from[e]]++;
+        graph->target[slot] = list->to[e];
+        graph->weight[slot] = list->weight[e];
+    }
+    graph->numEdges = list->count;
+}
+
+//---------------------------------------------------------------------------
+
+bool coupling_init(CouplingGraph* graph, int topology, int numDevices)
+{
+    memset(graph, 0, sizeof(CouplingGraph));
+    if (numDevices < 1 || numDevices > COUPLING_MAX_DEVICES) return (false);
+    graph->topology = topology;
+    graph->numDevices = numDevices;
+
+    EdgeList list;
+    list.count = 0;
+    for (int i = 0; i < numDevices; i++)
+    {
+        switch (topology)
+        {
+            case COUPLING_STAR:
+                if (i == 0)
+                {
+                    for (int j = 1; j < numDevices; j++) add_edge(&list, 0, j, 1.0);
+                }
+                else
+                {
+                    add_edge(&list, i, 0, 1.0);
+                }
+                break;
+
+            // with two devices both neighbours are the same one
+            case COUPLING_RING:
+                add_edge(&list, i, (i + 1) % numDevices, 1.0);
+                add_edge(&list, i, (i + numDevices - 1) % numDevices, 1.0);
+                break;
+
+            case COUPLING_ALL:
+                for (int j = 0; j < numDevices; j++) add_edge(&list, i, j, 1.0);
+                break;
+
+            default:
+                return (false);
+        }
+    }
+    build_rows(graph, &list);
+
+    // each device follows the mean of its neighbours
+    for (int i = 0; i < numDevices; i++)
+    {
+        int degree = graph->first[i + 1] - graph->first[i];
+        for (int e = graph->first[i]; e < graph->first[i + 1]; e++)
+        {
+            graph->weight[e] = 1.0 / degree;
+        }
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool coupling_parse(CouplingGraph* graph, const char* edges, int numDevices)
+{
+    memset(graph, 0, sizeof(CouplingGraph));
+    if (numDevices < 1 || numDevices > COUPLING_MAX_DEVICES) return (false);
+    graph->topology = COUPLING_EDGES;
+    graph->numDevices = numDevices;
+
+    EdgeList list;
+    list.count = 0;
+    const char* p = edges;
+    while (*p != 0)
+    {
+        char* end;
+        int i = (int)strtol(p, &end, 10);
+        if (end == p || *end != '-') return (false);
+        p = end + 1;
+        int j = (int)strtol(p, &end, 10);
+        if (end == p) return (false);
+        p = end;
+
+        double w = 1.0;
+        if (*p == ':')
+        {
+            w = strtod(p + 1, &end);
+            if (end == p + 1) return (false);
+            p = end;
+        }
+        if (*p == ',') p++;
+        else if (*p != 0) return (false);
+
+        if (i < 0 || i >= numDevices || j < 0 || j >= numDevices) return (false);
+        if (!add_edge(&list, i, j, w) || !add_edge(&list, j, i, w)) return (false);
+    }
+    build_rows(graph, &list);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void coupling_error(const CouplingGraph* graph, int device, const CouplingState* state,
+                    const cVector3d& position, const cVector3d& velocity,
+                    cVector3d& errorPosition, cVector3d& errorVelocity)
+{
+    errorPosition.zero();
+    errorVelocity.zero();
+    for (int e = graph->first[device]; e < graph->first[device + 1]; e++)
+    {
+        int j = graph->target[e];
+        double w = graph->weight[e];
+        errorPosition += w * (position - state->pos[j]);
+        errorVelocity += w * (velocity - state->vel[j]);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static const char* couplingNames[] = { "star", "ring", "all", "edges" };
+
+int coupling_topology(const char* name)
+{
+    for (int t = 0; t < 4; t++)
+    {
+        if (strcmp(name, couplingNames[t]) == 0) return t;
+    }
+    return (-1);
+}
+
+//---------------------------------------------------------------------------
+
+const char* coupling_name(int topology)
+{
+    return (topology >= 0 && topology < 4) ? couplingNames[topology] : "unknown";
+}
+
+//---------------------------------------------------------------------------
+
+void coupling_print(const CouplingGraph* graph)
+{
+    printf("Coupling %s, %d devices, %d edges\n",
+           coupling_name(graph->topology), graph->numDevices, graph->numEdges);
+    for (int i = 0; i < graph->numDevices; i++)
+    {
+        printf("  #%d ->", i);
+        for (int e = graph->first[i]; e < graph->first[i + 1]; e++)
+        {
+            printf(" %d (%.3g)", graph->target[e], graph->weight[e]);
+        }
+        printf("\n");
+    }
+}
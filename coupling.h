@@ -0,0 +1,89 @@
+//===========================================================================
+/*
+    coupling.h
+
+    Coupling graph of a multi-device session. Each device is pulled
+    towards its neighbours with the PID of teleop.h applied to the
+    weighted sum of its errors to them:
+
+        errorPosition(i) = sum over edges i->j of w(i,j) * (pos(i) - pos(j))
+
+    and the same for the velocity. The edges are kept in compressed rows
+    (the edges of device i are first[i] .. first[i+1]-1), so a tick costs
+    one pass over the edges and nothing else.
+
+        COUPLING_STAR       device 0 (the trainer) to every other device
+        COUPLING_RING       each device to the next and the previous one
+        COUPLING_ALL        every device to every other device
+        COUPLING_EDGES      explicit weighted edges, see coupling_parse()
+
+    The built-in topologies weight the edges of a device by 1 / its number
+    of neighbours, so a device follows the mean of its neighbours and the
+    loop gain does not grow with the number of devices. With two devices
+    all three are the original master/slave pair.
+*/
+//===========================================================================
+#pragma once
+
+#include "math/CVector3d.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// topologies
+const int COUPLING_STAR             = 0;
+const int COUPLING_RING             = 1;
+const int COUPLING_ALL              = 2;
+const int COUPLING_EDGES            = 3;
+
+const int COUPLING_MAX_DEVICES      = 8;
+const int COUPLING_MAX_EDGES        = COUPLING_MAX_DEVICES * (COUPLING_MAX_DEVICES - 1);
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct CouplingGraph
+{
+    int    topology;
+    int    numDevices;
+    int    numEdges;
+    int    first[COUPLING_MAX_DEVICES + 1];
+    int    target[COUPLING_MAX_EDGES];
+    double weight[COUPLING_MAX_EDGES];
+};
+
+// per-device state read by the coupling, one array per quantity
+struct CouplingState
+{
+    cVector3d pos[COUPLING_MAX_DEVICES];        // last position [m]
+    cVector3d vel[COUPLING_MAX_DEVICES];        // last velocity [m/s]
+    cVector3d integral[COUPLING_MAX_DEVICES];   // accumulated position error [m]
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// build a star, ring or all-to-all graph
+bool coupling_init(CouplingGraph* graph, int topology, int numDevices);
+
+// build a graph from edges "i-j[:w],...", each one coupling i and j both
+// ways with weight w (default 1), e.g. "0-1,0-2:0.5,1-2:0.25"
+bool coupling_parse(CouplingGraph* graph, const char* edges, int numDevices);
+
+// weighted errors of a device to its neighbours; "position" and
+// "velocity" are its new sample, the neighbours are read from "state"
+void coupling_error(const CouplingGraph* graph, int device, const CouplingState* state,
+                    const cVector3d& position, const cVector3d& velocity,
+                    cVector3d& errorPosition, cVector3d& errorVelocity);
+
+// topology from / to its name: "star", "ring", "all", "edges"
+int coupling_topology(const char* name);
+const char* coupling_name(int topology);
+
+// print the edges, one row per device
+void coupling_print(const CouplingGraph* graph);
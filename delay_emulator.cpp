@@ -0,0 +1,248 @@
+//===========================================================================
+/*
+    delay_emulator.cpp
+
+    Emulated delay, jitter, loss and reordering between the devices.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "delay_emulator.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+static const double pi = 3.141592653589793;
+
+//---------------------------------------------------------------------------
+
+// xorshift64*, uniform in [0, 1)
+static double uniform(DelayEmulator* e)
+{
+    e->rng ^= e->rng >> 12;
+    e->rng ^= e->rng << 25;
+    e->rng ^= e->rng >> 27;
+    return (double)((e->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//---------------------------------------------------------------------------
+
+// standard normal, Box-Muller, two values per pair of draws
+static double normal(DelayEmulator* e)
+{
+    if (e->haveSpare)
+    {
+        e->haveSpare = false;
+        return e->spare;
+    }
+    double u = 1.0 - uniform(e);    // (0, 1], log() stays finite
+    double v = uniform(e);
+    double r = sqrt(-2.0 * log(u));
+    e->spare = r * sin(2.0 * pi * v);
+    e->haveSpare = true;
+    return r * cos(2.0 * pi * v);
+}
+
+//---------------------------------------------------------------------------
+
+// heap order: earlier delivery first, then push order
+static bool before(const DelayedSample& a, const DelayedSample& b)
+{
+    if (a.deliverAt != b.deliverAt) return (a.deliverAt < b.deliverAt);
+    return (a.order < b.order);
+}
+
+//---------------------------------------------------------------------------
+
+static void sift_up(DelayedSample* heap, int k)
+{
+    DelayedSample item = heap[k];
+    while (k > 0)
+    {
+        int parent = (k - 1) / 2;
+        if (!before(item, heap[parent])) break;
+        heap[k] = heap[parent];
+        k = parent;
+    }
+    heap[k] = item;
+}
+
+//---------------------------------------------------------------------------
+
+static void sift_down(DelayedSample* heap, int count, int k)
+{
+    DelayedSample item = heap[k];
+    while (true)
+    {
+        int child = 2 * k + 1;
+        if (child >= count) break;
+        if (child + 1 < count && before(heap[child + 1], heap[child])) child++;
+        if (!before(heap[child], item)) break;
+        heap[k] = heap[child];
+        k = child;
+    }
+    heap[k] = item;
+}
+
+//---------------------------------------------------------------------------
+
+bool delay_init(DelayEmulator* emulator, int numDevices, double delay)
+{
+    if (numDevices < 1 || numDevices > DELAY_MAX_DEVICES || delay < 0) return (false);
+
+    emulator->jitterType  = DELAY_JITTER_NONE;
+    emulator->numDevices  = numDevices;
+    emulator->delay       = delay;
+    emulator->jitter      = 0;
+    emulator->lossRate    = 0;
+    emulator->reorderRate = 0;
+    emulator->reorderHold = 0;
+    emulator->trace.clear();
+    emulator->traceNext   = 0;
+    emulator->rng         = DELAY_DEFAULT_SEED;
+    emulator->haveSpare   = false;
+    emulator->spare       = 0;
+    emulator->count       = 0;
+    emulator->order       = 0;
+
+    // touch the whole queue now rather than from the servo loop
+    memset(emulator->queue, 0, sizeof(emulator->queue));
+    memset(emulator->stats, 0, sizeof(emulator->stats));
+    for (int d = 0; d < DELAY_MAX_DEVICES; d++)
+    {
+        emulator->newestTick[d] = -1;
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool delay_load_trace(DelayEmulator* emulator, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return (false);
+
+    std::vector<double> trace;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char* end;
+        double ms = strtod(line, &end);
+        if (end == line) continue;          // blank line or comment
+        trace.push_back(ms / 1000.0);
+    }
+    fclose(file);
+    if (trace.empty()) return (false);
+
+    emulator->trace.swap(trace);
+    emulator->traceNext = 0;
+    emulator->jitterType = DELAY_JITTER_TRACE;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void delay_push(DelayEmulator* emulator, int device, long long tick, double now,
+                const cVector3d& position, const cVector3d& velocity)
+{
+    DelayStats& stats = emulator->stats[device];
+    stats.sent++;
+
+    if (emulator->lossRate > 0 && uniform(emulator) < emulator->lossRate)
+    {
+        stats.lost++;
+        return;
+    }
+
+    double delay = emulator->delay;
+    if (emulator->jitterType == DELAY_JITTER_GAUSS)
+    {
+        delay += emulator->jitter * normal(emulator);
+    }
+    else if (emulator->jitterType == DELAY_JITTER_TRACE)
+    {
+        delay += emulator->trace[emulator->traceNext];
+        if (++emulator->traceNext == emulator->trace.size()) emulator->traceNext = 0;
+    }
+    if (emulator->reorderRate > 0 && uniform(emulator) < emulator->reorderRate)
+    {
+        delay += emulator->reorderHold;
+    }
+    if (delay < 0) delay = 0;
+
+    if (emulator->count == DELAY_QUEUE_SIZE)
+    {
+        stats.overflow++;
+        return;
+    }
+
+    DelayedSample& sample = emulator->queue[emulator->count];
+    sample.deliverAt = now + delay;
+    sample.sentAt = now;
+    sample.order = emulator->order++;
+    sample.tick = tick;
+    sample.device = device;
+    sample.pos[0] = position.x;  sample.pos[1] = position.y;  sample.pos[2] = position.z;
+    sample.vel[0] = velocity.x;  sample.vel[1] = velocity.y;  sample.vel[2] = velocity.z;
+    sift_up(emulator->queue, emulator->count++);
+}
+
+//---------------------------------------------------------------------------
+
+int delay_deliver(DelayEmulator* emulator, double now, CouplingState* state)
+{
+    int delivered = 0;
+    DelayedSample* heap = emulator->queue;
+    while (emulator->count > 0 && heap[0].deliverAt <= now)
+    {
+        const DelayedSample sample = heap[0];
+        heap[0] = heap[--emulator->count];
+        if (emulator->count > 0) sift_down(heap, emulator->count, 0);
+
+        int d = sample.device;
+        DelayStats& stats = emulator->stats[d];
+        if (sample.tick <= emulator->newestTick[d])
+        {
+            stats.stale++;
+            continue;
+        }
+        emulator->newestTick[d] = sample.tick;
+
+        state->pos[d].set(sample.pos[0], sample.pos[1], sample.pos[2]);
+        state->vel[d].set(sample.vel[0], sample.vel[1], sample.vel[2]);
+
+        stats.delivered++;
+        double ms = (now - sample.sentAt) * 1000.0;
+        stats.delayMean += (ms - stats.delayMean) / stats.delivered;
+        if (ms > stats.delayMax) stats.delayMax = ms;
+        delivered++;
+    }
+    return delivered;
+}
+
+//---------------------------------------------------------------------------
+
+void delay_print_config(const DelayEmulator* emulator, FILE* out)
+{
+    fprintf(out, "Delay emulation: %.2f ms", emulator->delay * 1000.0);
+    if (emulator->jitterType == DELAY_JITTER_GAUSS)
+        fprintf(out, ", jitter %.2f ms (Gaussian)", emulator->jitter * 1000.0);
+    else if (emulator->jitterType == DELAY_JITTER_TRACE)
+        fprintf(out, ", jitter trace of %d samples", (int)emulator->trace.size());
+    fprintf(out, ", loss %.2f %%, reorder %.2f %% by %.2f ms\n",
+            emulator->lossRate * 100.0, emulator->reorderRate * 100.0, emulator->reorderHold * 1000.0);
+}
+
+//---------------------------------------------------------------------------
+
+void delay_print_stats(const DelayEmulator* emulator, FILE* out)
+{
+    for (int d = 0; d < emulator->numDevices; d++)
+    {
+        const DelayStats& s = emulator->stats[d];
+        fprintf(out, "  #%d  delay mean %.2f ms, max %.2f ms  sent %lld  delivered %lld"
+                     "  lost %lld  stale %lld  overflow %lld\n",
+                d, s.delayMean, s.delayMax, s.sent, s.delivered, s.lost, s.stale, s.overflow);
+    }
+}
@@ -0,0 +1,127 @@
+//===========================================================================
+/*
+    delay_emulator.h
+
+    Emulated communication channel between the devices of a session, to
+    see how the coupling behaves before it runs over a real link. Every
+    sample a device publishes (position and velocity, once per tick) is
+    queued with a delivery time and handed to the coupling when that time
+    has come:
+
+        delivery = send time + delay + jitter (+ hold if reordered)
+
+        DELAY_JITTER_NONE       fixed delay only
+        DELAY_JITTER_GAUSS      normally distributed jitter, the total
+                                delay is clipped at zero
+        DELAY_JITTER_TRACE      jitter read from a file of delays [ms],
+                                one per line, replayed in a loop
+
+    A sample is lost with probability lossRate, and held back for an
+    extra reorderHold with probability reorderRate so that the samples
+    after it overtake it. As on a real link (see transport.h) a sample
+    older than the newest one delivered for its device is dropped.
+
+    The queue is a binary heap on the delivery time in a fixed array, so
+    a tick costs a push per device and a pop per delivery and nothing
+    allocates after init. The random numbers come from a seeded generator
+    of its own, so a virtual-time run repeats bit for bit.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "coupling.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// jitter types
+const int DELAY_JITTER_NONE         = 0;
+const int DELAY_JITTER_GAUSS        = 1;
+const int DELAY_JITTER_TRACE        = 2;
+
+const int DELAY_MAX_DEVICES         = COUPLING_MAX_DEVICES;
+
+// samples in flight, e.g. 2 devices for 4 s at 1 kHz
+const int DELAY_QUEUE_SIZE          = 8192;
+
+// seed of the loss, jitter and reorder draws
+const uint64_t DELAY_DEFAULT_SEED   = 0x2545F4914F6CDD1DULL;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct DelayedSample
+{
+    double    deliverAt;        // [s], emulator clock
+    double    sentAt;           // [s]
+    uint64_t  order;            // push order, breaks ties in deliverAt
+    long long tick;             // servo tick of the sample
+    int       device;
+    double    pos[3];
+    double    vel[3];
+};
+
+struct DelayStats
+{
+    long long sent;
+    long long delivered;
+    long long lost;             // dropped by the loss draw
+    long long stale;            // overtaken by a newer sample, dropped
+    long long overflow;         // queue full, dropped
+    double    delayMean;        // delay of the delivered samples [ms]
+    double    delayMax;
+};
+
+struct DelayEmulator
+{
+    int    jitterType;
+    int    numDevices;
+    double delay;               // fixed one-way delay [s]
+    double jitter;              // Gaussian standard deviation [s]
+    double lossRate;            // probability of losing a sample
+    double reorderRate;         // probability of holding a sample back
+    double reorderHold;         // time it is held back [s]
+
+    std::vector<double> trace;  // jitter trace [s]
+    size_t traceNext;
+
+    uint64_t rng;
+    bool     haveSpare;         // second value of the last Box-Muller pair
+    double   spare;
+
+    DelayedSample queue[DELAY_QUEUE_SIZE];
+    int      count;
+    uint64_t order;
+
+    long long  newestTick[DELAY_MAX_DEVICES];
+    DelayStats stats[DELAY_MAX_DEVICES];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// set up a channel with a fixed delay [s], no jitter, loss or reordering
+bool delay_init(DelayEmulator* emulator, int numDevices, double delay);
+
+// read a jitter trace (one delay [ms] per line, '#' starts a comment)
+// and switch to DELAY_JITTER_TRACE
+bool delay_load_trace(DelayEmulator* emulator, const char* path);
+
+// send the sample of a device at "now" [s]
+void delay_push(DelayEmulator* emulator, int device, long long tick, double now,
+                const cVector3d& position, const cVector3d& velocity);
+
+// hand every sample due at "now" to "state"; returns the number delivered
+int delay_deliver(DelayEmulator* emulator, double now, CouplingState* state);
+
+// one line of settings, then one line of figures per device
+void delay_print_config(const DelayEmulator* emulator, FILE* out);
+void delay_print_stats(const DelayEmulator* emulator, FILE* out);
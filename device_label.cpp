@@ -0,0 +1,70 @@
+//===========================================================================
+/*
+    device_label.cpp
+
+    Per-device label text of the graphics window.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "device_label.h"
+#include <math.h>
+#include <stdio.h>
+//---------------------------------------------------------------------------
+
+// digits after the point of each value, as the label used to show them
+static const int digits[DEVICE_LABEL_VALUES] = { 5, 5, 5, 2, 2, 2, 2, 0, 2, 0, 2, 1, 3, 1 };
+static const double scale[DEVICE_LABEL_VALUES] = { 1e5, 1e5, 1e5, 1e2, 1e2, 1e2, 1e2,
+                                                   1, 1e2, 1, 1e2, 1e1, 1e3, 1e1 };
+
+static const double deg = 180.0 / 3.141592653589793;
+
+//---------------------------------------------------------------------------
+
+bool device_label_update(DeviceLabel* label, int device, const double force[3],
+                         double time, double Kp, double Ki, double Kd,
+                         const FreqResponseEstimate* response)
+{
+    double values[DEVICE_LABEL_VALUES] = { force[0], force[1], force[2], time, Kp, Ki, Kd,
+                                           0, 0, 0, 0, 0, 0, 0 };
+    if (response != NULL)
+    {
+        int a = response->axis;
+        values[7]  = 1;
+        values[8]  = response->freq;
+        values[9]  = a;
+        values[10] = response->posAmp[a] * 1000.0;
+        values[11] = response->posPhase[a] * deg;
+        values[12] = response->forceAmp[a];
+        values[13] = response->forcePhase[a] * deg;
+    }
+
+    bool changed = !label->valid;
+    for (int k = 0; k < DEVICE_LABEL_VALUES; k++)
+    {
+        long long shown = llround(values[k] * scale[k]);
+        if (shown != label->shown[k])
+        {
+            label->shown[k] = shown;
+            changed = true;
+        }
+    }
+    if (!changed) return (false);
+
+    int length = snprintf(label->text, sizeof(label->text),
+                          "#%d  x: %.*f   y: %.*f  z: %.*f  t: %.*f  Kp: %.*f  Ki: %.*f  Kd: %.*f",
+                          device,
+                          digits[0], values[0], digits[1], values[1], digits[2], values[2],
+                          digits[3], values[3], digits[4], values[4], digits[5], values[5],
+                          digits[6], values[6]);
+    if (response != NULL && length > 0 && length < (int)sizeof(label->text))
+    {
+        snprintf(label->text + length, sizeof(label->text) - length,
+                 "  %.*f Hz %c: %.*f mm %.*f deg  %.*f N %.*f deg",
+                 digits[8], values[8], "xyz"[response->axis],
+                 digits[10], values[10], digits[11], values[11],
+                 digits[12], values[12], digits[13], values[13]);
+    }
+    label->valid = true;
+    return (true);
+}
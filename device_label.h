@@ -0,0 +1,51 @@
+//===========================================================================
+/*
+    device_label.h
+
+    Text of the per-device label of the graphics window: force, time,
+    gains and the running frequency response (amplitude and phase of the
+    position and the force on the axis that moves most). The text lives
+    in a fixed buffer and is formatted again only when one of the values
+    changes at the precision it is shown with, so a frame in which
+    nothing visible changed costs a few comparisons and no formatting or
+    allocation.
+*/
+//===========================================================================
+#pragma once
+
+#include "freq_response.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// longest label, including the terminating zero
+const int DEVICE_LABEL_SIZE         = 224;
+
+// values shown: force x, y, z, time, Kp, Ki, Kd, then whether there is a
+// response, its frequency, axis, position amplitude [mm] and phase [deg],
+// force amplitude [N] and phase [deg]
+const int DEVICE_LABEL_VALUES       = 14;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct DeviceLabel
+{
+    bool      valid;                        // text has been formatted once
+    long long shown[DEVICE_LABEL_VALUES];   // values in units of their last digit
+    char      text[DEVICE_LABEL_SIZE];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// bring the text up to date, "response" NULL if there is none yet; true
+// if it changed
+bool device_label_update(DeviceLabel* label, int device, const double force[3],
+                         double time, double Kp, double Ki, double Kd,
+                         const FreqResponseEstimate* response);
@@ -0,0 +1,272 @@
+//===========================================================================
+/*
+    falcon_device.cpp
+
+    Device backends for the haptic loop.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "falcon_device.h"
+#include "falcon_kinematics.h"
+#include <math.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+#if defined(FALCON_HAS_HDAL)
+#include <hdl/hdl.h>
+#include <hdlu/hdlu.h>
+#endif
+//---------------------------------------------------------------------------
+
+#if defined(FALCON_HAS_HDAL)
+
+//---------------------------------------------------------------------------
+// HDAL BACKEND
+//---------------------------------------------------------------------------
+
+class HdalBackend : public FalconBackend
+{
+  public:
+
+    HdalBackend()
+    {
+        for (int i = 0; i < FALCON_MAX_DEVICES; i++)
+        {
+            m_handles[i] = HDL_INVALID_HANDLE;
+        }
+    }
+
+    const char* getName() { return "HDAL"; }
+
+    int getNumDevices() { return hdlCountDevices(); }
+
+    bool open(int index)
+    {
+        m_handles[index] = hdlInitIndexedDevice(index);
+        return (m_handles[index] != HDL_INVALID_HANDLE);
+    }
+
+    void close(int index)
+    {
+        hdlUninitDevice(m_handles[index]);
+        m_handles[index] = HDL_INVALID_HANDLE;
+    }
+
+    void start() { hdlStart(); }
+    void stop()  { hdlStop(); }
+
+    void getPosition(int index, double position[3])
+    {
+        hdlMakeCurrent(m_handles[index]);
+        hdlToolPosition(position);
+    }
+
+    void setForce(int index, const double force[3])
+    {
+        double f[3] = { force[0], force[1], force[2] };
+        hdlMakeCurrent(m_handles[index]);
+        hdlSetToolForce(f);
+    }
+
+  private:
+
+    HDLDeviceHandle m_handles[FALCON_MAX_DEVICES];
+};
+
+FalconBackend* falcon_create_hdal_backend()
+{
+    return new HdalBackend();
+}
+
+#else
+
+FalconBackend* falcon_create_hdal_backend()
+{
+    return NULL;
+}
+
+#endif
+
+//---------------------------------------------------------------------------
+// SIMULATED BACKEND
+//---------------------------------------------------------------------------
+
+// gaps in the time base longer than this are skipped rather than integrated
+static const double SIM_MAX_GAP = 0.1;
+
+//---------------------------------------------------------------------------
+
+SimFalconBackend::SimFalconBackend(int numDevices)
+{
+    m_numDevices = (numDevices < FALCON_MAX_DEVICES) ? numDevices : FALCON_MAX_DEVICES;
+
+    m_mass    = 0.15;
+    m_damping = 2.0;
+    m_gravity = 0.0;
+    m_maxStep = 0.0001;
+
+    memset(m_devices, 0, sizeof(m_devices));
+
+    // the first operator moves the grip side to side, the others hold
+    // their grips loosely
+    for (int i = 0; i < FALCON_MAX_DEVICES; i++)
+    {
+        SimHand& hand = m_devices[i].hand;
+        hand.freq      = 1.0;
+        hand.stiffness = (i == 0) ? 300.0 : 50.0;
+        hand.damping   = (i == 0) ? 5.0 : 1.0;
+        if (i == 0)
+        {
+            hand.amplitude[0] = 0.02;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool SimFalconBackend::open(int index)
+{
+    if (index < 0 || index >= m_numDevices) return (false);
+
+    // start at rest, in the hand's rest position
+    SimFalcon& dev = m_devices[index];
+    for (int k = 0; k < 3; k++)
+    {
+        dev.pos[k]   = dev.hand.center[k];
+        dev.vel[k]   = 0;
+        dev.force[k] = 0;
+    }
+    dev.limitHits = 0;
+    dev.peakSpeed = 0;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::start()
+{
+    for (int i = 0; i < m_numDevices; i++)
+    {
+        m_devices[i].running = true;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::stop()
+{
+    for (int i = 0; i < m_numDevices; i++)
+    {
+        m_devices[i].running = false;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::update(int index, double time)
+{
+    SimFalcon* dev = &m_devices[index];
+    double gap = time - dev->time;
+
+    // not running, clock reset or long pause: resynchronize only
+    if (!dev->running || gap <= 0 || gap > SIM_MAX_GAP)
+    {
+        dev->time = time;
+        return;
+    }
+
+    int steps = (int)ceil(gap / m_maxStep);
+    double dt = gap / steps;
+    for (int n = 0; n < steps; n++)
+    {
+        step(dev, dt);
+    }
+    dev->time = time;
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::step(SimFalcon* dev, double dt)
+{
+    const SimHand& hand = dev->hand;
+    double w = 2.0 * 3.141592653589793 * hand.freq;
+    double s = sin(w * dev->time + hand.phase);
+    double c = cos(w * dev->time + hand.phase);
+
+    // semi-implicit Euler: velocity first, then position with the new velocity
+    double newPos[3];
+    for (int k = 0; k < 3; k++)
+    {
+        double target    = hand.center[k] + hand.amplitude[k] * s;
+        double targetVel = hand.amplitude[k] * w * c;
+
+        double f = dev->force[k]
+                 + hand.stiffness * (target - dev->pos[k])
+                 + hand.damping * (targetVel - dev->vel[k])
+                 - m_damping * dev->vel[k];
+        if (k == 1)
+        {
+            f -= m_mass * m_gravity;
+        }
+
+        dev->vel[k] += f / m_mass * dt;
+        newPos[k] = dev->pos[k] + dev->vel[k] * dt;
+    }
+
+    // the mechanism stops dead at the edge of the workspace
+    // (application frame: x = HDAL z, y = HDAL x, z = HDAL y)
+    if (falcon_in_workspace(cVector3d(newPos[2], newPos[0], newPos[1])))
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            dev->pos[k] = newPos[k];
+        }
+    }
+    else
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            dev->vel[k] = 0;
+        }
+        dev->limitHits++;
+    }
+
+    double speed = sqrt(dev->vel[0]*dev->vel[0] + dev->vel[1]*dev->vel[1] + dev->vel[2]*dev->vel[2]);
+    if (speed > dev->peakSpeed)
+    {
+        dev->peakSpeed = speed;
+    }
+
+    dev->time += dt;
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::getPosition(int index, double position[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        position[k] = m_devices[index].pos[k];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::setForce(int index, const double force[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        m_devices[index].force[k] = force[k];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SimFalconBackend::printStats(FILE* out)
+{
+    for (int i = 0; i < m_numDevices; i++)
+    {
+        fprintf(out, "sim: device %d peak speed %.3f m/s, %lld workspace limit hits\n",
+                i, m_devices[i].peakSpeed, m_devices[i].limitHits);
+    }
+}
@@ -0,0 +1,138 @@
+//===========================================================================
+/*
+    falcon_device.h
+
+    Device backends for the haptic loop. FalconBackend hides whether the
+    tool positions come from real Falcons through HDAL or from a simulated
+    plant, so the coupling in updateHaptics() runs unchanged on machines
+    without the devices or the HDAL SDK.
+
+    All positions and forces use the HDAL axis order (x right, y up,
+    z towards the user), in meters and newtons.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+
+//---------------------------------------------------------------------------
+// HDAL is only available with the Novint SDK on Windows
+#if defined(_WIN32) && !defined(FALCON_NO_HDAL)
+#define FALCON_HAS_HDAL
+#endif
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// maximum number of devices of a backend
+const int FALCON_MAX_DEVICES = 8;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+class FalconBackend
+{
+  public:
+
+    virtual ~FalconBackend() {}
+
+    virtual const char* getName() = 0;
+
+    // number of devices that can be opened
+    virtual int getNumDevices() = 0;
+
+    virtual bool open(int index) = 0;
+    virtual void close(int index) = 0;
+
+    // start / stop servoing all opened devices
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    // bring a device up to "time" [s] before it is read; only simulated
+    // devices need this
+    virtual void update(int index, double time) {}
+
+    // tool position [m]
+    virtual void getPosition(int index, double position[3]) = 0;
+
+    // commanded force [N], held until the next call
+    virtual void setForce(int index, const double force[3]) = 0;
+};
+
+//---------------------------------------------------------------------------
+
+// scripted operator hand: a spring-damper grip that pulls the end-effector
+// towards center + amplitude * sin(2 pi freq t + phase)
+struct SimHand
+{
+    double center[3];       // [m]
+    double amplitude[3];    // [m]
+    double freq;            // [Hz]
+    double phase;           // [rad]
+    double stiffness;       // [N/m], 0 = hand off the grip
+    double damping;         // [N s/m]
+};
+
+// point-mass plant of one Falcon grip
+struct SimFalcon
+{
+    SimHand hand;
+    double  pos[3];
+    double  vel[3];
+    double  force[3];       // last commanded force
+    double  time;
+    bool    running;
+
+    // stability indicators
+    long long limitHits;    // integration steps stopped by the workspace limit
+    double    peakSpeed;    // [m/s]
+};
+
+class SimFalconBackend : public FalconBackend
+{
+  public:
+
+    SimFalconBackend(int numDevices);
+
+    const char* getName() { return "simulated Falcon"; }
+    int getNumDevices() { return m_numDevices; }
+
+    bool open(int index);
+    void close(int index) {}
+    void start();
+    void stop();
+    void update(int index, double time);
+    void getPosition(int index, double position[3]);
+    void setForce(int index, const double force[3]);
+
+    // plant and hand of a device, may be changed between ticks
+    SimFalcon* device(int index) { return &m_devices[index]; }
+
+    // print peak speed and workspace limit hits of all devices
+    void printStats(FILE* out);
+
+    // plant parameters, common to all devices
+    double m_mass;          // effective moving mass at the grip [kg]
+    double m_damping;       // viscous friction of the mechanism [N s/m]
+    double m_gravity;       // [m/s^2] along -y, 0 = counterbalanced grip
+    double m_maxStep;       // largest integration step [s]
+
+  private:
+
+    void step(SimFalcon* dev, double dt);
+
+    int m_numDevices;
+    SimFalcon m_devices[FALCON_MAX_DEVICES];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// backend for real devices, NULL if HDAL is not compiled in
+FalconBackend* falcon_create_hdal_backend();
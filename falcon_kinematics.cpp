@@ -0,0 +1,289 @@
+//===========================================================================
+/*
+    falcon_kinematics.cpp
+
+    Kinematic model of the Novint Falcon delta mechanism.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "falcon_kinematics.h"
+#include <math.h>
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// FALCON GEOMETRY (Unit: meter)
+//---------------------------------------------------------------------------
+
+static const double Pzo = 0.134;	//	Zero-Configuration z-offset
+static const double r   = 0.03723;	//	Radius of Back Plate
+static const double Pvo = 0.022;   //  Zero-Configuration v-offset
+
+static const double s  =  0.025;    // Back plate Actuator Offset
+static const double b  =  0.103;    // Length of Parallel Link
+static const double a  =  0.060;    // Length of Curved Link
+static const double d  =  0.011;    // Length of Joint Link
+static const double c	=  0.0157;	 //	Radius of Front Plate
+
+//Motor Joint Angles    (Unit: radians)
+static const double pi = 3.141592653589793;
+static const double phi[3] = {105.0*pi/180.0, -15.0*pi/180.0, -135.0*pi/180.0};
+static const double cosPhi[3] = {cos(phi[0]), cos(phi[1]), cos(phi[2])};
+static const double sinPhi[3] = {sin(phi[0]), sin(phi[1]), sin(phi[2])};
+
+//Masses of different parts of Falcon (Units in kilograms)
+static const double me = 0.052;	//  Mass of modified falcon grip
+static const double mc = 0.03278;  //  Mass of moving plate
+static const double mb = 0.00841;  //  Mass of parallel link
+static const double md = 0.01037;  //  Mass of joint link
+static const double ma = 0.08935;  //  Mass of curved link
+
+//Different lengths of Falcon Parts(Units in meter)
+static const double q   = 0.022;   //  Length of center of mass of curved link from motor joint
+
+//Magnitude of Gravity - m/s^2
+static const double g  = 9.815;
+
+// rest angle of the curved link's center of mass, as used for the
+// gravitational torque (kept at the model's 3.14 rather than pi)
+static const double thetaA = 100.0*3.14/180.0;
+
+//---------------------------------------------------------------------------
+
+cVector3d gravity_compensate(cVector3d newPosition)
+{
+		//Get position of a Falcon end effector in its co-ordinate frame and transfer it to the Base frame
+		//co-ordinate frame
+		double px = (newPosition.y);
+		double py = (newPosition.z);
+		double pz = (newPosition.x) + Pzo;
+
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//Computing the position of point P with respect to individial motor co-ordinate frames
+		//Transfering from Base frame co-ordinate frame to motor co-ordinate frame
+		////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//Other parameters
+		int j;
+
+		//Motor co-ordinate frames
+		double Pv[3], Pw[3], Pu[3];
+
+
+		for(j=0;j<3;j++)
+		{
+			Pu[j] = (cos(phi[j]) * px)  + (sin(phi[j])* py)  - r;	
+			Pv[j] = -(sin(phi[j])* px)  + (cos(phi[j]) * py) + Pvo;
+			Pw[j] = pz;
+		}
+
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//Computing Inverse Kinematics
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////
+		double T1[3];
+		double L0[3], L1[3], L2[3];
+		double theta1[3], theta2[3], theta3[3]; // Joint Angles
+
+		for(j=0;j<3;j++)
+		{
+			//Calculating theta3
+			theta3[j] = acos( (Pv[j] - s) /b);
+
+			L0[j] = pow(Pw[j],2.0) + pow(Pu[j],2) + (2.0 * c * Pu[j]) - (4.0 * pow(d,2)) - (pow(b,2) * pow(sin(theta3[j]),2)) - (4.0 * b * d * sin(theta3[j])) - (2.0 * a * Pu[j]) + pow((a-c),2);
+			L1[j] = -4.0 * a * Pw[j];
+			L2[j] = pow(Pw[j],2.0) + pow(Pu[j],2) + (2.0 * c * Pu[j]) - (4.0 * pow(d,2)) - (pow(b,2) * pow(sin(theta3[j]),2)) - (4.0 * b * d * sin(theta3[j])) + (2.0 * a * Pu[j]) + pow((a+c),2);
+			T1[j] = (-L1[j] - sqrt(pow(L1[j],2) - (4.0*L2[j]*L0[j]))) / (2.0*L2[j]);
+
+			//Calculating theta1
+			theta1[j] = 2.0 * atan(T1[j]);
+       
+			//Calculating theta2
+			theta2[j] = atan((Pw[j] - (a * sin(theta1[j])))/(Pu[j] - (a * cos(theta1[j])) + c) );
+		}
+
+		////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//Computing the Jacobian Matrix
+		////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		cMatrix3d JF;
+		double JF1[3], JF2[3], JF3[3];
+		for(j=0;j<3;j++)
+		{
+			JF1[j] =	cos(theta2[j]) * sin(theta3[j]) * cos(phi[j])      - cos(theta3[j]) * sin(phi[j]);
+			JF2[j] =	cos(theta3[j]) * cos(phi[j])    + cos(theta2[j]) * sin(theta3[j]) * sin(phi[j]);
+			JF3[j] =	sin(theta2[j]) * sin(theta3[j]);
+		}
+		JF.set(JF1[0],JF2[0],JF3[0],JF1[1],JF2[1],JF3[1],JF1[2],JF2[2],JF3[2]);
+
+		/////////////////////////////////////////////////////
+		cMatrix3d JI;
+		double JI1[3];
+		for(j=0;j<3;j++)
+		{
+			JI1[j] =	a*sin(theta2[j] - theta1[j])*sin(theta3[j]);
+		}
+		JI.set(JI1[0],0.0,0.0,0.0,JI1[1],0.0,0.0,0.0,JI1[2]);
+
+		/////////////////////////////////////////////////////
+		cMatrix3d J;
+		cMatrix3d JIinv;
+		cMatrix3d JT;
+		JI.invertr(JIinv);
+		JIinv.mulr(JF,J);
+		J.transr(JT);
+		cMatrix3d JTinv;
+		JT.invertr(JTinv);
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////
+		//Computing Gravitational Torque
+		///////////////////////////////////////////////////////////////////////////////////////////////////////
+	    cVector3d Ga_Torque;        //Gravitational Torque
+		cVector3d Gb_Torque;        //Gravitational Torque
+		cVector3d Gc_Torque;        //Gravitational Torque
+		cVector3d Tg;               //Total gravitational torque
+
+		double m_a = g * ma * q;
+		Ga_Torque.set( m_a * sin((100.0*3.14/180.0) - theta1[0]) * sin(phi[0]) , m_a * sin((100.0*3.14/180.0) - theta1[1]) * sin(phi[1]) , m_a * sin((100.0*3.14/180.0) - theta1[2]) * sin(phi[2]) );
+
+		double m_b = a * g * (mb + md);
+		Gb_Torque.set( m_b * sin(theta1[0]) * sin(phi[0]) , m_b * sin(theta1[1]) * sin(phi[1]) , m_b * sin(theta1[2]) * sin(phi[2]) );
+		cVector3d Gc_Force;
+		Gc_Force.x = 0.0;
+		Gc_Force.y = (3.0* (mb+md) + mc + me) * g;
+		Gc_Force.z = 0.0;
+		JTinv.mulr(Gc_Force,Gc_Torque);
+
+		// Computing total gravitational torque
+		Tg = Ga_Torque - Gb_Torque + Gc_Torque;
+
+		// Computing the required gravity force from gravitational torque
+		cVector3d Gravity;
+		JT.mulr(Tg,Gravity);
+
+		// Converting from back plate to Falcons Co-ordinate system
+		cVector3d Fg;
+		Fg.set(Gravity.z,Gravity.x,Gravity.y);
+		return Fg;
+}
+
+//---------------------------------------------------------------------------
+
+void gravity_compensate_batch(int count,
+                              const double* __restrict x, const double* __restrict y,
+                              const double* __restrict z,
+                              double* __restrict fx, double* __restrict fy, double* __restrict fz)
+{
+    // Same model as gravity_compensate(), rearranged so that every point
+    // is straight-line arithmetic the compiler can vectorize:
+    //  - sin/cos of the joint angles come from algebraic identities
+    //    instead of acos/atan followed by sin/cos
+    //  - JI is diagonal, so J = JI^-1 JF just divides row j by JI1[j]
+    //  - JT * JTinv = I, so the constant plate/grip weight Gc passes
+    //    straight through and no 3x3 inverse is needed:
+    //        Gravity = JT (Ga - Gb) + Gc
+    // The loop vectorizes (SSE/AVX/NEON) as long as sqrt() need not set
+    // errno: -fno-math-errno with GCC/Clang, /fp:fast with MSVC.
+    const double m_a = g * ma * q;
+    const double m_b = a * g * (mb + md);
+    const double Gc  = (3.0* (mb+md) + mc + me) * g;
+    const double sinA = sin(thetaA);
+    const double cosA = cos(thetaA);
+
+    for (int n = 0; n < count; n++)
+    {
+        // base frame
+        double px = y[n];
+        double py = z[n];
+        double pz = x[n] + Pzo;
+
+        double G0 = 0.0;
+        double G1 = Gc;
+        double G2 = 0.0;
+
+        for (int j = 0; j < 3; j++)
+        {
+            // motor frame
+            double Pu =  (cosPhi[j] * px) + (sinPhi[j] * py) - r;
+            double Pv = -(sinPhi[j] * px) + (cosPhi[j] * py) + Pvo;
+            double Pw = pz;
+
+            // theta3 = acos((Pv - s) / b), in [0, pi]
+            double cos3 = (Pv - s) / b;
+            double sin3 = sqrt(1.0 - cos3 * cos3);
+
+            // theta1 = 2 atan(T1)
+            double K  = Pw*Pw + Pu*Pu + (2.0 * c * Pu) - (4.0 * d*d) - (b*b * sin3*sin3) - (4.0 * b * d * sin3);
+            double L0 = K - (2.0 * a * Pu) + (a-c)*(a-c);
+            double L1 = -4.0 * a * Pw;
+            double L2 = K + (2.0 * a * Pu) + (a+c)*(a+c);
+            double T1 = (-L1 - sqrt(L1*L1 - (4.0*L2*L0))) / (2.0*L2);
+            double den1 = 1.0 / (1.0 + T1*T1);
+            double sin1 = 2.0 * T1 * den1;
+            double cos1 = (1.0 - T1*T1) * den1;
+
+            // theta2 = atan(num / den), in (-pi/2, pi/2)
+            double num = Pw - (a * sin1);
+            double den = Pu - (a * cos1) + c;
+            double h = 1.0 / sqrt(num*num + den*den);
+            double cos2 = fabs(den) * h;
+            double sin2 = num * copysign(1.0, den) * h;
+
+            // row j of JF and diagonal element of JI
+            double JF1 = cos2 * sin3 * cosPhi[j] - cos3 * sinPhi[j];
+            double JF2 = cos3 * cosPhi[j] + cos2 * sin3 * sinPhi[j];
+            double JF3 = sin2 * sin3;
+            double JI1 = a * (sin2 * cos1 - cos2 * sin1) * sin3;
+
+            // gravitational torque of the curved link and of the
+            // parallel and joint links
+            double Ga = m_a * (sinA * cos1 - cosA * sin1) * sinPhi[j];
+            double Gb = m_b * sin1 * sinPhi[j];
+
+            double w = (Ga - Gb) / JI1;
+            G0 += w * JF1;
+            G1 += w * JF2;
+            G2 += w * JF3;
+        }
+
+        // back plate to Falcon co-ordinate system
+        fx[n] = G2;
+        fy[n] = G0;
+        fz[n] = G1;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool falcon_in_workspace(const cVector3d& newPosition)
+{
+    // travel of the grip; the inverse kinematics alone also accepts
+    // positions far behind the device that the links cannot reach
+    if (fabs(newPosition.x) > FALCON_TRAVEL ||
+        fabs(newPosition.y) > FALCON_TRAVEL ||
+        fabs(newPosition.z) > FALCON_TRAVEL) return (false);
+
+    // same transformation to the motor frames as in gravity_compensate()
+    double px = newPosition.y;
+    double py = newPosition.z;
+    double pz = newPosition.x + Pzo;
+
+    for (int j=0; j<3; j++)
+    {
+        double Pu = (cos(phi[j]) * px) + (sin(phi[j]) * py) - r;
+        double Pv = -(sin(phi[j]) * px) + (cos(phi[j]) * py) + Pvo;
+        double Pw = pz;
+
+        // the parallel link must reach: |cos(theta3)| < 1
+        double cos3 = (Pv - s) / b;
+        if (cos3 <= -1.0 || cos3 >= 1.0) return (false);
+        double sin3 = sqrt(1.0 - cos3 * cos3);
+
+        // the half-angle equation for theta1 must have a real root
+        double K  = Pw*Pw + Pu*Pu + (2.0 * c * Pu) - (4.0 * d*d) - (b*b * sin3*sin3) - (4.0 * b * d * sin3);
+        double L0 = K - (2.0 * a * Pu) + (a-c)*(a-c);
+        double L1 = -4.0 * a * Pw;
+        double L2 = K + (2.0 * a * Pu) + (a+c)*(a+c);
+        if (L2 == 0.0 || L1*L1 - 4.0*L2*L0 < 0.0) return (false);
+    }
+    return (true);
+}
@@ -0,0 +1,38 @@
+//===========================================================================
+/*
+    falcon_kinematics.h
+
+    Kinematic model of the Novint Falcon delta mechanism. Positions are in
+    the application frame (x = HDAL z, y = HDAL x, z = HDAL y), in meters.
+*/
+//===========================================================================
+#pragma once
+
+#include "math/CVector3d.h"
+#include "math/CMatrix3d.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// half range of the grip travel along each axis [m]
+const double FALCON_TRAVEL = 0.06;
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// force that cancels the weight of the mechanism at a given position [N]
+cVector3d gravity_compensate(cVector3d);
+
+// gravity_compensate() for "count" positions at once; positions and
+// forces are stored one array per axis (application frame). Unreachable
+// positions give NaN, as in the scalar version.
+void gravity_compensate_batch(int count,
+                              const double* x, const double* y, const double* z,
+                              double* fx, double* fy, double* fz);
+
+// true if the position is within the grip travel and the inverse
+// kinematics has a solution, i.e. it can be reached by all three legs
+bool falcon_in_workspace(const cVector3d& newPosition);
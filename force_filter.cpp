@@ -0,0 +1,214 @@
+//===========================================================================
+/*
+    force_filter.cpp
+
+    Streaming filters for the commanded force.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "force_filter.h"
+#include <math.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+static const double pi = 3.141592653589793;
+
+//---------------------------------------------------------------------------
+
+static bool valid_parameters(int type, int order, double cutoff, double sampleRate)
+{
+    switch (type)
+    {
+        case FILTER_NONE:
+            return (true);
+        case FILTER_MOVING_AVERAGE:
+            return (order >= 1 && order <= FILTER_MAX_WINDOW);
+        case FILTER_MEDIAN:
+            return (order >= 1 && order <= FILTER_MAX_MEDIAN && (order % 2) == 1);
+        case FILTER_BIQUAD:
+            return (order >= 2 && order <= FILTER_MAX_ORDER && (order % 2) == 0 &&
+                    sampleRate > 0 && cutoff > 0 && cutoff < 0.5 * sampleRate);
+    }
+    return (false);
+}
+
+//---------------------------------------------------------------------------
+
+bool force_filter_init(ForceFilterBank* bank, int type, int order, double cutoff,
+                       double sampleRate, int numChannels)
+{
+    memset(bank, 0, sizeof(ForceFilterBank));
+    bank->numChannels = (numChannels < FILTER_MAX_CHANNELS) ? numChannels : FILTER_MAX_CHANNELS;
+    bank->sampleRate = sampleRate;
+
+    if (!valid_parameters(type, order, cutoff, sampleRate))
+    {
+        bank->type = FILTER_NONE;
+        return (false);
+    }
+    bank->type = type;
+    bank->order = order;
+    bank->cutoff = cutoff;
+
+    // Butterworth poles in conjugate pairs, one low-pass biquad each
+    // (bilinear transform, as in the RBJ audio EQ cookbook)
+    if (type == FILTER_BIQUAD)
+    {
+        bank->numSections = order / 2;
+        double w0 = 2.0 * pi * cutoff / sampleRate;
+        double cw = cos(w0);
+        for (int k = 0; k < bank->numSections; k++)
+        {
+            double Q = 1.0 / (2.0 * cos(pi * (2 * k + 1) / (2.0 * order)));
+            double alpha = sin(w0) / (2.0 * Q);
+            double a0 = 1.0 + alpha;
+            bank->b0[k] = (1.0 - cw) / 2.0 / a0;
+            bank->b1[k] = (1.0 - cw) / a0;
+            bank->b2[k] = (1.0 - cw) / 2.0 / a0;
+            bank->a1[k] = -2.0 * cw / a0;
+            bank->a2[k] = (1.0 - alpha) / a0;
+        }
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void force_filter_reset(ForceFilterBank* bank)
+{
+    memset(bank->head, 0, sizeof(bank->head));
+    memset(bank->history, 0, sizeof(bank->history));
+    memset(bank->sum, 0, sizeof(bank->sum));
+    memset(bank->sorted, 0, sizeof(bank->sorted));
+    memset(bank->z1, 0, sizeof(bank->z1));
+    memset(bank->z2, 0, sizeof(bank->z2));
+}
+
+//---------------------------------------------------------------------------
+
+double force_filter_update(ForceFilterBank* bank, int ch, double x)
+{
+    const int n = bank->order;
+
+    switch (bank->type)
+    {
+        case FILTER_MOVING_AVERAGE:
+        {
+            int h = bank->head[ch];
+            bank->sum[ch] += x - bank->history[h][ch];
+            bank->history[h][ch] = x;
+            if (++h == n)
+            {
+                // once per window, re-add the ring so that rounding
+                // errors of the running sum cannot build up
+                h = 0;
+                double s = 0;
+                for (int k = 0; k < n; k++)
+                {
+                    s += bank->history[k][ch];
+                }
+                bank->sum[ch] = s;
+            }
+            bank->head[ch] = h;
+            return bank->sum[ch] / n;
+        }
+
+        case FILTER_MEDIAN:
+        {
+            int h = bank->head[ch];
+            double old = bank->history[h][ch];
+            bank->history[h][ch] = x;
+            bank->head[ch] = (h + 1 == n) ? 0 : h + 1;
+
+            // replace the oldest sample in the sorted window by the new
+            // one and move it to its place
+            int p = 0;
+            while (p < n - 1 && bank->sorted[p][ch] != old) p++;
+            while (p > 0 && bank->sorted[p-1][ch] > x)
+            {
+                bank->sorted[p][ch] = bank->sorted[p-1][ch];
+                p--;
+            }
+            while (p < n - 1 && bank->sorted[p+1][ch] < x)
+            {
+                bank->sorted[p][ch] = bank->sorted[p+1][ch];
+                p++;
+            }
+            bank->sorted[p][ch] = x;
+            return bank->sorted[n / 2][ch];
+        }
+
+        case FILTER_BIQUAD:
+        {
+            double y = x;
+            for (int k = 0; k < bank->numSections; k++)
+            {
+                double in = y;
+                y = bank->b0[k] * in + bank->z1[k][ch];
+                bank->z1[k][ch] = bank->b1[k] * in - bank->a1[k] * y + bank->z2[k][ch];
+                bank->z2[k][ch] = bank->b2[k] * in - bank->a2[k] * y;
+            }
+            return y;
+        }
+    }
+    return x;
+}
+
+//---------------------------------------------------------------------------
+
+void force_filter_update3(ForceFilterBank* bank, int device, const double in[3], double out[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        out[k] = force_filter_update(bank, 3 * device + k, in[k]);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+double force_filter_group_delay(const ForceFilterBank* bank)
+{
+    if (bank->sampleRate <= 0) return (0);
+
+    double samples = 0;
+    switch (bank->type)
+    {
+        // linear phase, and the median of a ramp lags by the same amount
+        case FILTER_MOVING_AVERAGE:
+        case FILTER_MEDIAN:
+            samples = (bank->order - 1) / 2.0;
+            break;
+
+        // at DC, a section B(z)/A(z) delays by
+        // (b1 + 2 b2) / (b0 + b1 + b2) - (a1 + 2 a2) / (1 + a1 + a2)
+        case FILTER_BIQUAD:
+            for (int k = 0; k < bank->numSections; k++)
+            {
+                samples += (bank->b1[k] + 2.0 * bank->b2[k]) / (bank->b0[k] + bank->b1[k] + bank->b2[k])
+                         - (bank->a1[k] + 2.0 * bank->a2[k]) / (1.0 + bank->a1[k] + bank->a2[k]);
+            }
+            break;
+    }
+    return samples / bank->sampleRate;
+}
+
+//---------------------------------------------------------------------------
+
+static const char* filterNames[] = { "none", "avg", "biquad", "median" };
+
+int force_filter_type(const char* name)
+{
+    for (int t = 0; t < 4; t++)
+    {
+        if (strcmp(name, filterNames[t]) == 0) return t;
+    }
+    return (-1);
+}
+
+//---------------------------------------------------------------------------
+
+const char* force_filter_name(int type)
+{
+    return (type >= 0 && type < 4) ? filterNames[type] : "unknown";
+}
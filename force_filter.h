@@ -0,0 +1,96 @@
+//===========================================================================
+/*
+    force_filter.h
+
+    Streaming filters for the commanded force, one channel per device and
+    axis (channel = device * 3 + axis). All filters of a bank share type
+    and parameters; their state is kept as one array per state variable
+    across channels, and every update is O(1) in the window length except
+    for the median, which is O(window) with a window of at most
+    FILTER_MAX_MEDIAN samples.
+
+        FILTER_MOVING_AVERAGE   running sum over a ring of "order" samples
+        FILTER_BIQUAD           Butterworth low-pass of even "order", as
+                                order/2 cascaded biquad sections
+        FILTER_MEDIAN           median of the last "order" samples (odd)
+
+    All filters start from zero force. The group delay of a bank is the
+    price paid in coupling latency for the smoothing.
+*/
+//===========================================================================
+#pragma once
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// filter types
+const int FILTER_NONE               = 0;
+const int FILTER_MOVING_AVERAGE     = 1;
+const int FILTER_BIQUAD             = 2;
+const int FILTER_MEDIAN             = 3;
+
+// devices * axes
+const int FILTER_MAX_CHANNELS       = 24;
+
+// longest moving average / median window
+const int FILTER_MAX_WINDOW         = 64;
+const int FILTER_MAX_MEDIAN         = 15;
+
+// highest Butterworth order (biquad sections * 2)
+const int FILTER_MAX_ORDER          = 8;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct ForceFilterBank
+{
+    int    type;
+    int    order;               // window length or Butterworth order
+    int    numChannels;
+    double cutoff;              // biquad cutoff [Hz]
+    double sampleRate;          // [Hz]
+
+    // moving average and median: ring of recent inputs per channel
+    int    head[FILTER_MAX_CHANNELS];
+    double history[FILTER_MAX_WINDOW][FILTER_MAX_CHANNELS];
+    double sum[FILTER_MAX_CHANNELS];
+
+    // median: the same window kept sorted
+    double sorted[FILTER_MAX_MEDIAN][FILTER_MAX_CHANNELS];
+
+    // biquad sections, transposed direct form II, a0 = 1
+    int    numSections;
+    double b0[FILTER_MAX_ORDER / 2], b1[FILTER_MAX_ORDER / 2], b2[FILTER_MAX_ORDER / 2];
+    double a1[FILTER_MAX_ORDER / 2], a2[FILTER_MAX_ORDER / 2];
+    double z1[FILTER_MAX_ORDER / 2][FILTER_MAX_CHANNELS];
+    double z2[FILTER_MAX_ORDER / 2][FILTER_MAX_CHANNELS];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// set up a bank; returns false (and leaves a pass-through bank) if the
+// parameters are out of range
+bool force_filter_init(ForceFilterBank* bank, int type, int order, double cutoff,
+                       double sampleRate, int numChannels);
+
+// clear the state of all channels, back to zero force
+void force_filter_reset(ForceFilterBank* bank);
+
+// filter one sample of a channel
+double force_filter_update(ForceFilterBank* bank, int channel, double x);
+
+// filter the three axes of a device
+void force_filter_update3(ForceFilterBank* bank, int device, const double in[3], double out[3]);
+
+// low-frequency group delay of the filters [s]
+double force_filter_group_delay(const ForceFilterBank* bank);
+
+// filter type from / to its name: "none", "avg", "biquad", "median"
+int force_filter_type(const char* name);
+const char* force_filter_name(int type);
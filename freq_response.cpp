@@ -0,0 +1,95 @@
+//===========================================================================
+/*
+    freq_response.cpp
+
+    Streaming single-bin DFT of the position and force of a device.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "freq_response.h"
+#include <math.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+static const double pi = 3.141592653589793;
+
+//---------------------------------------------------------------------------
+
+void freq_response_reset(FreqResponse* response, double freq, double rate)
+{
+    memset(response, 0, sizeof(FreqResponse));
+    if (!(freq > 0) || !(rate > 0)) return;
+
+    response->freq  = freq;
+    response->rate  = rate;
+    response->w     = 2 * pi * freq / rate;
+    response->coeff = 2 * cos(response->w);
+}
+
+//---------------------------------------------------------------------------
+
+void freq_response_add(FreqResponse* response, double time,
+                       const double pos[3], const double force[3])
+{
+    if (response->freq <= 0) return;
+    if (response->count++ == 0) response->t0 = time;
+
+    double x[FREQ_RESPONSE_CHANNELS] = { pos[0], pos[1], pos[2], force[0], force[1], force[2] };
+    for (int c = 0; c < FREQ_RESPONSE_CHANNELS; c++)
+    {
+        double s0 = x[c] + response->coeff * response->s1[c] - response->s2[c];
+        response->s2[c] = response->s1[c];
+        response->s1[c] = s0;
+        response->sum[c] += x[c];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool freq_response_estimate(const FreqResponse& response, FreqResponseEstimate* estimate)
+{
+    long long n = response.count;
+    double w = response.w;
+    double periods = n * response.freq / response.rate;
+    if (response.freq <= 0 || periods < 1) return (false);
+
+    // the Goertzel output is y = sum x[k] exp(j w (n-1-k)); a constant
+    // gives y = d exp(j w (n-1) / 2), subtracted at the mean
+    double d = sin(w * n / 2) / sin(w / 2);
+    double dRe = d * cos(w * (n - 1) / 2);
+    double dIm = d * sin(w * (n - 1) / 2);
+
+    // then back to the phase of the servo clock
+    double rot = -w * (n - 1 + response.t0 * response.rate);
+    double c = cos(rot);
+    double s = sin(rot);
+
+    double amp[FREQ_RESPONSE_CHANNELS];
+    double phase[FREQ_RESPONSE_CHANNELS];
+    for (int k = 0; k < FREQ_RESPONSE_CHANNELS; k++)
+    {
+        double mean = response.sum[k] / n;
+        double re = response.s1[k] - cos(w) * response.s2[k] - mean * dRe;
+        double im = sin(w) * response.s2[k] - mean * dIm;
+        double xr = re * c - im * s;
+        double xi = re * s + im * c;
+
+        amp[k] = 2 * sqrt(xr * xr + xi * xi) / n;
+        phase[k] = (amp[k] > 0) ? atan2(xi, xr) + pi / 2 : 0;
+        if (phase[k] > pi) phase[k] -= 2 * pi;
+    }
+
+    estimate->freq = response.freq;
+    estimate->periods = periods;
+    estimate->axis = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        estimate->posAmp[k]     = amp[k];
+        estimate->posPhase[k]   = phase[k];
+        estimate->forceAmp[k]   = amp[3 + k];
+        estimate->forcePhase[k] = phase[3 + k];
+        if (amp[k] > amp[estimate->axis]) estimate->axis = k;
+    }
+    return (true);
+}
@@ -0,0 +1,75 @@
+//===========================================================================
+/*
+    freq_response.h
+
+    Online frequency response of one device at the current sweep frequency.
+    Every tick adds the position and the force of each axis to a Goertzel
+    filter (a single-bin DFT) at the sweep frequency, a multiply-add or two
+    per channel and no trigonometry. The running amplitude and phase can
+    be read out at any time, by any thread holding a copy of the state:
+
+        X = sum (x[n] - mean) exp(-j w (n + n0))    over the samples so far
+        amplitude = 2 |X| / N,  phase = arg X + 90 deg
+
+    so that a signal A sin(2 pi f t + phase) + c gives A and phase, with
+    t the servo time (n0 = time of the first sample * rate). The mean is
+    taken out, so the offset of a grip from the origin does not leak into
+    the bin while the count is not a whole number of periods. Samples are
+    taken as one per period of the servo rate.
+*/
+//===========================================================================
+#pragma once
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// position x, y, z, force x, y, z
+const int FREQ_RESPONSE_CHANNELS    = 6;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct FreqResponse
+{
+    double    freq;             // [Hz], 0 = not started
+    double    rate;             // servo rate [Hz]
+    double    w;                // [rad / sample]
+    double    coeff;            // 2 cos(w)
+    double    t0;               // time of the first sample [s]
+    long long count;            // samples so far
+
+    // Goertzel state and sum of every channel
+    double    s1[FREQ_RESPONSE_CHANNELS];
+    double    s2[FREQ_RESPONSE_CHANNELS];
+    double    sum[FREQ_RESPONSE_CHANNELS];
+};
+
+struct FreqResponseEstimate
+{
+    double freq;                // [Hz]
+    double periods;             // of the sweep frequency seen so far
+    double posAmp[3];           // [m]
+    double posPhase[3];         // [rad]
+    double forceAmp[3];         // [N]
+    double forcePhase[3];       // [rad]
+    int    axis;                // the one that moves most
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// start over at "freq" (a new sweep step)
+void freq_response_reset(FreqResponse* response, double freq, double rate);
+
+// servo thread: one tick, position [m] and force [N] on the same axes
+void freq_response_add(FreqResponse* response, double time,
+                       const double pos[3], const double force[3]);
+
+// amplitude and phase of every axis so far; false before the first
+// whole period
+bool freq_response_estimate(const FreqResponse& response, FreqResponseEstimate* estimate);
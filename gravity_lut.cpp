@@ -0,0 +1,320 @@
+//===========================================================================
+/*
+    gravity_lut.cpp
+
+    Tabulated gravity compensation with trilinear interpolation.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "gravity_lut.h"
+#include "falcon_kinematics.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// CACHE FILE
+//---------------------------------------------------------------------------
+
+#pragma pack(push, 8)
+
+struct GravityLutFileHeader
+{
+    char     magic[8];          // "FALCGRV" + '\0'
+    uint32_t version;
+    int32_t  size;
+    double   origin;
+    double   step;
+    double   probe[3];          // analytic force at GRAVITY_LUT_PROBE
+    double   maxError;
+    double   rmsError;
+    double   p99Error;
+};
+
+#pragma pack(pop)
+
+static const char GRAVITY_LUT_MAGIC[8] = "FALCGRV";
+
+// a cache built from a different model gives a different force here
+static const cVector3d GRAVITY_LUT_PROBE(0.01, -0.02, 0.015);
+
+//---------------------------------------------------------------------------
+
+static void grid_setup(GravityLut* lut, int size)
+{
+    lut->size     = size;
+    lut->origin   = -FALCON_TRAVEL;
+    lut->step     = 2.0 * FALCON_TRAVEL / (size - 1);
+    lut->invStep  = 1.0 / lut->step;
+    lut->maxError = 0;
+    lut->rmsError = 0;
+    lut->p99Error = 0;
+    lut->force.assign((size_t)size * size * size * 3, 0.0f);
+}
+
+//---------------------------------------------------------------------------
+
+static bool is_finite(const cVector3d& v)
+{
+    // false for NaN and infinities
+    return (fabs(v.x) < 1e30 && fabs(v.y) < 1e30 && fabs(v.z) < 1e30);
+}
+
+//---------------------------------------------------------------------------
+
+// give every unreachable node the mean of its already known face
+// neighbours, growing outwards from the workspace one layer per pass
+static void fill_unreachable(GravityLut* lut, std::vector<char>& known)
+{
+    int n = lut->size;
+    int stride[3] = { 1, n, n * n };
+    std::vector<int> layer;
+
+    while (true)
+    {
+        layer.clear();
+        for (int z = 0; z < n; z++)
+        for (int y = 0; y < n; y++)
+        for (int x = 0; x < n; x++)
+        {
+            int node = x + n * (y + n * z);
+            if (known[node]) continue;
+
+            int coord[3] = { x, y, z };
+            double sum[3] = { 0, 0, 0 };
+            int count = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                for (int dir = -1; dir <= 1; dir += 2)
+                {
+                    int c = coord[k] + dir;
+                    if (c < 0 || c >= n) continue;
+                    int other = node + dir * stride[k];
+                    if (!known[other]) continue;
+                    for (int m = 0; m < 3; m++)
+                    {
+                        sum[m] += lut->force[3 * other + m];
+                    }
+                    count++;
+                }
+            }
+            if (count > 0)
+            {
+                for (int m = 0; m < 3; m++)
+                {
+                    lut->force[3 * node + m] = (float)(sum[m] / count);
+                }
+                layer.push_back(node);
+            }
+        }
+
+        if (layer.empty()) break;
+        for (size_t i = 0; i < layer.size(); i++)
+        {
+            known[layer[i]] = 1;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// compare against the analytic model at the cell centers, where the
+// trilinear error is largest
+static void measure_error(GravityLut* lut)
+{
+    int n = lut->size;
+    std::vector<double> errors;
+    double sumSq = 0;
+
+    for (int z = 0; z < n - 1; z++)
+    for (int y = 0; y < n - 1; y++)
+    for (int x = 0; x < n - 1; x++)
+    {
+        cVector3d p(lut->origin + (x + 0.5) * lut->step,
+                    lut->origin + (y + 0.5) * lut->step,
+                    lut->origin + (z + 0.5) * lut->step);
+        if (!falcon_in_workspace(p)) continue;
+
+        cVector3d exact = gravity_compensate(p);
+        if (!is_finite(exact)) continue;
+
+        double e = (gravity_lut_eval(lut, p) - exact).length();
+        errors.push_back(e);
+        sumSq += e * e;
+    }
+    if (errors.empty()) return;
+
+    size_t p99 = errors.size() * 99 / 100;
+    std::nth_element(errors.begin(), errors.begin() + p99, errors.end());
+    lut->p99Error = errors[p99];
+    lut->maxError = *std::max_element(errors.begin() + p99, errors.end());
+    lut->rmsError = sqrt(sumSq / errors.size());
+}
+
+//---------------------------------------------------------------------------
+
+bool gravity_lut_build(GravityLut* lut, int size)
+{
+    if (size < 2) return (false);
+    grid_setup(lut, size);
+
+    int n = size;
+    std::vector<char> known((size_t)n * n * n, 0);
+    int numKnown = 0;
+
+    // one grid row along x per batch
+    std::vector<double> px(n), py(n), pz(n), fx(n), fy(n), fz(n);
+    for (int x = 0; x < n; x++)
+    {
+        px[x] = lut->origin + x * lut->step;
+    }
+    for (int z = 0; z < n; z++)
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            py[x] = lut->origin + y * lut->step;
+            pz[x] = lut->origin + z * lut->step;
+        }
+        gravity_compensate_batch(n, &px[0], &py[0], &pz[0], &fx[0], &fy[0], &fz[0]);
+
+        for (int x = 0; x < n; x++)
+        {
+            cVector3d f(fx[x], fy[x], fz[x]);
+            if (!falcon_in_workspace(cVector3d(px[x], py[x], pz[x])) || !is_finite(f)) continue;
+
+            int node = x + n * (y + n * z);
+            lut->force[3 * node + 0] = (float)f.x;
+            lut->force[3 * node + 1] = (float)f.y;
+            lut->force[3 * node + 2] = (float)f.z;
+            known[node] = 1;
+            numKnown++;
+        }
+    }
+    if (numKnown == 0) return (false);
+
+    fill_unreachable(lut, known);
+    measure_error(lut);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool gravity_lut_save(const GravityLut* lut, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return (false);
+
+    GravityLutFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAVITY_LUT_MAGIC, sizeof(header.magic));
+    header.version  = GRAVITY_LUT_VERSION;
+    header.size     = lut->size;
+    header.origin   = lut->origin;
+    header.step     = lut->step;
+    cVector3d probe = gravity_compensate(GRAVITY_LUT_PROBE);
+    header.probe[0] = probe.x;
+    header.probe[1] = probe.y;
+    header.probe[2] = probe.z;
+    header.maxError = lut->maxError;
+    header.rmsError = lut->rmsError;
+    header.p99Error = lut->p99Error;
+
+    bool ok = (fwrite(&header, sizeof(header), 1, file) == 1) &&
+              (fwrite(&lut->force[0], sizeof(float), lut->force.size(), file) == lut->force.size());
+    ok = (fclose(file) == 0) && ok;
+    return (ok);
+}
+
+//---------------------------------------------------------------------------
+
+bool gravity_lut_load(GravityLut* lut, int size, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return (false);
+
+    GravityLutFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, GRAVITY_LUT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GRAVITY_LUT_VERSION ||
+        header.size != size)
+    {
+        fclose(file);
+        return (false);
+    }
+
+    // stale cache: the model or the workspace changed since it was written
+    cVector3d probe = gravity_compensate(GRAVITY_LUT_PROBE);
+    grid_setup(lut, size);
+    if (fabs(header.probe[0] - probe.x) > 1e-9 ||
+        fabs(header.probe[1] - probe.y) > 1e-9 ||
+        fabs(header.probe[2] - probe.z) > 1e-9 ||
+        header.origin != lut->origin || header.step != lut->step)
+    {
+        fclose(file);
+        return (false);
+    }
+
+    bool ok = (fread(&lut->force[0], sizeof(float), lut->force.size(), file) == lut->force.size());
+    fclose(file);
+    lut->maxError = header.maxError;
+    lut->rmsError = header.rmsError;
+    lut->p99Error = header.p99Error;
+    return (ok);
+}
+
+//---------------------------------------------------------------------------
+
+bool gravity_lut_init(GravityLut* lut, int size, const char* path)
+{
+    if (path != NULL && gravity_lut_load(lut, size, path)) return (true);
+    if (!gravity_lut_build(lut, size)) return (false);
+    if (path != NULL)
+    {
+        // a missing cache only costs the build time on the next start
+        gravity_lut_save(lut, path);
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+cVector3d gravity_lut_eval(const GravityLut* lut, const cVector3d& position)
+{
+    const int n = lut->size;
+    const double p[3] = { position.x, position.y, position.z };
+
+    // cell index and fraction along each axis, clamped to the grid
+    int i[3];
+    double f[3];
+    for (int k = 0; k < 3; k++)
+    {
+        double u = (p[k] - lut->origin) * lut->invStep;
+        if (u < 0) u = 0;
+        if (u > n - 1) u = n - 1;
+        i[k] = (int)u;
+        if (i[k] > n - 2) i[k] = n - 2;
+        f[k] = u - i[k];
+    }
+
+    const int sx = 3;
+    const int sy = 3 * n;
+    const int sz = 3 * n * n;
+    const float* c = &lut->force[i[0] * sx + i[1] * sy + i[2] * sz];
+
+    double out[3];
+    for (int m = 0; m < 3; m++)
+    {
+        double c00 = c[m]           + f[0] * (c[sx + m]           - c[m]);
+        double c10 = c[sy + m]      + f[0] * (c[sx + sy + m]      - c[sy + m]);
+        double c01 = c[sz + m]      + f[0] * (c[sx + sz + m]      - c[sz + m]);
+        double c11 = c[sy + sz + m] + f[0] * (c[sx + sy + sz + m] - c[sy + sz + m]);
+        double c0  = c00 + f[1] * (c10 - c00);
+        double c1  = c01 + f[1] * (c11 - c01);
+        out[m] = c0 + f[2] * (c1 - c0);
+    }
+    return cVector3d(out[0], out[1], out[2]);
+}
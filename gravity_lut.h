@@ -0,0 +1,74 @@
+//===========================================================================
+/*
+    gravity_lut.h
+
+    Gravity compensation force sampled on a regular grid over the grip
+    travel (application frame, +-FALCON_TRAVEL on each axis) and answered
+    by trilinear interpolation, so it can run at servo rate in place of
+    gravity_compensate().
+
+    Grid nodes the mechanism cannot reach have no analytic value; they are
+    filled from their reachable neighbours so that interpolation near the
+    edge of the workspace stays smooth.
+
+    The table can be cached in a file. The cache stores the grid size and
+    the analytic force at a probe position, and is rebuilt when either
+    does not match.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "math/CVector3d.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+const uint32_t GRAVITY_LUT_VERSION  = 1;
+
+// default grid points per axis
+const int GRAVITY_LUT_DEFAULT_SIZE  = 32;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct GravityLut
+{
+    int    size;                // grid points per axis
+    double origin;              // position of node 0 on every axis [m]
+    double step;                // node spacing [m]
+    double invStep;             // 1 / step
+    std::vector<float> force;   // x, y, z per node, x index varying fastest
+
+    // interpolation error against the analytic model, measured at the
+    // cell centers inside the workspace [N]; the maximum comes from the
+    // near-singular fringe at the edge of the workspace, the 99th
+    // percentile describes the bulk of it
+    double maxError;
+    double rmsError;
+    double p99Error;
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// sample gravity_compensate() on a size^3 grid and measure the error
+bool gravity_lut_build(GravityLut* lut, int size);
+
+// load the table from a cache file, or build it and write the file;
+// "path" may be NULL for no cache
+bool gravity_lut_init(GravityLut* lut, int size, const char* path);
+
+// write / read a cache file
+bool gravity_lut_save(const GravityLut* lut, const char* path);
+bool gravity_lut_load(GravityLut* lut, int size, const char* path);
+
+// interpolated gravity force at a position [N], application frame;
+// positions outside the grid are clamped to it
+cVector3d gravity_lut_eval(const GravityLut* lut, const cVector3d& position);
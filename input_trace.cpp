@@ -0,0 +1,333 @@
+//===========================================================================
+/*
+    input_trace.cpp
+
+    Session input traces and their replay backend.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "input_trace.h"
+#include <string.h>
+//---------------------------------------------------------------------------
+
+static const char INPUT_TRACE_MAGIC[8] = "FALCTRC";
+
+//---------------------------------------------------------------------------
+
+static uint64_t double_bits(double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits)
+{
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+//---------------------------------------------------------------------------
+// WRITER
+//---------------------------------------------------------------------------
+
+static void put_varint(FILE* file, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        putc((int)((v & 0x7f) | 0x80), file);
+        v >>= 7;
+    }
+    putc((int)v, file);
+}
+
+//---------------------------------------------------------------------------
+
+// the bytes of "bits" that differ from "previous", see input_trace.h
+static void put_xor(FILE* file, uint64_t bits, uint64_t previous)
+{
+    uint64_t x = bits ^ previous;
+    int lead = 0;
+    int trail = 0;
+    if (x == 0)
+    {
+        lead = 8;
+    }
+    else
+    {
+        while ((x >> (56 - 8 * lead)) == 0) lead++;
+        while (((x >> (8 * trail)) & 0xff) == 0) trail++;
+    }
+    putc(lead << 4 | trail, file);
+    for (int b = 7 - lead; b >= trail; b--)
+    {
+        putc((int)((x >> (8 * b)) & 0xff), file);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void input_trace_init_header(InputTraceHeader* header, int numDevices, double servoRate,
+                             double freqMin, double freqMax)
+{
+    memset(header, 0, sizeof(InputTraceHeader));
+    memcpy(header->magic, INPUT_TRACE_MAGIC, sizeof(header->magic));
+    header->version    = INPUT_TRACE_VERSION;
+    header->headerSize = sizeof(InputTraceHeader);
+    header->numDevices = numDevices;
+    header->servoRate  = servoRate;
+    header->freqMin    = freqMin;
+    header->freqMax    = freqMax;
+}
+
+//---------------------------------------------------------------------------
+
+bool input_trace_create(InputTraceWriter* writer, const char* path, const InputTraceHeader& header)
+{
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return (false);
+
+    setvbuf(writer->file, NULL, _IOFBF, 1 << 20);
+    fwrite(&header, sizeof(InputTraceHeader), 1, writer->file);
+    memset(&writer->last, 0, sizeof(writer->last));
+    writer->events = 0;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void input_trace_write(InputTraceWriter* writer, const InputEvent& event)
+{
+    if (writer->file == NULL) return;
+    if (event.index < 0 || event.index > 15) return;
+    if (event.kind == INPUT_POSITION && event.index >= FALCON_MAX_DEVICES) return;
+
+    FILE* file = writer->file;
+    InputTraceState& last = writer->last;
+
+    putc(event.kind << 4 | event.index, file);
+    long long delta = event.tick - last.tick;
+    put_varint(file, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    last.tick = event.tick;
+
+    uint64_t time = double_bits(event.time);
+    put_xor(file, time, last.time);
+    last.time = time;
+
+    if (event.kind == INPUT_POSITION)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            uint64_t bits = double_bits(event.value[k]);
+            put_xor(file, bits, last.pos[event.index][k]);
+            last.pos[event.index][k] = bits;
+        }
+    }
+    else if (event.kind == INPUT_PARAM)
+    {
+        put_xor(file, double_bits(event.value[0]), 0);
+    }
+    writer->events++;
+}
+
+//---------------------------------------------------------------------------
+
+void input_trace_close(InputTraceWriter* writer)
+{
+    if (writer->file == NULL) return;
+    fclose(writer->file);
+    writer->file = NULL;
+}
+
+//---------------------------------------------------------------------------
+// READER
+//---------------------------------------------------------------------------
+
+static bool get_varint(FILE* file, uint64_t* v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 70; shift += 7)
+    {
+        int byte = getc(file);
+        if (byte == EOF) return (false);
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return (true);
+    }
+    return (false);
+}
+
+//---------------------------------------------------------------------------
+
+static bool get_xor(FILE* file, uint64_t previous, uint64_t* bits)
+{
+    int control = getc(file);
+    if (control == EOF) return (false);
+    int lead = control >> 4;
+    int trail = control & 0x0f;
+    if (lead + trail > 8) return (false);
+
+    uint64_t x = 0;
+    for (int b = 7 - lead; b >= trail; b--)
+    {
+        int byte = getc(file);
+        if (byte == EOF) return (false);
+        x |= (uint64_t)byte << (8 * b);
+    }
+    *bits = previous ^ x;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool input_trace_open(InputTraceReader* reader, const char* path)
+{
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) return (false);
+
+    setvbuf(reader->file, NULL, _IOFBF, 1 << 20);
+    InputTraceHeader& header = reader->header;
+    if (fread(&header, sizeof(InputTraceHeader), 1, reader->file) != 1 ||
+        memcmp(header.magic, INPUT_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != INPUT_TRACE_VERSION ||
+        header.headerSize != sizeof(InputTraceHeader) ||
+        header.numDevices < 1 || header.numDevices > FALCON_MAX_DEVICES)
+    {
+        input_trace_close_read(reader);
+        return (false);
+    }
+    memset(&reader->last, 0, sizeof(reader->last));
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool input_trace_read(InputTraceReader* reader, InputEvent* event)
+{
+    if (reader->file == NULL) return (false);
+
+    FILE* file = reader->file;
+    InputTraceState& last = reader->last;
+
+    int first = getc(file);
+    if (first == EOF) return (false);
+    event->kind  = first >> 4;
+    event->index = first & 0x0f;
+    if (event->kind == INPUT_POSITION && event->index >= FALCON_MAX_DEVICES) return (false);
+
+    uint64_t v;
+    if (!get_varint(file, &v)) return (false);
+    last.tick += (long long)(v >> 1) ^ -(long long)(v & 1);
+    event->tick = last.tick;
+
+    if (!get_xor(file, last.time, &last.time)) return (false);
+    event->time = bits_double(last.time);
+
+    event->value[0] = event->value[1] = event->value[2] = 0;
+    if (event->kind == INPUT_POSITION)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            uint64_t& bits = last.pos[event->index][k];
+            if (!get_xor(file, bits, &bits)) return (false);
+            event->value[k] = bits_double(bits);
+        }
+    }
+    else if (event->kind == INPUT_PARAM)
+    {
+        if (!get_xor(file, 0, &v)) return (false);
+        event->value[0] = bits_double(v);
+    }
+    else if (event->kind != INPUT_STEP_END)
+    {
+        return (false);
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void input_trace_close_read(InputTraceReader* reader)
+{
+    if (reader->file == NULL) return;
+    fclose(reader->file);
+    reader->file = NULL;
+}
+
+//---------------------------------------------------------------------------
+// REPLAY BACKEND
+//---------------------------------------------------------------------------
+
+ReplayBackend::ReplayBackend()
+{
+    memset(&m_reader, 0, sizeof(m_reader));
+    m_hasNext = false;
+    memset(m_pos, 0, sizeof(m_pos));
+}
+
+//---------------------------------------------------------------------------
+
+ReplayBackend::~ReplayBackend()
+{
+    input_trace_close_read(&m_reader);
+}
+
+//---------------------------------------------------------------------------
+
+bool ReplayBackend::load(const char* path)
+{
+    if (!input_trace_open(&m_reader, path)) return (false);
+    m_hasNext = input_trace_read(&m_reader, &m_next);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void ReplayBackend::getPosition(int index, double position[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        position[k] = m_pos[index][k];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool ReplayBackend::nextTick(ReplayTick* tick)
+{
+    if (!m_hasNext) return (false);
+
+    tick->tick = m_next.tick;
+    tick->time = m_next.time;
+    tick->stepEnd = false;
+    tick->numParams = 0;
+    tick->paramTime = m_next.time;
+
+    // every event recorded in the tick; a device missing from it (its
+    // sample was dropped while recording) keeps its last position
+    while (m_hasNext && m_next.tick == tick->tick)
+    {
+        if (m_next.kind == INPUT_POSITION)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                m_pos[m_next.index][k] = m_next.value[k];
+            }
+            tick->time = m_next.time;
+        }
+        else if (m_next.kind == INPUT_PARAM && tick->numParams < REPLAY_MAX_PARAMS)
+        {
+            tick->paramTime = m_next.time;
+            tick->param[tick->numParams] = m_next.index;
+            tick->value[tick->numParams] = m_next.value[0];
+            tick->numParams++;
+        }
+        else if (m_next.kind == INPUT_STEP_END)
+        {
+            tick->stepEnd = true;
+        }
+        m_hasNext = input_trace_read(&m_reader, &m_next);
+    }
+    return (true);
+}
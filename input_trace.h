@@ -0,0 +1,178 @@
+//===========================================================================
+/*
+    input_trace.h
+
+    Recording and replay of the input of a session: the raw tool position
+    of every device at every tick, with its servo time, the parameter
+    changes (gains, modes) with the tick they took effect on, and the ends
+    of the sweep steps. Played back through ReplayBackend in virtual time,
+    a trace drives the unchanged force computation with the same input as
+    the recorded session, as fast as the loop runs, and gives the same
+    output every time.
+
+    The trace is a header followed by a stream of events:
+
+        uint8   kind << 4 | index           index = device or parameter
+        varint  tick - previous tick        zigzag
+        xor     time                        against the previous event
+        xor     value[0..2]                 positions against the device's
+                                            previous position; a parameter
+                                            value against 0
+
+    "xor" stores a double exactly as the bytes in which it differs from
+    its predecessor: one byte with the number of leading (high nibble) and
+    trailing (low nibble) zero bytes of the XOR, then the bytes between.
+    Two devices read in the same tick share their time, and a slowly
+    moving grip keeps sign, exponent and the high mantissa bytes, so a
+    position costs a few bytes instead of eight.
+*/
+//===========================================================================
+#pragma once
+
+#include "falcon_device.h"
+#include "command_queue.h"
+#include <stdio.h>
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+const uint32_t INPUT_TRACE_VERSION  = 1;
+
+// event kinds
+const int INPUT_POSITION            = 0;    // raw tool position, HDAL axes [m]
+const int INPUT_PARAM               = 1;    // parameter set to value[0]
+const int INPUT_STEP_END            = 2;    // the sweep step ended, clock restarted
+
+// parameter changes of one tick that a replay applies, more are dropped
+const int REPLAY_MAX_PARAMS         = 16;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+#pragma pack(push, 8)
+
+struct InputTraceHeader
+{
+    char     magic[8];          // "FALCTRC" + '\0'
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(InputTraceHeader)
+    int32_t  numDevices;
+    int32_t  reserved;
+    double   servoRate;         // [Hz]
+    double   freqMin;           // sweep range [Hz]
+    double   freqMax;
+    double   params[PARAM_COUNT];   // values when the servo loop started
+};
+
+#pragma pack(pop)
+
+struct InputEvent
+{
+    int       kind;
+    int       index;            // device or parameter
+    long long tick;
+    double    time;             // servo time [s]
+    double    value[3];
+};
+
+// the value an event is coded against
+struct InputTraceState
+{
+    long long tick;
+    uint64_t  time;
+    uint64_t  pos[FALCON_MAX_DEVICES][3];
+};
+
+struct InputTraceWriter
+{
+    FILE*           file;
+    InputTraceState last;
+    long long       events;
+};
+
+struct InputTraceReader
+{
+    FILE*            file;
+    InputTraceHeader header;
+    InputTraceState  last;
+};
+
+// one tick of a replayed trace
+struct ReplayTick
+{
+    long long tick;             // as recorded
+    double    time;             // servo time of the tick's positions [s]
+    bool      stepEnd;          // the sweep step ended at this tick
+    int       numParams;
+    double    paramTime;        // servo time the changes were applied at [s]
+    int       param[REPLAY_MAX_PARAMS];
+    double    value[REPLAY_MAX_PARAMS];
+};
+
+//---------------------------------------------------------------------------
+
+// devices whose positions come from a trace; the application asks for the
+// next tick with nextTick() at the start of each tick and reads the
+// positions as from any other backend
+class ReplayBackend : public FalconBackend
+{
+  public:
+
+    ReplayBackend();
+    ~ReplayBackend();
+
+    // open the trace, false if it cannot be read
+    bool load(const char* path);
+    const InputTraceHeader& header() { return m_reader.header; }
+
+    const char* getName() { return "trace replay"; }
+    int getNumDevices() { return m_reader.header.numDevices; }
+
+    bool open(int index) { return (index >= 0 && index < getNumDevices()); }
+    void close(int index) {}
+    void start() {}
+    void stop() {}
+    void getPosition(int index, double position[3]);
+    void setForce(int index, const double force[3]) {}
+
+    // events of the next tick, false at the end of the trace
+    bool nextTick(ReplayTick* tick);
+
+  private:
+
+    InputTraceReader m_reader;
+    InputEvent       m_next;
+    bool             m_hasNext;
+    double           m_pos[FALCON_MAX_DEVICES][3];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// header of a trace: sweep range and device count, parameters to be set
+// by the caller
+void input_trace_init_header(InputTraceHeader* header, int numDevices, double servoRate,
+                             double freqMin, double freqMax);
+
+// create a trace file and write its header
+bool input_trace_create(InputTraceWriter* writer, const char* path, const InputTraceHeader& header);
+
+void input_trace_write(InputTraceWriter* writer, const InputEvent& event);
+
+void input_trace_close(InputTraceWriter* writer);
+
+//---------------------------------------------------------------------------
+
+// open a trace and read its header
+bool input_trace_open(InputTraceReader* reader, const char* path);
+
+// next event, false at the end of the trace or at a damaged event
+bool input_trace_read(InputTraceReader* reader, InputEvent* event);
+
+void input_trace_close_read(InputTraceReader* reader);
@@ -0,0 +1,286 @@
+//===========================================================================
+/*
+    rt_profile.cpp
+
+    Real-time setup of the process and the servo thread.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "rt_profile.h"
+#include <stdlib.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#endif
+//---------------------------------------------------------------------------
+
+static const int PAGE_BYTES = 4096;
+
+//---------------------------------------------------------------------------
+
+static int cpu_count()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+// the profile's servo CPU, or -1 if there is no CPU to spare for it
+static int servo_cpu(const RtProfile* profile, int numCpus)
+{
+    if (numCpus < 2) return (-1);
+    if (profile->servoCpu < 0) return (numCpus - 1);
+    return (profile->servoCpu < numCpus) ? profile->servoCpu : -1;
+}
+
+//---------------------------------------------------------------------------
+
+void rt_profile_defaults(RtProfile* profile)
+{
+    profile->priority   = RT_DEFAULT_PRIORITY;
+    profile->servoCpu   = -1;
+    profile->lockMemory = true;
+    profile->stackKb    = RT_DEFAULT_STACK_KB;
+    profile->heapKb     = RT_DEFAULT_HEAP_KB;
+}
+
+//---------------------------------------------------------------------------
+
+// touch one byte per page of a block so that every page is mapped now
+static void touch_pages(volatile unsigned char* block, size_t bytes)
+{
+    for (size_t k = 0; k < bytes; k += PAGE_BYTES)
+    {
+        block[k] = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static long locked_kb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return (-1);
+    return (long)(counters.WorkingSetSize / 1024);
+#else
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL) return (-1);
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, "VmLck:", 6) == 0)
+        {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+void rt_process_setup(const RtProfile* profile, RtReport* report)
+{
+    memset(report, 0, sizeof(RtReport));
+    report->numCpus = cpu_count();
+    report->servoCpu = -1;
+    int cpu = servo_cpu(profile, report->numCpus);
+
+#if defined(_WIN32)
+    // the working set has to be large enough for everything to stay in
+    if (profile->lockMemory)
+    {
+        SIZE_T bytes = (SIZE_T)(profile->heapKb + 65536) * 1024;
+        report->memoryLocked = SetProcessWorkingSetSize(GetCurrentProcess(), bytes, bytes * 2) != 0;
+        if (!report->memoryLocked) report->lockError = (int)GetLastError();
+    }
+#else
+    if (profile->lockMemory)
+    {
+        report->memoryLocked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+        if (!report->memoryLocked) report->lockError = errno;
+    }
+#if defined(__GLIBC__)
+    // keep freed memory in the process instead of returning it to the
+    // system, and serve large blocks from the heap, not from new mappings
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+#endif
+
+    // grow the heap once, touch it and give it back to the allocator: the
+    // pages stay mapped (and locked) for later allocations
+    if (profile->heapKb > 0)
+    {
+        size_t bytes = (size_t)profile->heapKb * 1024;
+        unsigned char* block = (unsigned char*)malloc(bytes);
+        if (block != NULL)
+        {
+            touch_pages(block, bytes);
+#if defined(_WIN32)
+            if (profile->lockMemory) VirtualLock(block, bytes);
+#endif
+            free(block);
+            report->heapKb = profile->heapKb;
+        }
+    }
+
+    // keep the main thread, and so every thread it starts, off the servo CPU
+    if (cpu >= 0)
+    {
+#if defined(_WIN32)
+        // new threads take the process mask, not this one: only the main
+        // thread is moved
+        DWORD_PTR all = 0;
+        for (int k = 0; k < report->numCpus && k < (int)(8 * sizeof(DWORD_PTR)); k++) all |= (DWORD_PTR)1 << k;
+        report->mainPinned = SetThreadAffinityMask(GetCurrentThread(), all & ~((DWORD_PTR)1 << cpu)) != 0;
+        report->othersPinned = false;
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int k = 0; k < report->numCpus; k++)
+        {
+            if (k != cpu) CPU_SET(k, &set);
+        }
+        report->mainPinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        report->othersPinned = report->mainPinned;
+#endif
+    }
+
+    report->lockedKb = locked_kb();
+}
+
+//---------------------------------------------------------------------------
+
+// use "kb" of stack now, so that the pages are mapped before the loop runs
+static void prefault_stack(int kb)
+{
+    volatile unsigned char stack[RT_MAX_STACK_KB * 1024];
+    size_t bytes = (size_t)((kb < RT_MAX_STACK_KB) ? kb : RT_MAX_STACK_KB) * 1024;
+    touch_pages(stack + sizeof(stack) - bytes, bytes);
+}
+
+//---------------------------------------------------------------------------
+
+void rt_servo_thread_setup(const RtProfile* profile, RtReport* report)
+{
+    int cpu = servo_cpu(profile, report->numCpus);
+
+#if defined(_WIN32)
+    if (profile->priority > 0)
+    {
+        report->priorityGranted = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+        if (!report->priorityGranted) report->priorityError = (int)GetLastError();
+    }
+    report->priority = GetThreadPriority(GetCurrentThread());
+
+    if (cpu >= 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0)
+    {
+        report->servoCpu = cpu;
+    }
+#else
+    if (profile->priority > 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = profile->priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        report->priorityGranted = (error == 0);
+        report->priorityError = error;
+    }
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0)
+    {
+        report->priority = (policy == SCHED_FIFO) ? param.sched_priority : 0;
+    }
+
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        {
+            report->servoCpu = cpu;
+        }
+    }
+#endif
+
+    if (profile->stackKb > 0)
+    {
+        prefault_stack(profile->stackKb);
+        report->stackKb = (profile->stackKb < RT_MAX_STACK_KB) ? profile->stackKb : RT_MAX_STACK_KB;
+    }
+    report->faultsAtStart = rt_thread_faults();
+}
+
+//---------------------------------------------------------------------------
+
+long long rt_thread_faults()
+{
+#if defined(_WIN32)
+    // per-process count only
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return (-1);
+    return (long long)counters.PageFaultCount;
+#elif defined(RUSAGE_THREAD)
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) return (-1);
+    return (long long)usage.ru_minflt + usage.ru_majflt;
+#else
+    return (-1);
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+void rt_print_report(const RtReport* report, FILE* out)
+{
+    fprintf(out, "RT profile (%d CPUs):\n", report->numCpus);
+
+    if (report->priorityGranted)
+        fprintf(out, "  servo priority: %d\n", report->priority);
+    else
+        fprintf(out, "  servo priority: NOT granted (error %d), running at %d\n",
+                report->priorityError, report->priority);
+
+    if (report->servoCpu >= 0)
+        fprintf(out, "  servo CPU: %d, other threads %s\n", report->servoCpu,
+                report->othersPinned ? "on the remaining CPUs" :
+                report->mainPinned ? "NOT moved off it, main thread only" : "NOT moved off it");
+    else
+        fprintf(out, "  servo CPU: not pinned\n");
+
+    if (report->memoryLocked)
+        fprintf(out, "  memory: locked, %ld KB resident\n", report->lockedKb);
+    else
+        fprintf(out, "  memory: NOT locked (error %d)\n", report->lockError);
+
+    fprintf(out, "  pre-faulted: %d KB heap, %d KB servo stack\n", report->heapKb, report->stackKb);
+}
@@ -0,0 +1,99 @@
+//===========================================================================
+/*
+    rt_profile.h
+
+    Real-time setup of the process and the servo thread:
+
+        - the servo thread runs under SCHED_FIFO (Linux) or at time-critical
+          priority (Windows) and is pinned to one CPU
+        - every other thread (graphics, telemetry writer) is kept off that
+          CPU; on Linux threads inherit the affinity of the main thread, so
+          it is set there before any thread is started. Windows threads
+          start with the process mask instead, which the servo thread could
+          then not leave, so there only the main (graphics) thread is moved
+          and the report says the others are not
+        - all memory is locked (mlockall / working set), and a stack and a
+          heap reserve are touched up front so the servo loop does not take
+          page faults on memory it has not used yet
+
+    Each step may be refused (missing CAP_SYS_NICE / CAP_IPC_LOCK, rtprio
+    or memlock limits); the setup carries on and the report says what was
+    granted and what was not.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// default SCHED_FIFO priority of the servo thread (1..99)
+const int RT_DEFAULT_PRIORITY       = 80;
+
+// default stack and heap to pre-fault [KB]
+const int RT_DEFAULT_STACK_KB       = 256;
+const int RT_DEFAULT_HEAP_KB        = 32768;
+
+// most stack that can be pre-faulted [KB]
+const int RT_MAX_STACK_KB           = 512;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct RtProfile
+{
+    int  priority;              // servo thread priority, 0 = leave as is
+    int  servoCpu;              // CPU of the servo thread, -1 = last CPU
+    bool lockMemory;            // lock all current and future pages
+    int  stackKb;               // servo stack to pre-fault [KB]
+    int  heapKb;                // heap to pre-fault and keep [KB]
+};
+
+// what the system granted
+struct RtReport
+{
+    int  numCpus;
+
+    // process / main thread
+    bool memoryLocked;
+    int  lockError;             // errno / GetLastError() of a refused lock
+    int  heapKb;                // heap pre-faulted [KB]
+    bool mainPinned;            // main thread kept off the servo CPU
+    bool othersPinned;          // and the threads it starts
+    long lockedKb;              // locked memory after the setup [KB], -1 = unknown
+
+    // servo thread
+    bool priorityGranted;
+    int  priority;              // priority in effect
+    int  priorityError;
+    int  servoCpu;              // CPU the servo thread is pinned to, -1 = none
+    int  stackKb;               // stack pre-faulted [KB]
+    long long faultsAtStart;    // page faults of the servo thread after setup
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// default profile: FIFO 80 on the last CPU, memory locked, stack and heap
+// pre-faulted
+void rt_profile_defaults(RtProfile* profile);
+
+// main thread, before any other thread is started: lock memory,
+// pre-fault the heap and move the main thread (on Linux also the threads
+// it starts) off the servo CPU
+void rt_process_setup(const RtProfile* profile, RtReport* report);
+
+// servo thread, before its loop: priority, affinity and stack
+void rt_servo_thread_setup(const RtProfile* profile, RtReport* report);
+
+// minor + major page faults of the calling thread so far (-1 if unknown)
+long long rt_thread_faults();
+
+// print what was granted
+void rt_print_report(const RtReport* report, FILE* out);
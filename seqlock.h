@@ -0,0 +1,93 @@
+//===========================================================================
+/*
+    seqlock.h
+
+    Single-writer sequence lock for publishing a small, trivially copyable
+    state from the servo loop to any number of readers. write() never
+    waits; a reader copies the state and retries if a write overlapped
+    the copy, so readers can never hold up the writer, only themselves.
+
+    The state is stored as relaxed atomic words and the sequence number is
+    odd while a write is in progress, so a torn copy is always detected.
+    The sequence number also counts the writes: a reader that remembers
+    the last one it saw can tell how many it has missed.
+*/
+//===========================================================================
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+//---------------------------------------------------------------------------
+
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock state must be trivially copyable");
+
+  public:
+
+    Seqlock() : m_sequence(0)
+    {
+        for (unsigned k = 0; k < WORDS; k++) m_words[k].store(0, std::memory_order_relaxed);
+    }
+
+    // writer side, wait-free
+    void write(const T& state)
+    {
+        unsigned long long words[WORDS] = { 0 };
+        memcpy(words, &state, sizeof(T));
+
+        unsigned long long seq = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (unsigned k = 0; k < WORDS; k++)
+        {
+            m_words[k].store(words[k], std::memory_order_relaxed);
+        }
+        m_sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // reader side, one attempt; false if a write overlapped the copy
+    bool tryRead(T& state, unsigned long long* writes = NULL) const
+    {
+        unsigned long long words[WORDS];
+        unsigned long long before = m_sequence.load(std::memory_order_acquire);
+        if (before & 1) return false;
+        for (unsigned k = 0; k < WORDS; k++)
+        {
+            words[k] = m_words[k].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence.load(std::memory_order_relaxed) != before) return false;
+
+        memcpy(&state, words, sizeof(T));
+        if (writes != NULL) *writes = before / 2;
+        return true;
+    }
+
+    // reader side, retries until it gets a consistent copy; returns the
+    // number of writes so far
+    unsigned long long read(T& state) const
+    {
+        unsigned long long writes;
+        while (!tryRead(state, &writes)) {}
+        return writes;
+    }
+
+    // number of completed writes
+    unsigned long long writes() const
+    {
+        return m_sequence.load(std::memory_order_acquire) / 2;
+    }
+
+  private:
+
+    static const unsigned WORDS = (sizeof(T) + 7) / 8;
+
+    // the sequence number has a cache line of its own, the writer touches
+    // it twice per write and readers poll it
+    alignas(64) std::atomic<unsigned long long> m_sequence;
+    alignas(64) std::atomic<unsigned long long> m_words[WORDS];
+};
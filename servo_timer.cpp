@@ -0,0 +1,243 @@
+//===========================================================================
+/*
+    servo_timer.cpp
+
+    Absolute-deadline pacing for the haptic servo loop.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "servo_timer.h"
+#include <math.h>
+//---------------------------------------------------------------------------
+#if defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "winmm.lib")
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <time.h>
+#include <errno.h>
+#endif
+//---------------------------------------------------------------------------
+
+long long servo_time_ns()
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    // split to avoid overflowing the multiplication on long uptimes
+    long long sec = now.QuadPart / freq.QuadPart;
+    long long rem = now.QuadPart % freq.QuadPart;
+    return sec * 1000000000LL + rem * 1000000000LL / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+#if defined(_WIN32)
+// high-resolution waitable timer (Windows 10 1803 and later), NULL where
+// the system does not have one; created once, kept for the process
+static HANDLE waitableTimer = NULL;
+#endif
+
+//---------------------------------------------------------------------------
+
+// sleep until the absolute time "deadline" (servo_time_ns time base)
+static void sleep_until(long long deadline)
+{
+#if defined(_WIN32)
+    // the high-resolution timer wakes well within a millisecond; it takes
+    // a relative time in 100 ns units
+    if (waitableTimer != NULL)
+    {
+        LARGE_INTEGER due;
+        due.QuadPart = -((deadline - servo_time_ns()) / 100);
+        if (due.QuadPart < 0 && SetWaitableTimerEx(waitableTimer, &due, 0, NULL, NULL, NULL, 0))
+        {
+            WaitForSingleObject(waitableTimer, INFINITE);
+        }
+        return;
+    }
+
+    // Sleep() only has millisecond granularity (with timeBeginPeriod(1)),
+    // so stop sleeping once less than two scheduler quanta are left and
+    // let the busy-wait tail take over; at 1 kHz that is the whole period
+    while (deadline - servo_time_ns() > 2000000LL)
+    {
+        Sleep(1);
+    }
+#else
+    struct timespec ts;
+    ts.tv_sec  = (time_t)(deadline / 1000000000LL);
+    ts.tv_nsec = (long)(deadline % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+void servo_timer_init(ServoTimer* timer, double rate, int spinUs, bool virtualTime)
+{
+    if (rate <= 0) { rate = SERVO_DEFAULT_RATE; }
+    if (spinUs < 0) { spinUs = 0; }
+
+#if defined(_WIN32)
+    // raise the system timer resolution to 1 ms for the lifetime of the process
+    timeBeginPeriod(1);
+    if (waitableTimer == NULL)
+    {
+        waitableTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                               TIMER_ALL_ACCESS);
+    }
+#endif
+
+    timer->rate         = rate;
+    timer->periodNs     = (long long)(1e9 / rate);
+    timer->spinNs       = (long long)spinUs * 1000LL;
+    timer->virtualTime  = virtualTime;
+    timer->nextDeadline = servo_time_ns() + timer->periodNs;
+    servo_timer_reset_stats(timer);
+    servo_timer_reset_clock(timer);
+}
+
+//---------------------------------------------------------------------------
+
+void servo_timer_start(ServoTimer* timer)
+{
+    timer->nextDeadline = servo_time_ns() + timer->periodNs;
+    servo_timer_reset_stats(timer);
+}
+
+//---------------------------------------------------------------------------
+
+long long servo_timer_wait(ServoTimer* timer)
+{
+    long long deadline = timer->nextDeadline;
+    long long now = servo_time_ns();
+
+    // cost of the tick that just finished
+    if (timer->ticks > 0)
+    {
+        long long work = now - timer->lastWakeNs;
+        if (work > timer->maxWorkNs) { timer->maxWorkNs = work; }
+        timer->sumWorkNs += (double)work;
+    }
+
+    // virtual time: never wait, never late
+    if (timer->virtualTime)
+    {
+        timer->ticks++;
+        timer->lastLatenessNs = 0;
+        timer->lastWakeNs = now;
+        return 0;
+    }
+
+    if (now < deadline)
+    {
+        // coarse sleep up to the start of the busy-wait tail
+        if (deadline - now > timer->spinNs)
+        {
+            sleep_until(deadline - timer->spinNs);
+        }
+
+        // spin for the remainder
+        do
+        {
+            now = servo_time_ns();
+        }
+        while (now < deadline);
+    }
+
+    long long lateness = now - deadline;
+
+    // schedule the next tick; if one or more whole periods were missed,
+    // skip them instead of running a burst of catch-up ticks
+    long long missed = lateness / timer->periodNs;
+    if (missed > 0)
+    {
+        timer->overruns++;
+    }
+    timer->nextDeadline = deadline + (missed + 1) * timer->periodNs;
+
+    // update statistics
+    timer->ticks++;
+    timer->lastLatenessNs = lateness;
+    if (lateness > timer->maxLatenessNs) { timer->maxLatenessNs = lateness; }
+    timer->sumLatenessNs   += (double)lateness;
+    timer->sumSqLatenessNs += (double)lateness * (double)lateness;
+    timer->lastWakeNs = now;
+
+    return lateness;
+}
+
+//---------------------------------------------------------------------------
+
+void servo_timer_reset_stats(ServoTimer* timer)
+{
+    timer->ticks           = 0;
+    timer->overruns        = 0;
+    timer->lastLatenessNs  = 0;
+    timer->maxLatenessNs   = 0;
+    timer->sumLatenessNs   = 0;
+    timer->sumSqLatenessNs = 0;
+    timer->lastWakeNs      = 0;
+    timer->maxWorkNs       = 0;
+    timer->sumWorkNs       = 0;
+}
+
+//---------------------------------------------------------------------------
+
+double servo_timer_seconds(const ServoTimer* timer)
+{
+    if (timer->virtualTime)
+    {
+        return (double)(timer->ticks - timer->clockStartTick) / timer->rate;
+    }
+    return (double)(servo_time_ns() - timer->clockStartNs) * 1e-9;
+}
+
+//---------------------------------------------------------------------------
+
+void servo_timer_reset_clock(ServoTimer* timer)
+{
+    timer->clockStartNs   = servo_time_ns();
+    timer->clockStartTick = timer->ticks;
+}
+
+//---------------------------------------------------------------------------
+
+void servo_timer_print_stats(const ServoTimer* timer, FILE* out)
+{
+    double mean = 0;
+    double stddev = 0;
+    double work = 0;
+    if (timer->ticks > 1)
+    {
+        work = timer->sumWorkNs / (timer->ticks - 1);
+    }
+    if (timer->ticks > 0)
+    {
+        mean = timer->sumLatenessNs / timer->ticks;
+        double var = timer->sumSqLatenessNs / timer->ticks - mean * mean;
+        stddev = (var > 0) ? sqrt(var) : 0;
+    }
+
+    fprintf(out, "servo: %.0f Hz%s, %lld ticks, %lld overruns\n",
+            timer->rate, timer->virtualTime ? " (virtual time)" : "", timer->ticks, timer->overruns);
+    fprintf(out, "servo: lateness mean %.1f us, stddev %.1f us, max %.1f us\n",
+            mean / 1000.0, stddev / 1000.0, timer->maxLatenessNs / 1000.0);
+    fprintf(out, "servo: tick cost mean %.1f us, max %.1f us (period %.1f us)\n",
+            work / 1000.0, timer->maxWorkNs / 1000.0, timer->periodNs / 1000.0);
+}
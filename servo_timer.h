@@ -0,0 +1,94 @@
+//===========================================================================
+/*
+    servo_timer.h
+
+    Absolute-deadline pacing for the haptic servo loop. The loop sleeps
+    until the next deadline (period = 1/rate) instead of for a fixed
+    interval, so the tick rate does not drift with the work done per tick.
+    An optional busy-wait tail covers the last part of each period when
+    the OS sleep granularity is too coarse for the requested rate.
+
+    On Windows the sleep is a high-resolution waitable timer where the
+    system has one (Windows 10 1803 and later). Older systems fall back
+    to Sleep(1) until 2 ms before the deadline, so at 1 kHz and above the
+    whole period is busy-waited there.
+
+    The timer also provides the experiment clock. In virtual time mode
+    the loop does not wait at all and the clock advances by exactly one
+    period per tick, so a run goes as fast as the CPU allows and repeats
+    bit for bit.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// default servo rate [Hz]
+const double SERVO_DEFAULT_RATE     = 1000.0;
+
+// default busy-wait tail before each deadline [us]
+const int SERVO_DEFAULT_SPIN_US     = 100;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct ServoTimer
+{
+    double    rate;             // requested tick rate [Hz]
+    long long periodNs;         // tick period [ns]
+    long long spinNs;           // busy-wait tail before each deadline [ns]
+    long long nextDeadline;     // absolute time of the next tick [ns]
+    bool      virtualTime;      // no waiting, one period of clock per tick
+
+    // experiment clock origin
+    long long clockStartNs;
+    long long clockStartTick;
+
+    // per-tick statistics, lateness = wake-up time - deadline
+    long long ticks;
+    long long overruns;         // ticks that missed at least one full period
+    long long lastLatenessNs;
+    long long maxLatenessNs;
+    double    sumLatenessNs;
+    double    sumSqLatenessNs;
+
+    // work done between two waits, i.e. the cost of a tick
+    long long lastWakeNs;
+    long long maxWorkNs;
+    double    sumWorkNs;
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// monotonic time [ns]
+long long servo_time_ns();
+
+// set rate and busy-wait tail and start the experiment clock
+void servo_timer_init(ServoTimer* timer, double rate, int spinUs, bool virtualTime);
+
+// servo thread, before the loop: first deadline is one period from now
+void servo_timer_start(ServoTimer* timer);
+
+// block until the next deadline, returns lateness of this tick [ns]
+long long servo_timer_wait(ServoTimer* timer);
+
+// clear the statistics without moving the deadline
+void servo_timer_reset_stats(ServoTimer* timer);
+
+// experiment time [s] since init or the last servo_timer_reset_clock()
+double servo_timer_seconds(const ServoTimer* timer);
+
+// restart the experiment clock from zero
+void servo_timer_reset_clock(ServoTimer* timer);
+
+// print rate, overruns, jitter and tick cost
+void servo_timer_print_stats(const ServoTimer* timer, FILE* out);
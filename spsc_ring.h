@@ -0,0 +1,70 @@
+//===========================================================================
+/*
+    spsc_ring.h
+
+    Bounded single-producer / single-consumer ring buffer. push() and pop()
+    never block and never allocate; push() fails when the ring is full so
+    the producer (the servo loop) can count the loss and carry on.
+*/
+//===========================================================================
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+//---------------------------------------------------------------------------
+
+template <typename T, unsigned N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+  public:
+
+    SpscRing() : m_head(0), m_tail(0) {}
+
+    // producer side, returns false if the ring is full
+    bool push(const T& item)
+    {
+        unsigned head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N) return false;
+        m_items[head & (N - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false if the ring is empty
+    bool pop(T& item)
+    {
+        unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) return false;
+        item = m_items[tail & (N - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, oldest item without removing it (NULL if empty)
+    const T* front() const
+    {
+        unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) return NULL;
+        return &m_items[tail & (N - 1)];
+    }
+
+    // number of queued items (approximate when called from a third thread)
+    unsigned size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    unsigned capacity() const { return N; }
+
+  private:
+
+    T m_items[N];
+
+    // head and tail live on separate cache lines so producer and consumer
+    // do not invalidate each other on every operation
+    alignas(64) std::atomic<unsigned> m_head;
+    alignas(64) std::atomic<unsigned> m_tail;
+};
@@ -0,0 +1,712 @@
+//===========================================================================
+/*
+    sweep_analyzer.cpp
+
+    Offline summary of the logs of a frequency sweep. Every file of the
+    given directories is memory mapped and analyzed on its own, the files
+    spread over all cores with a work-stealing pool, and the results are
+    printed as one table.
+
+    usage: sweep_analyzer <dir|file> ... [-from <s>] [-threads <n>]
+
+        -from       skip the samples before this time, e.g. the centering
+                    phase of each step (default 1)
+        -threads    worker threads, 0 = all cores (default 0)
+
+    Two kinds of files are read:
+        *.bin       binary logs of 01-devices (raw or packed, see binlog.h);
+                    device and sweep frequency come from the header
+        f<freq>.txt legacy "x y z t" rows (force and time), as in the old
+                    sweep logs and binlog_dump -text; the frequency is
+                    taken from the file name
+
+    Other text files of a directory (sweep_response.txt, baza_RD.txt...)
+    are not logs and are left out; a text file named on the command line
+    that holds no "x y z t" row is skipped with a note on stderr.
+
+    The table goes to stdout, one row per file in name order:
+
+        file device freq records rms_err_mm peak_err_mm f_mean_N f_rms_N
+        f_peak_N axis x_amp_mm x_phase_deg f_amp_N f_phase_deg gain_N_m
+        phase_deg
+
+    The error columns are the norm of the position error to the coupled
+    device, the force columns the norm of the commanded force. Amplitude
+    and phase at the file's frequency are found with a Goertzel filter
+    over the last whole number of periods, on the axis that moves most
+    (binary logs) or is pushed hardest (text files); phases are those of
+    A sin(2 pi f t + phase). gain_N_m and phase_deg are force over
+    position, the dynamic stiffness the device felt at that frequency.
+    Columns a file does not have are "-". Samples are taken as equally
+    spaced at the header's servo rate (text files: the mean spacing of
+    their rows).
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "binlog.h"
+#include "servo_timer.h"
+#include "thread_pool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+//---------------------------------------------------------------------------
+
+static const double pi = 3.141592653589793;
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+// amplitude and phase of one signal at one frequency
+struct Goertzel
+{
+    double coeff;               // 2 cos(w)
+    double s1;
+    double s2;
+};
+
+struct FileResult
+{
+    std::string path;
+    bool        binary;
+
+    // results
+    bool        ok;
+    bool        skipped;        // text file without a single row
+    char        device[32];
+    double      freq;           // [Hz], 0 if unknown
+    long long   records;        // analyzed, after -from
+    double      rmsError;       // [m]
+    double      peakError;      // [m]
+    double      meanForce;      // [N]
+    double      rmsForce;       // [N]
+    double      peakForce;      // [N]
+    int         axis;           // -1 if no amplitude was measured
+    double      posAmp;         // [m]
+    double      posPhase;       // [rad]
+    double      forceAmp;       // [N]
+    double      forcePhase;     // [rad]
+    size_t      bytes;          // size of the file
+};
+
+struct AnalyzerBatch
+{
+    double from;                // [s]
+    std::vector<FileResult> files;
+};
+
+// a memory mapped text file
+struct MappedFile
+{
+    const char* data;
+    size_t      size;
+    void*       handle[2];
+};
+
+// one legacy row
+struct TextRow
+{
+    double force[3];
+    double time;
+};
+
+
+//---------------------------------------------------------------------------
+// SIGNALS
+//---------------------------------------------------------------------------
+
+static double wrap_phase(double phase)
+{
+    while (phase > pi) phase -= 2 * pi;
+    while (phase <= -pi) phase += 2 * pi;
+    return phase;
+}
+
+//---------------------------------------------------------------------------
+
+static void goertzel_init(Goertzel* g, double w)
+{
+    g->coeff = 2.0 * cos(w);
+    g->s1 = 0;
+    g->s2 = 0;
+}
+
+static void goertzel_add(Goertzel* g, double x)
+{
+    double s0 = x + g->coeff * g->s1 - g->s2;
+    g->s2 = g->s1;
+    g->s1 = s0;
+}
+
+// amplitude and phase of A sin(w n + w n0 + phase) after "count" samples,
+// n0 the index the first sample would have in a run started at time 0
+static void goertzel_result(const Goertzel& g, double w, long long count, double n0,
+                            double* amp, double* phase)
+{
+    // y = sum x[n] exp(j w (count-1-n)), rotated back to the start
+    double re = g.s1 - cos(w) * g.s2;
+    double im = sin(w) * g.s2;
+    double rot = -w * (count - 1 + n0);
+    double xr = re * cos(rot) - im * sin(rot);
+    double xi = re * sin(rot) + im * cos(rot);
+
+    *amp = 2.0 * sqrt(xr * xr + xi * xi) / count;
+    *phase = wrap_phase(atan2(xi, xr) + pi / 2);
+}
+
+//---------------------------------------------------------------------------
+
+// samples of the last whole number of periods out of "count"
+static long long whole_periods(long long count, double freq, double rate)
+{
+    if (freq <= 0 || rate <= 0) return (0);
+    double perPeriod = rate / freq;
+    long long periods = (long long)(count / perPeriod);
+    long long n = llround(periods * perPeriod);
+    return (n < count) ? n : count;
+}
+
+//---------------------------------------------------------------------------
+
+static double norm3(double x, double y, double z)
+{
+    return sqrt(x * x + y * y + z * z);
+}
+
+
+//---------------------------------------------------------------------------
+// BINARY LOGS
+//---------------------------------------------------------------------------
+
+static void analyze_binary(double from, FileResult* result)
+{
+    BinLogReader reader;
+    if (!binlog_open_read(&reader, result->path.c_str())) return;
+
+    const BinLogHeader* h = reader.header;
+    snprintf(result->device, sizeof(result->device), "%.31s", h->device);
+    result->freq = h->freq;
+    result->bytes = reader.size;
+
+    uint64_t first = binlog_seek(&reader, from);
+    long long count = (long long)(reader.numRecords - first);
+    long long window = whole_periods(count, h->freq, h->servoRate);
+    long long windowStart = count - window;
+    double w = (h->servoRate > 0) ? 2 * pi * h->freq / h->servoRate : 0;
+
+    Goertzel pos[3];
+    Goertzel force[3];
+    for (int k = 0; k < 3; k++)
+    {
+        goertzel_init(&pos[k], w);
+        goertzel_init(&force[k], w);
+    }
+
+    double sumSqError = 0;
+    double sumForce = 0;
+    double sumSqForce = 0;
+    double n0 = 0;
+    for (long long n = 0; n < count; n++)
+    {
+        const BinLogSample* s = binlog_sample(&reader, first + n);
+
+        double e = norm3(s->errorPos[0], s->errorPos[1], s->errorPos[2]);
+        double f = norm3(s->force[0], s->force[1], s->force[2]);
+        sumSqError += e * e;
+        sumForce += f;
+        sumSqForce += f * f;
+        if (e > result->peakError) result->peakError = e;
+        if (f > result->peakForce) result->peakForce = f;
+
+        if (n >= windowStart)
+        {
+            if (n == windowStart) n0 = s->time * h->servoRate;
+            for (int k = 0; k < 3; k++)
+            {
+                goertzel_add(&pos[k], s->pos[k]);
+                goertzel_add(&force[k], s->force[k]);
+            }
+        }
+    }
+
+    result->records = count;
+    if (count > 0)
+    {
+        result->rmsError  = sqrt(sumSqError / count);
+        result->meanForce = sumForce / count;
+        result->rmsForce  = sqrt(sumSqForce / count);
+    }
+    if (window > 0)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            double amp, phase;
+            goertzel_result(pos[k], w, window, n0, &amp, &phase);
+            if (result->axis < 0 || amp > result->posAmp)
+            {
+                result->axis = k;
+                result->posAmp = amp;
+                result->posPhase = phase;
+            }
+        }
+        goertzel_result(force[result->axis], w, window, n0, &result->forceAmp, &result->forcePhase);
+    }
+
+    binlog_close_read(&reader);
+    result->ok = true;
+}
+
+
+//---------------------------------------------------------------------------
+// TEXT LOGS
+//---------------------------------------------------------------------------
+
+static bool map_text(MappedFile* file, const char* path)
+{
+    file->data = NULL;
+    file->size = 0;
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return (false);
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(handle, &size);
+    file->handle[0] = handle;
+    file->handle[1] = NULL;
+    file->size = (size_t)size.QuadPart;
+    if (file->size == 0) return (true);
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(handle);
+        return (false);
+    }
+    file->data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    file->handle[1] = mapping;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return (false);
+
+    struct stat st;
+    fstat(fd, &st);
+    file->size = st.st_size;
+    if (file->size == 0)
+    {
+        close(fd);
+        return (true);
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return (false);
+    file->data = (const char*)data;
+#endif
+    return (file->data != NULL);
+}
+
+static void unmap_text(MappedFile* file)
+{
+#if defined(_WIN32)
+    if (file->data != NULL) UnmapViewOfFile(file->data);
+    if (file->handle[1] != NULL) CloseHandle((HANDLE)file->handle[1]);
+    CloseHandle((HANDLE)file->handle[0]);
+#else
+    if (file->data != NULL) munmap((void*)file->data, file->size);
+#endif
+    file->data = NULL;
+}
+
+//---------------------------------------------------------------------------
+
+// one decimal number ("-12.34567", "1e-3") at p, or NULL; faster than
+// strtod, which also handles locales, hex and infinities, and exact to the
+// digits the logs are written with
+static const char* parse_number(const char* p, const char* end, double* value)
+{
+    static const double power[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                    1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+                                    1e17, 1e18 };
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    const char* start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (digits < 18) { mantissa = mantissa * 10 + (*p - '0'); digits++; }
+        else exponent++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (digits < 18) { mantissa = mantissa * 10 + (*p - '0'); digits++; exponent--; }
+        }
+    }
+    if (p == start || (p == start + 1 && *start == '.')) return (NULL);
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+')) negativeExp = (*q++ == '-');
+        int e = 0;
+        const char* digitsStart = q;
+        for (; q < end && *q >= '0' && *q <= '9'; q++)
+        {
+            if (e < 10000) e = e * 10 + (*q - '0');
+        }
+        if (q > digitsStart)
+        {
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    double v = (double)mantissa;
+    if (exponent < 0)
+    {
+        v = (exponent >= -18) ? v / power[-exponent] : v * pow(10.0, exponent);
+    }
+    else if (exponent > 0)
+    {
+        v = (exponent <= 18) ? v * power[exponent] : v * pow(10.0, exponent);
+    }
+    *value = negative ? -v : v;
+    return (p);
+}
+
+//---------------------------------------------------------------------------
+
+// "x y z t" rows; lines that do not hold four numbers (comments, headers)
+// are skipped
+static void parse_rows(const char* p, const char* end, std::vector<TextRow>& rows)
+{
+    while (p < end)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+
+        double v[4];
+        int n = 0;
+        const char* q = p;
+        while (n < 4)
+        {
+            while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+            if (q == eol) break;
+            q = parse_number(q, eol, &v[n]);
+            if (q == NULL) break;
+            n++;
+        }
+        if (n == 4)
+        {
+            TextRow row = { { v[0], v[1], v[2] }, v[3] };
+            rows.push_back(row);
+        }
+        p = eol + 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// sweep frequency from a "f<freq>.txt" name, 0 if there is none
+static double name_freq(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    const char* name = path.c_str() + ((slash == std::string::npos) ? 0 : slash + 1);
+    double freq;
+    if (name[0] != 'f' || sscanf(name + 1, "%lf", &freq) != 1 || !(freq > 0)) return (0);
+    return freq;
+}
+
+//---------------------------------------------------------------------------
+
+static void analyze_text(double from, FileResult* result)
+{
+    MappedFile file;
+    if (!map_text(&file, result->path.c_str())) return;
+
+    std::vector<TextRow> rows;
+    rows.reserve(file.size / 40);
+    if (file.data != NULL) parse_rows(file.data, file.data + file.size, rows);
+    result->bytes = file.size;
+    unmap_text(&file);
+    if (rows.empty())
+    {
+        result->skipped = true;
+        return;
+    }
+
+    size_t first = 0;
+    while (first < rows.size() && rows[first].time < from) first++;
+    long long count = (long long)(rows.size() - first);
+
+    result->freq = name_freq(result->path);
+    snprintf(result->device, sizeof(result->device), "-");
+    result->records = count;
+
+    double sumForce = 0;
+    double sumSqForce = 0;
+    for (size_t n = first; n < rows.size(); n++)
+    {
+        double f = norm3(rows[n].force[0], rows[n].force[1], rows[n].force[2]);
+        sumForce += f;
+        sumSqForce += f * f;
+        if (f > result->peakForce) result->peakForce = f;
+    }
+    if (count > 0)
+    {
+        result->meanForce = sumForce / count;
+        result->rmsForce  = sqrt(sumSqForce / count);
+    }
+
+    // the rows carry no rate, take their mean spacing
+    double rate = 0;
+    if (count > 1 && rows.back().time > rows[first].time)
+    {
+        rate = (count - 1) / (rows.back().time - rows[first].time);
+    }
+    long long window = whole_periods(count, result->freq, rate);
+    if (window > 0)
+    {
+        double w = 2 * pi * result->freq / rate;
+        size_t start = rows.size() - (size_t)window;
+        double n0 = rows[start].time * rate;
+        for (int k = 0; k < 3; k++)
+        {
+            Goertzel g;
+            goertzel_init(&g, w);
+            for (size_t n = start; n < rows.size(); n++)
+            {
+                goertzel_add(&g, rows[n].force[k]);
+            }
+            double amp, phase;
+            goertzel_result(g, w, window, n0, &amp, &phase);
+            if (result->axis < 0 || amp > result->forceAmp)
+            {
+                result->axis = k;
+                result->forceAmp = amp;
+                result->forcePhase = phase;
+            }
+        }
+    }
+    result->ok = true;
+}
+
+//---------------------------------------------------------------------------
+
+static void analyze_job(int index, void* arg)
+{
+    AnalyzerBatch* batch = (AnalyzerBatch*)arg;
+    FileResult* result = &batch->files[index];
+    if (result->binary)
+    {
+        analyze_binary(batch->from, result);
+    }
+    else
+    {
+        analyze_text(batch->from, result);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// FILES
+//---------------------------------------------------------------------------
+
+static bool has_suffix(const std::string& name, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return (name.size() > n && name.compare(name.size() - n, n, suffix) == 0);
+}
+
+static void add_file(const std::string& path, AnalyzerBatch* batch)
+{
+    FileResult result;
+    result.path = path;
+    result.binary = has_suffix(path, ".bin");
+    result.ok = false;
+    result.skipped = false;
+    result.device[0] = '\0';
+    result.freq = 0;
+    result.records = 0;
+    result.rmsError = result.peakError = 0;
+    result.meanForce = result.rmsForce = result.peakForce = 0;
+    result.axis = -1;
+    result.posAmp = result.posPhase = 0;
+    result.forceAmp = result.forcePhase = 0;
+    result.bytes = 0;
+    batch->files.push_back(result);
+}
+
+//---------------------------------------------------------------------------
+
+// the *.bin and f<freq>.txt files of a directory, or the path itself if
+// it is not one
+static void add_path(const char* path, AnalyzerBatch* batch)
+{
+    std::vector<std::string> names;
+    std::string dir(path);
+    if (!dir.empty() && dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') dir += '/';
+
+#if defined(_WIN32)
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((dir + "*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        add_file(path, batch);
+        return;
+    }
+    do
+    {
+        if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) names.push_back(entry.cFileName);
+    }
+    while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* d = opendir(path);
+    if (d == NULL)
+    {
+        add_file(path, batch);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        struct stat st;
+        if (stat((dir + entry->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) names.push_back(entry->d_name);
+    }
+    closedir(d);
+#endif
+
+    std::sort(names.begin(), names.end());
+    for (size_t n = 0; n < names.size(); n++)
+    {
+        if (has_suffix(names[n], ".bin") ||
+            (has_suffix(names[n], ".txt") && name_freq(names[n]) > 0))
+        {
+            add_file(dir + names[n], batch);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static void print_value(double value, bool valid, int width, int digits)
+{
+    if (valid) printf(" %*.*f", width, digits, value);
+    else printf(" %*s", width, "-");
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    AnalyzerBatch batch;
+    batch.from = 1.0;
+    int numThreads = 0;
+    int numPaths = 0;
+
+    bool ok = true;
+    for (int a = 1; a < argc && ok; a++)
+    {
+        if (strcmp(argv[a], "-from") == 0 && a+1 < argc)
+            batch.from = atof(argv[++a]);
+        else if (strcmp(argv[a], "-threads") == 0 && a+1 < argc)
+            numThreads = atoi(argv[++a]);
+        else if (argv[a][0] != '-')
+        {
+            add_path(argv[a], &batch);
+            numPaths++;
+        }
+        else
+            ok = false;
+    }
+    if (!ok || numPaths == 0)
+    {
+        printf("usage: sweep_analyzer <dir|file> ... [-from <s>] [-threads <n>]\n");
+        return (1);
+    }
+    if (batch.files.empty())
+    {
+        printf("No log files found\n");
+        return (1);
+    }
+
+    WorkStealingPool pool(numThreads);
+    long long start = servo_time_ns();
+    pool.run((int)batch.files.size(), analyze_job, &batch);
+    double wall = (servo_time_ns() - start) * 1e-9;
+
+    printf("%-32s %-10s %8s %10s %11s %12s %9s %8s %9s %4s %9s %12s %8s %12s %9s %10s\n",
+           "file", "device", "freq", "records", "rms_err_mm", "peak_err_mm",
+           "f_mean_N", "f_rms_N", "f_peak_N", "axis", "x_amp_mm", "x_phase_deg",
+           "f_amp_N", "f_phase_deg", "gain_N_m", "phase_deg");
+
+    size_t bytes = 0;
+    int failed = 0;
+    int skipped = 0;
+    for (size_t n = 0; n < batch.files.size(); n++)
+    {
+        const FileResult& r = batch.files[n];
+        if (r.skipped)
+        {
+            fprintf(stderr, "Skipped, no x y z t rows: %s\n", r.path.c_str());
+            skipped++;
+            continue;
+        }
+        if (!r.ok)
+        {
+            fprintf(stderr, "Could not read log file: %s\n", r.path.c_str());
+            failed++;
+            continue;
+        }
+        bytes += r.bytes;
+
+        bool hasAmp = (r.axis >= 0);
+        bool hasPos = hasAmp && r.binary;
+        bool hasGain = hasPos && r.posAmp > 0;
+        printf("%-32s %-10s", r.path.c_str(), r.device);
+        print_value(r.freq, r.freq > 0, 8, 3);
+        printf(" %10lld", r.records);
+        print_value(r.rmsError * 1000.0, r.binary, 11, 4);
+        print_value(r.peakError * 1000.0, r.binary, 12, 4);
+        print_value(r.meanForce, true, 9, 4);
+        print_value(r.rmsForce, true, 8, 4);
+        print_value(r.peakForce, true, 9, 4);
+        if (hasAmp) printf(" %4c", "xyz"[r.axis]);
+        else printf(" %4s", "-");
+        print_value(r.posAmp * 1000.0, hasPos, 9, 4);
+        print_value(r.posPhase * 180 / pi, hasPos, 12, 2);
+        print_value(r.forceAmp, hasAmp, 8, 4);
+        print_value(r.forcePhase * 180 / pi, hasAmp, 12, 2);
+        print_value(hasGain ? r.forceAmp / r.posAmp : 0, hasGain, 9, 2);
+        print_value(hasGain ? wrap_phase(r.forcePhase - r.posPhase) * 180 / pi : 0, hasGain, 10, 2);
+        printf("\n");
+    }
+
+    fprintf(stderr, "analyzer: %d files, %.1f MB in %.2f s, %.0f MB/s, %d threads, %lld steals\n",
+            (int)batch.files.size() - failed - skipped, bytes / 1e6, wall, bytes / 1e6 / wall,
+            pool.getNumThreads(), pool.getSteals());
+
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+//===========================================================================
+/*
+    sweep_runner.cpp
+
+    Batch gain / frequency sweep on simulated devices. Every point of the
+    grid Kp x Kd x Ki x freq is an independent master/slave pair running
+    the coupling of updateHaptics() in virtual time; the points are spread
+    over all cores with a work-stealing pool and summarized in one table.
+
+    usage: sweep_runner [-kp <list>] [-kd <list>] [-ki <list>] [-freq <list>]
+                        [-time <s>] [-settle <s>] [-rate <Hz>] [-threads <n>]
+
+        <list>      comma separated values "a,b,c" or a range "min:max:count"
+        -time       simulated run time of each point (default 30)
+        -settle     centering phase before the coupling starts (default 1)
+        -rate       servo rate (default 1000)
+        -threads    worker threads, 0 = all cores (default 0)
+
+    The table goes to stdout, one row per grid point in grid order:
+
+        Kp Kd Ki freq rms_err_mm peak_force_N limit_hits stable
+
+    rms_err_mm is the RMS position difference of the pair while coupled,
+    peak_force_N the largest coupling force of either device. A point is
+    unstable if the state became non-finite, a grip ran into the end of
+    its travel, or the error at the end of the run is more than twice the
+    RMS error over the whole coupled phase.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "falcon_device.h"
+#include "servo_timer.h"
+#include "teleop.h"
+#include "thread_pool.h"
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct SweepSettings
+{
+    double runTime;     // [s]
+    double settleTime;  // [s]
+    double rate;        // [Hz]
+};
+
+struct SweepPoint
+{
+    TeleopGains gains;
+    double      freq;
+
+    // results
+    double      rmsError;       // [m]
+    double      tailRmsError;   // [m], last tenth of the run
+    double      peakForce;      // [N]
+    long long   limitHits;
+    bool        finite;
+    bool        stable;
+};
+
+struct SweepBatch
+{
+    SweepSettings settings;
+    std::vector<SweepPoint> points;
+};
+
+// per-device state of the coupling, as in updateHaptics()
+struct SweepDevice
+{
+    cVector3d pos;
+    cVector3d vel;
+    cVector3d error;
+    double    time;
+    double    force[3];
+};
+
+
+//---------------------------------------------------------------------------
+
+static void run_point(const SweepSettings& settings, SweepPoint* point)
+{
+    const int numDevices = 2;
+    SimFalconBackend sim(numDevices);
+    SweepDevice dev[numDevices];
+    for (int i = 0; i < numDevices; i++)
+    {
+        sim.open(i);
+        sim.device(i)->hand.freq = point->freq;
+        dev[i].pos.zero();
+        dev[i].vel.zero();
+        dev[i].error.zero();
+        dev[i].time = 0;
+    }
+    sim.start();
+
+    long long ticks = (long long)(settings.runTime * settings.rate);
+    long long tailStart = ticks - ticks / 10;
+    double sumSq = 0;
+    double tailSumSq = 0;
+    long long coupled = 0;
+    long long tailCoupled = 0;
+    double peakForce = 0;
+    bool finite = true;
+
+    for (long long tick = 1; tick <= ticks && finite; tick++)
+    {
+        // virtual time, as in servo_timer_seconds()
+        double newTime = (double)tick / settings.rate;
+
+        for (int i = 0; i < numDevices; i++)
+        {
+            sim.update(i, newTime);
+
+            double positionServo[3];
+            sim.getPosition(i, positionServo);
+            cVector3d newPosition = teleop_app_position(positionServo);
+            cVector3d linearVelocity = teleop_velocity(newPosition, dev[i].pos, newTime - dev[i].time);
+
+            cVector3d errorPosition(0, 0, 0);
+            cVector3d errorVelocity(0, 0, 0);
+            double force[3];
+            if (newTime < settings.settleTime)
+            {
+                teleop_centering_force(point->gains, newPosition, linearVelocity, force);
+            }
+            else
+            {
+                teleop_coupling_force(point->gains, newPosition, linearVelocity,
+                                      dev[1-i].pos, dev[1-i].vel, dev[i].error,
+                                      errorPosition, errorVelocity, force);
+
+                // tracking error of the pair, counted once per tick
+                if (i == 0)
+                {
+                    double e2 = errorPosition.lengthsq();
+                    sumSq += e2;
+                    coupled++;
+                    if (tick >= tailStart)
+                    {
+                        tailSumSq += e2;
+                        tailCoupled++;
+                    }
+                }
+            }
+
+            double f = sqrt(force[0]*force[0] + force[1]*force[1] + force[2]*force[2]);
+            if (!(f < 1e30))
+            {
+                finite = false;
+                break;
+            }
+            if (f > peakForce)
+            {
+                peakForce = f;
+            }
+
+            if (teleop_should_apply(errorPosition, errorVelocity))
+            {
+                sim.setForce(i, force);
+            }
+            dev[i].pos = newPosition;
+            dev[i].vel = linearVelocity;
+            dev[i].time = newTime;
+        }
+    }
+
+    point->rmsError     = (coupled > 0) ? sqrt(sumSq / coupled) : 0;
+    point->tailRmsError = (tailCoupled > 0) ? sqrt(tailSumSq / tailCoupled) : 0;
+    point->peakForce    = peakForce;
+    point->limitHits    = sim.device(0)->limitHits + sim.device(1)->limitHits;
+    point->finite       = finite;
+    point->stable       = finite && point->limitHits == 0 &&
+                          point->tailRmsError <= 2.0 * point->rmsError;
+}
+
+//---------------------------------------------------------------------------
+
+static void sweep_job(int index, void* arg)
+{
+    SweepBatch* batch = (SweepBatch*)arg;
+    run_point(batch->settings, &batch->points[index]);
+}
+
+//---------------------------------------------------------------------------
+
+// "a,b,c" or "min:max:count"
+static bool parse_list(const char* spec, std::vector<double>& values)
+{
+    values.clear();
+
+    double lo, hi;
+    int count;
+    if (sscanf(spec, "%lf:%lf:%d", &lo, &hi, &count) == 3)
+    {
+        if (count < 1) return (false);
+        for (int n = 0; n < count; n++)
+        {
+            values.push_back((count == 1) ? lo : lo + (hi - lo) * n / (count - 1));
+        }
+        return (true);
+    }
+
+    const char* p = spec;
+    while (*p)
+    {
+        char* end;
+        double v = strtod(p, &end);
+        if (end == p) return (false);
+        values.push_back(v);
+        p = end;
+        if (*p == ',') p++;
+    }
+    return (!values.empty());
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    std::vector<double> kp(1, 140.0);
+    std::vector<double> kd(1, 1.0);
+    std::vector<double> ki(1, 3.0);
+    std::vector<double> freq(1, 1.0);
+
+    SweepSettings settings;
+    settings.runTime = 30.0;
+    settings.settleTime = 1.0;
+    settings.rate = SERVO_DEFAULT_RATE;
+    int numThreads = 0;
+
+    for (int a = 1; a < argc; a++)
+    {
+        bool ok = true;
+        if (strcmp(argv[a], "-kp") == 0 && a+1 < argc)
+            ok = parse_list(argv[++a], kp);
+        else if (strcmp(argv[a], "-kd") == 0 && a+1 < argc)
+            ok = parse_list(argv[++a], kd);
+        else if (strcmp(argv[a], "-ki") == 0 && a+1 < argc)
+            ok = parse_list(argv[++a], ki);
+        else if (strcmp(argv[a], "-freq") == 0 && a+1 < argc)
+            ok = parse_list(argv[++a], freq);
+        else if (strcmp(argv[a], "-time") == 0 && a+1 < argc)
+            settings.runTime = atof(argv[++a]);
+        else if (strcmp(argv[a], "-settle") == 0 && a+1 < argc)
+            settings.settleTime = atof(argv[++a]);
+        else if (strcmp(argv[a], "-rate") == 0 && a+1 < argc)
+            settings.rate = atof(argv[++a]);
+        else if (strcmp(argv[a], "-threads") == 0 && a+1 < argc)
+            numThreads = atoi(argv[++a]);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printf("usage: sweep_runner [-kp <list>] [-kd <list>] [-ki <list>] [-freq <list>]\n");
+            printf("                    [-time <s>] [-settle <s>] [-rate <Hz>] [-threads <n>]\n");
+            printf("       <list> = a,b,c or min:max:count\n");
+            return (1);
+        }
+    }
+    if (settings.rate <= 0 || settings.runTime <= settings.settleTime)
+    {
+        printf("run time must be longer than the settle time\n");
+        return (1);
+    }
+
+    // grid in Kp, Kd, Ki, freq order, freq varying fastest
+    SweepBatch batch;
+    batch.settings = settings;
+    for (size_t a = 0; a < kp.size(); a++)
+    for (size_t b = 0; b < kd.size(); b++)
+    for (size_t c = 0; c < ki.size(); c++)
+    for (size_t d = 0; d < freq.size(); d++)
+    {
+        SweepPoint point;
+        memset(&point, 0, sizeof(point));
+        point.gains.Kp = kp[a];
+        point.gains.Kd = kd[b];
+        point.gains.Ki = ki[c];
+        point.freq = freq[d];
+        batch.points.push_back(point);
+    }
+
+    WorkStealingPool pool(numThreads);
+    fprintf(stderr, "sweep: %d points, %.1f s each at %.0f Hz, %d threads\n",
+            (int)batch.points.size(), settings.runTime, settings.rate, pool.getNumThreads());
+
+    long long start = servo_time_ns();
+    pool.run((int)batch.points.size(), sweep_job, &batch);
+    double wall = (servo_time_ns() - start) * 1e-9;
+
+    printf("%10s %10s %10s %8s %11s %13s %11s %7s\n",
+           "Kp", "Kd", "Ki", "freq", "rms_err_mm", "peak_force_N", "limit_hits", "stable");
+    for (size_t n = 0; n < batch.points.size(); n++)
+    {
+        const SweepPoint& p = batch.points[n];
+        printf("%10.3f %10.3f %10.3f %8.3f %11.4f %13.4f %11lld %7s\n",
+               p.gains.Kp, p.gains.Kd, p.gains.Ki, p.freq,
+               p.rmsError * 1000.0, p.peakForce, p.limitHits,
+               p.stable ? "yes" : (p.finite ? "no" : "nan"));
+    }
+
+    double simulated = settings.runTime * batch.points.size();
+    fprintf(stderr, "sweep: %.2f s wall, %.1f points/s, %.0fx real time, %lld steals\n",
+            wall, batch.points.size() / wall, simulated / wall, pool.getSteals());
+
+    return (0);
+}
@@ -0,0 +1,668 @@
+//===========================================================================
+/*
+    telemetry.cpp
+
+    Servo-loop telemetry rings and background writer.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "telemetry.h"
+#include "command_queue.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "chai3d.h"
+//---------------------------------------------------------------------------
+
+// a pending log switch; filled by the servo thread before the record that
+// refers to it is pushed, so the ring's release/acquire pair publishes it
+struct TelemetryLogRequest
+{
+    char         path[TELEMETRY_MAX_PATH];
+    BinLogHeader header;
+};
+
+// state of a channel's standby log writer, and who owns it
+const int STANDBY_EMPTY     = 0;    // rotator: closed, may prepare the next file
+const int STANDBY_READY     = 1;    // writer: open on standbyPath, may swap it in
+const int STANDBY_CLOSING   = 2;    // rotator: retired by a switch, to be closed
+
+struct TelemetryChannel
+{
+    SpscRing<TelemetryRecord, TELEMETRY_RING_SIZE> ring;
+
+    // written by the servo thread only, read by anyone
+    std::atomic<long long> dropped;
+
+    // samples seen by the writer, for the record file decimation
+    long long recordCount;
+
+    // binary logs: the writer thread appends to *active, *standby belongs
+    // to the thread named by standbyState
+    BinLogWriter logs[2];
+    BinLogWriter* active;
+    BinLogWriter* standby;
+    std::atomic<int> standbyState;
+    bool standbyDiscard;        // closing a file that was never switched to
+    char standbyPath[TELEMETRY_MAX_PATH];
+    char activePath[TELEMETRY_MAX_PATH];    // writer thread, "" if none
+
+    // two request slots used alternately by the servo thread
+    TelemetryLogRequest requests[2];
+    int nextRequest;
+
+    // next file to prepare, picked up by the rotator thread
+    TelemetryLogRequest prepare;
+    long long prepareRecords;
+    std::atomic<bool> preparePending;
+};
+
+// one ring per device
+static TelemetryChannel channels[TELEMETRY_MAX_CHANNELS];
+static int numTelemetryChannels = 0;
+
+// output
+static FILE* telemetryFile = NULL;
+static InputTraceWriter inputTrace = { NULL };
+static FILE* responseFile = NULL;
+static int telemetryRecordEvery = 1;
+static int telemetryConsoleEvery = 0;
+static bool telemetryLossless = false;
+static bool telemetryPacked = false;
+static BinLogPrecision telemetryPrecision;
+static long long telemetryConsoleCount = 0;
+
+// writer thread state
+static std::atomic<bool> writerRunning(false);
+static std::atomic<bool> writerFinished(true);
+
+// rotator thread state
+static std::atomic<bool> rotatorRunning(false);
+static std::atomic<bool> rotatorFinished(true);
+
+// sequence number of the next record pushed (servo thread) and of the
+// next record to write (writer thread)
+static long long pushSeq = 0;
+static long long writeSeq = 0;
+
+// records written before the stop flag is checked again
+static const int WRITER_BATCH = 256;
+
+//---------------------------------------------------------------------------
+
+static void telemetry_write_sample(TelemetryChannel& channel, const TelemetryRecord& r)
+{
+    if (!binlog_is_open(channel.active)) return;
+
+    const int* axisMap = channel.active->header.axisMap;
+    BinLogSample sample;
+    sample.tick = r.tick;
+    sample.time = r.time;
+    for (int k = 0; k < 3; k++)
+    {
+        sample.pos[k]      = (float)r.sample.pos[k];
+        sample.vel[k]      = (float)r.sample.vel[k];
+        sample.force[k]    = (float)r.sample.force[axisMap[k]];
+        sample.errorPos[k] = (float)r.sample.errorPos[k];
+    }
+    binlog_append(channel.active, sample);
+}
+
+//---------------------------------------------------------------------------
+
+static const BinLogPrecision* log_packing()
+{
+    return telemetryPacked ? &telemetryPrecision : NULL;
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_switch_log(TelemetryChannel& channel, const TelemetryRecord& r)
+{
+    const TelemetryLogRequest& request = channel.requests[r.aux];
+
+    while (true)
+    {
+        if (channel.standbyState.load(std::memory_order_acquire) == STANDBY_READY)
+        {
+            if (strcmp(channel.standbyPath, request.path) == 0)
+            {
+                // prepared in time: swap, the rotator closes the old file
+                BinLogWriter* previous = channel.active;
+                channel.active = channel.standby;
+                channel.standby = previous;
+                strcpy(channel.activePath, channel.standbyPath);
+
+                // header as of the switch (gains may have changed since the
+                // file was created); binlog_close() writes it again
+                binlog_update_header(channel.active, request.header);
+
+                channel.standbyDiscard = false;
+                channel.standbyState.store(binlog_is_open(previous) ? STANDBY_CLOSING : STANDBY_EMPTY,
+                                           std::memory_order_release);
+                return;
+            }
+
+            // prepared for another step; never remove the file being written
+            channel.standbyDiscard = (strcmp(channel.standbyPath, channel.activePath) != 0);
+            channel.standbyState.store(STANDBY_CLOSING, std::memory_order_release);
+        }
+
+#if defined(TELEMETRY_RACE_CHECK)
+        telemetry_race_point(TELEMETRY_RACE_WRITER_WAIT, r.device);
+#endif
+
+        // the rotator may be creating this very file: wait for it rather
+        // than open the path a second time. It publishes READY before it
+        // clears the flag, so a preparation that finished since the state
+        // was read above is seen on the next pass and swapped in
+        if (!channel.preparePending.load(std::memory_order_acquire))
+        {
+            if (channel.standbyState.load(std::memory_order_acquire) != STANDBY_READY) break;
+            continue;
+        }
+        cSleepMs(1);
+    }
+
+    printf("Log file not prepared in time, opening it now: %s\n", request.path);
+    binlog_close(channel.active);
+    channel.activePath[0] = 0;
+    if (binlog_open(channel.active, request.path, request.header, log_packing()))
+    {
+        strcpy(channel.activePath, request.path);
+    }
+    else
+    {
+        printf("Could not open log file: %s\n", request.path);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// rotator thread: close the standby file, removing it if it was never used
+static void telemetry_close_standby(TelemetryChannel& channel)
+{
+    binlog_close(channel.standby);
+    if (channel.standbyDiscard)
+    {
+        remove(channel.standbyPath);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_rotator_loop(void)
+{
+    while (true)
+    {
+        bool running = rotatorRunning.load();
+
+        int done = 0;
+        for (int c = 0; c < numTelemetryChannels; c++)
+        {
+            TelemetryChannel& channel = channels[c];
+            int state = channel.standbyState.load(std::memory_order_acquire);
+            if (state == STANDBY_CLOSING)
+            {
+                telemetry_close_standby(channel);
+                channel.standbyState.store(STANDBY_EMPTY, std::memory_order_release);
+                state = STANDBY_EMPTY;
+                done++;
+            }
+            if (state == STANDBY_EMPTY && channel.preparePending.load(std::memory_order_acquire))
+            {
+                TelemetryLogRequest& request = channel.prepare;
+#if defined(TELEMETRY_RACE_CHECK)
+                telemetry_race_point(TELEMETRY_RACE_ROTATOR_OPEN, c);
+#endif
+                if (binlog_open(channel.standby, request.path, request.header, log_packing()))
+                {
+                    binlog_reserve(channel.standby, (uint64_t)channel.prepareRecords);
+                    strcpy(channel.standbyPath, request.path);
+                    channel.standbyState.store(STANDBY_READY, std::memory_order_release);
+                }
+                else
+                {
+                    printf("Could not open log file: %s\n", request.path);
+                }
+                channel.preparePending.store(false, std::memory_order_release);
+#if defined(TELEMETRY_RACE_CHECK)
+                telemetry_race_point(TELEMETRY_RACE_ROTATOR_DONE, c);
+#endif
+                done++;
+            }
+        }
+
+        if (done == 0)
+        {
+            if (!running) break;
+            cSleepMs(1);
+        }
+    }
+
+    // the writer has stopped: a prepared file will not be switched to
+    for (int c = 0; c < numTelemetryChannels; c++)
+    {
+        TelemetryChannel& channel = channels[c];
+        if (channel.standbyState.load(std::memory_order_acquire) == STANDBY_READY)
+        {
+            channel.standbyDiscard = (strcmp(channel.standbyPath, channel.activePath) != 0);
+            telemetry_close_standby(channel);
+        }
+        channel.standbyState.store(STANDBY_EMPTY, std::memory_order_release);
+    }
+    rotatorFinished = true;
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_format(const TelemetryRecord& r)
+{
+    const TelemetrySample& s = r.sample;
+    double errorPos = sqrt(s.errorPos[0]*s.errorPos[0] + s.errorPos[1]*s.errorPos[1] + s.errorPos[2]*s.errorPos[2]);
+    double errorVel = sqrt(s.errorVel[0]*s.errorVel[0] + s.errorVel[1]*s.errorVel[1] + s.errorVel[2]*s.errorVel[2]);
+
+    if (telemetryFile != NULL && (channels[r.device].recordCount++ % telemetryRecordEvery) == 0)
+    {
+        fprintf(telemetryFile, "%d\t%lld\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n",
+                r.device, r.tick, r.time,
+                s.pos[0], s.pos[1], s.pos[2],
+                s.vel[0], s.vel[1], s.vel[2],
+                s.force[0], s.force[1], s.force[2],
+                errorPos, errorVel);
+    }
+
+    if (telemetryConsoleEvery > 0 && (telemetryConsoleCount++ % telemetryConsoleEvery) == 0)
+    {
+        printf("pos %d %lf %lf %lf %lf %lf\n", r.device, s.pos[0], s.pos[1], s.pos[2], errorPos, errorVel);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_write_input(const TelemetryRecord& r)
+{
+    if (inputTrace.file == NULL) return;
+
+    InputEvent event;
+    event.tick = r.tick;
+    event.time = r.time;
+    if (r.kind == TELEMETRY_PARAM)
+    {
+        event.kind = INPUT_PARAM;
+        event.index = r.aux;
+        event.value[0] = r.param.newValue;
+    }
+    else
+    {
+        event.kind = r.aux;
+        event.index = r.device;
+        for (int k = 0; k < 3; k++)
+        {
+            event.value[k] = r.sample.pos[k];
+        }
+    }
+    input_trace_write(&inputTrace, event);
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_format_param(const TelemetryRecord& r)
+{
+    const char* name = command_param_name(r.aux);
+    if (telemetryFile != NULL)
+    {
+        fprintf(telemetryFile, "# param\t%lld\t%lf\t%s\t%lf\t%lf\n",
+                r.tick, r.time, name, r.param.oldValue, r.param.newValue);
+    }
+    printf("tick %lld (%.3f s): %s %g -> %g\n", r.tick, r.time, name, r.param.oldValue, r.param.newValue);
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_format_response(const TelemetryRecord& r)
+{
+    static const double deg = 180.0 / 3.141592653589793;
+
+    const TelemetryResponse& e = r.response;
+    if (responseFile != NULL)
+    {
+        fprintf(responseFile, "%d\t%lf\t%d\t%.2f", r.aux, e.freq, r.device, e.periods);
+        for (int k = 0; k < 3; k++) fprintf(responseFile, "\t%lf", e.posAmp[k] * 1000.0);
+        for (int k = 0; k < 3; k++) fprintf(responseFile, "\t%.2f", e.posPhase[k] * deg);
+        for (int k = 0; k < 3; k++) fprintf(responseFile, "\t%lf", e.forceAmp[k]);
+        for (int k = 0; k < 3; k++) fprintf(responseFile, "\t%.2f", e.forcePhase[k] * deg);
+        fprintf(responseFile, "\n");
+    }
+
+    // the axis that moved most
+    int a = 0;
+    for (int k = 1; k < 3; k++)
+    {
+        if (e.posAmp[k] > e.posAmp[a]) a = k;
+    }
+    printf("response #%d at %.2f Hz: %c %.3f mm %.1f deg, force %.4f N %.1f deg\n",
+           r.device, e.freq, "xyz"[a], e.posAmp[a] * 1000.0, e.posPhase[a] * deg,
+           e.forceAmp[a], e.forcePhase[a] * deg);
+}
+
+//---------------------------------------------------------------------------
+
+static void telemetry_writer_loop(void)
+{
+    while (true)
+    {
+        // read the flag before draining so that records pushed before
+        // telemetry_stop() are always written
+        bool running = writerRunning.load();
+
+        // take records in push order: the next one is at the front of
+        // exactly one ring once it has been pushed
+        int written = 0;
+        while (written < WRITER_BATCH)
+        {
+            int c = 0;
+            while (c < numTelemetryChannels)
+            {
+                const TelemetryRecord* front = channels[c].ring.front();
+                if (front != NULL && front->seq == writeSeq) break;
+                c++;
+            }
+            if (c == numTelemetryChannels) break;
+
+            TelemetryRecord record;
+            channels[c].ring.pop(record);
+            writeSeq++;
+
+            if (record.kind == TELEMETRY_OPEN_LOG)
+            {
+                telemetry_switch_log(channels[c], record);
+            }
+            else if (record.kind == TELEMETRY_PARAM)
+            {
+                telemetry_format_param(record);
+                telemetry_write_input(record);
+            }
+            else if (record.kind == TELEMETRY_INPUT)
+            {
+                telemetry_write_input(record);
+            }
+            else if (record.kind == TELEMETRY_RESPONSE)
+            {
+                telemetry_format_response(record);
+            }
+            else
+            {
+                telemetry_write_sample(channels[c], record);
+                telemetry_format(record);
+            }
+            written++;
+        }
+
+        if (written == 0)
+        {
+            if (!running) break;
+            cSleepMs(1);
+        }
+    }
+
+    if (telemetryFile != NULL) { fflush(telemetryFile); }
+    if (responseFile != NULL) { fflush(responseFile); }
+    input_trace_close(&inputTrace);
+    for (int c = 0; c < numTelemetryChannels; c++)
+    {
+        binlog_close(channels[c].active);
+    }
+    writerFinished = true;
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_start(const char* filename, int numChannels, int recordEvery, int consoleEvery,
+                     bool lossless, const BinLogPrecision* packing)
+{
+    numTelemetryChannels = cMin(numChannels, TELEMETRY_MAX_CHANNELS);
+    telemetryRecordEvery = (recordEvery > 1) ? recordEvery : 1;
+    telemetryConsoleEvery = consoleEvery;
+    telemetryLossless = lossless;
+    telemetryPacked = (packing != NULL);
+    if (packing != NULL) telemetryPrecision = *packing;
+    telemetryConsoleCount = 0;
+    pushSeq = 0;
+    writeSeq = 0;
+    for (int c = 0; c < TELEMETRY_MAX_CHANNELS; c++)
+    {
+        channels[c].dropped = 0;
+        channels[c].recordCount = 0;
+        channels[c].logs[0].file = NULL;
+        channels[c].logs[1].file = NULL;
+        channels[c].active = &channels[c].logs[0];
+        channels[c].standby = &channels[c].logs[1];
+        channels[c].standbyState = STANDBY_EMPTY;
+        channels[c].standbyDiscard = false;
+        channels[c].activePath[0] = 0;
+        channels[c].nextRequest = 0;
+        channels[c].preparePending = false;
+    }
+
+    telemetryFile = NULL;
+    if (filename != NULL)
+    {
+        telemetryFile = fopen(filename, "w");
+        if (telemetryFile == NULL)
+        {
+            printf("Could not open telemetry file: %s\n", filename);
+            return (false);
+        }
+
+        // large stdio buffer, the writer thread is the only user
+        setvbuf(telemetryFile, NULL, _IOFBF, 1 << 20);
+    }
+
+    writerRunning = true;
+    writerFinished = false;
+    cThread* writerThread = new cThread();
+    writerThread->set(telemetry_writer_loop, CHAI_THREAD_PRIORITY_GRAPHICS);
+
+    rotatorRunning = true;
+    rotatorFinished = false;
+    cThread* rotatorThread = new cThread();
+    rotatorThread->set(telemetry_rotator_loop, CHAI_THREAD_PRIORITY_GRAPHICS);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_push(const TelemetryRecord& record)
+{
+    TelemetryChannel& channel = channels[record.device];
+
+    // a dropped record does not use up a sequence number
+    TelemetryRecord queued = record;
+    queued.seq = pushSeq;
+    while (!channel.ring.push(queued))
+    {
+        // give the writer time to catch up
+        if (telemetryLossless)
+        {
+            cSleepMs(1);
+            continue;
+        }
+
+        channel.dropped.store(channel.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return (false);
+    }
+    pushSeq++;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_open_log(int device, long long tick, const char* path, const BinLogHeader& header)
+{
+    TelemetryChannel& channel = channels[device];
+
+    // the writer has long consumed the other slot: switches are at least
+    // one sweep step apart
+    int slot = channel.nextRequest;
+    channel.nextRequest = 1 - slot;
+    strncpy(channel.requests[slot].path, path, TELEMETRY_MAX_PATH - 1);
+    channel.requests[slot].path[TELEMETRY_MAX_PATH - 1] = 0;
+    channel.requests[slot].header = header;
+
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind   = TELEMETRY_OPEN_LOG;
+    record.device = device;
+    record.aux    = slot;
+    record.tick   = tick;
+    return telemetry_push(record);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_prepare_log(int device, const char* path, const BinLogHeader& header, long long records)
+{
+    TelemetryChannel& channel = channels[device];
+    if (channel.preparePending.load(std::memory_order_acquire)) return (false);
+
+    strncpy(channel.prepare.path, path, TELEMETRY_MAX_PATH - 1);
+    channel.prepare.path[TELEMETRY_MAX_PATH - 1] = 0;
+    channel.prepare.header = header;
+    channel.prepareRecords = records;
+    channel.preparePending.store(true, std::memory_order_release);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void telemetry_wait_prepared()
+{
+    for (int c = 0; c < numTelemetryChannels; c++)
+    {
+        while (channels[c].preparePending.load(std::memory_order_acquire)) { cSleepMs(1); }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_param(long long tick, double time, int param, double oldValue, double newValue)
+{
+    // any ring will do, the sequence number orders it with the samples
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind   = TELEMETRY_PARAM;
+    record.device = 0;
+    record.aux    = param;
+    record.tick   = tick;
+    record.time   = time;
+    record.param.oldValue = oldValue;
+    record.param.newValue = newValue;
+    return telemetry_push(record);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_start_trace(const char* path, const InputTraceHeader& header)
+{
+    // the writer only touches the trace for records pushed after this
+    return input_trace_create(&inputTrace, path, header);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_input(int device, long long tick, double time, const double position[3])
+{
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind   = TELEMETRY_INPUT;
+    record.device = device;
+    record.aux    = INPUT_POSITION;
+    record.tick   = tick;
+    record.time   = time;
+    for (int k = 0; k < 3; k++)
+    {
+        record.sample.pos[k] = position[k];
+    }
+    return telemetry_push(record);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_input_step(long long tick, double time)
+{
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind   = TELEMETRY_INPUT;
+    record.device = 0;
+    record.aux    = INPUT_STEP_END;
+    record.tick   = tick;
+    record.time   = time;
+    return telemetry_push(record);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_start_response(const char* path)
+{
+    responseFile = fopen(path, "w");
+    if (responseFile == NULL) return (false);
+
+    fprintf(responseFile, "# step\tfreq_Hz\tdevice\tperiods"
+                          "\tx_amp_mm\ty_amp_mm\tz_amp_mm\tx_phase_deg\ty_phase_deg\tz_phase_deg"
+                          "\tfx_amp_N\tfy_amp_N\tfz_amp_N\tfx_phase_deg\tfy_phase_deg\tfz_phase_deg\n");
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool telemetry_response(int device, long long tick, double time, int step,
+                        const FreqResponseEstimate& estimate)
+{
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind   = TELEMETRY_RESPONSE;
+    record.device = device;
+    record.aux    = step;
+    record.tick   = tick;
+    record.time   = time;
+    record.response.freq    = estimate.freq;
+    record.response.periods = estimate.periods;
+    for (int k = 0; k < 3; k++)
+    {
+        record.response.posAmp[k]     = estimate.posAmp[k];
+        record.response.posPhase[k]   = estimate.posPhase[k];
+        record.response.forceAmp[k]   = estimate.forceAmp[k];
+        record.response.forcePhase[k] = estimate.forcePhase[k];
+    }
+    return telemetry_push(record);
+}
+
+//---------------------------------------------------------------------------
+
+void telemetry_stop()
+{
+    writerRunning = false;
+    while (!writerFinished) { cSleepMs(1); }
+    rotatorRunning = false;
+    while (!rotatorFinished) { cSleepMs(1); }
+
+    if (telemetryFile != NULL)
+    {
+        fclose(telemetryFile);
+        telemetryFile = NULL;
+    }
+    if (responseFile != NULL)
+    {
+        fclose(responseFile);
+        responseFile = NULL;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+long long telemetry_dropped(int channel)
+{
+    return channels[channel].dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,186 @@
+//===========================================================================
+/*
+    telemetry.h
+
+    Servo-loop telemetry. The haptic thread pushes one fixed-size record
+    per device and tick into a per-device SPSC ring; a background writer
+    thread drains the rings and does all console and file formatting, so
+    the servo loop never blocks on I/O. When a ring is full the record is
+    dropped and counted.
+
+    Requests to switch a device's binary log travel through the same ring
+    as the samples, so the switch happens exactly between two ticks. Each
+    channel has two log writers: a rotator thread creates and pre-allocates
+    the next file ahead of time (telemetry_prepare_log()), the switch itself
+    swaps the two, and the rotator closes the previous file afterwards, so
+    the writer never stops draining the rings for file creation or close.
+    A switch to a file that was not prepared in time opens it in place,
+    after waiting for a preparation still under way, so a file is never
+    opened twice.
+    Parameter changes are queued the same way and written to the record
+    file and the console as "#" lines with the tick they took effect on.
+
+    With an input trace open (telemetry_start_trace()), the raw position
+    reads, the parameter changes and the ends of the sweep steps are also
+    written to it, see input_trace.h. The frequency response of a device
+    at the end of each sweep step (telemetry_response()) goes to the
+    response file, one line per device and step.
+
+    Every queued record gets the next number of a single sequence, and the
+    writer handles records strictly in that order across all rings, so the
+    text output is the same from run to run.
+*/
+//===========================================================================
+#pragma once
+
+#include "spsc_ring.h"
+#include "binlog.h"
+#include "input_trace.h"
+#include "freq_response.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// maximum number of devices (one ring each)
+const int TELEMETRY_MAX_CHANNELS    = 8;
+
+// records per ring, about one second of data at 4 kHz
+const unsigned TELEMETRY_RING_SIZE  = 4096;
+
+// record kinds
+const int TELEMETRY_SAMPLE          = 0;
+const int TELEMETRY_OPEN_LOG        = 1;    // switch the device's binary log file
+const int TELEMETRY_PARAM           = 2;    // parameter change, aux = parameter
+const int TELEMETRY_INPUT           = 3;    // input trace event, aux = INPUT_POSITION
+                                            // (sample.pos = raw position) or INPUT_STEP_END
+const int TELEMETRY_RESPONSE        = 4;    // frequency response of a step, aux = step
+
+// maximum length of a log file path
+const int TELEMETRY_MAX_PATH        = 260;
+
+#if defined(TELEMETRY_RACE_CHECK)
+// points of a log switch at which a race check build (telemetry_check.cpp)
+// calls telemetry_race_point()
+const int TELEMETRY_RACE_ROTATOR_OPEN   = 0;    // rotator, before it creates a prepared file
+const int TELEMETRY_RACE_ROTATOR_DONE   = 1;    // rotator, after it cleared preparePending
+const int TELEMETRY_RACE_WRITER_WAIT    = 2;    // writer, between its standby and pending reads
+#endif
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+// TELEMETRY_SAMPLE
+struct TelemetrySample
+{
+    double    pos[3];       // device position [m]
+    double    vel[3];       // device velocity [m/s]
+    double    errorPos[3];  // position error to the coupled device [m]
+    double    errorVel[3];  // velocity error to the coupled device [m/s]
+    double    force[3];     // commanded force, HDAL axis order [N]
+};
+
+// TELEMETRY_PARAM
+struct TelemetryParam
+{
+    double    oldValue;
+    double    newValue;
+};
+
+// TELEMETRY_RESPONSE, as in FreqResponseEstimate
+struct TelemetryResponse
+{
+    double    freq;             // [Hz]
+    double    periods;          // of the sweep frequency in the step
+    double    posAmp[3];        // [m]
+    double    posPhase[3];      // [rad]
+    double    forceAmp[3];      // [N]
+    double    forcePhase[3];    // [rad]
+};
+
+struct TelemetryRecord
+{
+    int       kind;
+    int       device;
+    int       aux;          // kind specific
+    long long seq;          // push order across all channels, set by telemetry_push()
+    long long tick;
+    double    time;         // servo time [s]
+
+    // by kind
+    union
+    {
+        TelemetrySample   sample;
+        TelemetryParam    param;
+        TelemetryResponse response;
+    };
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// open the record file and start the writer thread; every recordEvery-th
+// sample of a device goes to the record file (1 = all of them) and every
+// consoleEvery-th sample is also echoed to stdout (0 = no console output).
+// In lossless mode (virtual time runs) a full ring makes the producer
+// wait instead of dropping, so the output is complete and reproducible.
+// With "packing" the binary logs are compressed at that precision
+// (binlog_codec.h).
+bool telemetry_start(const char* filename, int numChannels, int recordEvery, int consoleEvery,
+                     bool lossless, const BinLogPrecision* packing);
+
+// servo thread: queue a record, returns false if dropped; never blocks
+// unless the telemetry was started lossless
+bool telemetry_push(const TelemetryRecord& record);
+
+// servo thread: from this tick on, write the device's samples to a new
+// binary log (the previous one is closed by the writer thread)
+bool telemetry_open_log(int device, long long tick, const char* path, const BinLogHeader& header);
+
+// create the device's next binary log in the background, sized for about
+// "records" samples, so that the telemetry_open_log() switch to the same
+// path is a pointer swap; never blocks. Returns false if the previous
+// request has not been picked up yet.
+bool telemetry_prepare_log(int device, const char* path, const BinLogHeader& header, long long records);
+
+// not from the servo thread: wait until the rotator has handled every
+// telemetry_prepare_log() request
+void telemetry_wait_prepared();
+
+// servo thread: a parameter (see command_queue.h) changed at this tick
+bool telemetry_param(long long tick, double time, int param, double oldValue, double newValue);
+
+// record the session's input to a trace from now on; before the servo
+// loop starts
+bool telemetry_start_trace(const char* path, const InputTraceHeader& header);
+
+// servo thread: raw position of a device as read at this tick, for the
+// input trace
+bool telemetry_input(int device, long long tick, double time, const double position[3]);
+
+// servo thread: the sweep step ended at this tick, for the input trace
+bool telemetry_input_step(long long tick, double time);
+
+// write the frequency response summaries to "path" from now on; before
+// the servo loop starts
+bool telemetry_start_response(const char* path);
+
+// servo thread: frequency response of a device over sweep step "step",
+// which ended at this tick
+bool telemetry_response(int device, long long tick, double time, int step,
+                        const FreqResponseEstimate& estimate);
+
+// drain all rings, stop the writer and rotator threads and close all files
+void telemetry_stop();
+
+// number of records dropped on a channel because its ring was full
+long long telemetry_dropped(int channel);
+
+#if defined(TELEMETRY_RACE_CHECK)
+// provided by the race check, called by the writer and rotator threads
+void telemetry_race_point(int point, int channel);
+#endif
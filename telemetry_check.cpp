@@ -0,0 +1,186 @@
+//===========================================================================
+/*
+    telemetry_check.cpp
+
+    Race check of the binary log switch. Built with TELEMETRY_RACE_CHECK
+    defined, the telemetry calls back at the points named in telemetry.h,
+    and this program holds the writer and rotator threads there so that
+    every switch runs in the order that once opened a file twice:
+
+        writer   reads standbyState: EMPTY (the rotator has not started)
+        rotator  creates the file, stores READY, clears preparePending
+        writer   reads preparePending: false
+
+    The writer must still swap the prepared file in rather than create
+    the same path a second time; a file opened twice comes out truncated
+    when the rotator closes its copy. Every step's log is read back and
+    must hold all of its samples, in order.
+
+    usage: telemetry_check [-steps <n>] [-samples <n>] [-dir <path>]
+
+        -steps      log switches to force (default 3)
+        -samples    samples per step (default 5000)
+        -dir        where to write the logs (default .)
+
+    Exit code 2 if a log is damaged or an interleaving was not reached.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "chai3d.h"
+#include "servo_timer.h"
+#include "telemetry.h"
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// longest a thread is held at a race point [ns]
+const long long CHECK_HOLD_NS = 2000000000LL;
+
+
+//---------------------------------------------------------------------------
+// RACE POINTS
+//---------------------------------------------------------------------------
+
+// switches the writer has reached, and preparations the rotator finished
+static std::atomic<int> writerWaits(0);
+static std::atomic<int> rotatorDone(0);
+
+// switches run in the order above
+static std::atomic<int> forced(0);
+
+// wait until "value" reaches "target", false after CHECK_HOLD_NS
+static bool hold(const std::atomic<int>& value, int target)
+{
+    long long end = servo_time_ns() + CHECK_HOLD_NS;
+    while (value.load() < target)
+    {
+        if (servo_time_ns() > end) return (false);
+        cSleepMs(1);
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void telemetry_race_point(int point, int channel)
+{
+    if (point == TELEMETRY_RACE_ROTATOR_OPEN)
+    {
+        // not before the writer has looked at the standby state
+        hold(writerWaits, rotatorDone.load() + 1);
+    }
+    else if (point == TELEMETRY_RACE_ROTATOR_DONE)
+    {
+        rotatorDone++;
+    }
+    else if (point == TELEMETRY_RACE_WRITER_WAIT)
+    {
+        // and the writer reads preparePending only once the rotator is done
+        int step = ++writerWaits;
+        if (hold(rotatorDone, step)) forced++;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// CHECK
+//---------------------------------------------------------------------------
+
+// every sample of a step's log, in tick order
+static bool check_log(const char* path, long long firstTick, int samples)
+{
+    BinLogReader reader;
+    if (!binlog_open_read(&reader, path))
+    {
+        printf("FAIL: could not read %s\n", path);
+        return (false);
+    }
+
+    bool ok = (reader.numRecords == (uint64_t)samples);
+    for (uint64_t k = 0; ok && k < reader.numRecords; k++)
+    {
+        ok = (binlog_sample(&reader, k)->tick == firstTick + (long long)k);
+    }
+    printf("%-40s %8llu of %d samples  %s\n", path, (unsigned long long)reader.numRecords,
+           samples, ok ? "ok" : "DAMAGED");
+    binlog_close_read(&reader);
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int steps = 3;
+    int samples = 5000;
+    const char* dir = ".";
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-steps") == 0 && a+1 < argc)
+            steps = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-samples") == 0 && a+1 < argc)
+            samples = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-dir") == 0 && a+1 < argc)
+            dir = argv[++a];
+        else
+        {
+            printf("usage: telemetry_check [-steps <n>] [-samples <n>] [-dir <path>]\n");
+            return (1);
+        }
+    }
+    if (steps < 1) steps = 1;
+    if (samples < 1) samples = 1;
+
+    if (!telemetry_start(NULL, 1, 1, 0, true, NULL)) return (1);
+
+    // prepare and switch back to back, as a late sweep step does
+    static const int axisMap[3] = { 0, 1, 2 };
+    long long tick = 0;
+    for (int s = 0; s < steps; s++)
+    {
+        char path[TELEMETRY_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/telemetry_check_%d.bin", dir, s);
+        BinLogHeader header;
+        binlog_init_header(&header, "CHECK", s + 1.0, 0, 0, 0, SERVO_DEFAULT_RATE, axisMap);
+
+        telemetry_prepare_log(0, path, header, samples);
+        telemetry_open_log(0, tick, path, header);
+        for (int n = 0; n < samples; n++, tick++)
+        {
+            TelemetryRecord record;
+            memset(&record, 0, sizeof(record));
+            record.kind   = TELEMETRY_SAMPLE;
+            record.tick   = tick;
+            record.time   = tick / SERVO_DEFAULT_RATE;
+            record.sample.pos[0] = n * 1e-6;
+            telemetry_push(record);
+        }
+        telemetry_wait_prepared();
+    }
+    telemetry_stop();
+
+    bool failed = false;
+    for (int s = 0; s < steps; s++)
+    {
+        char path[TELEMETRY_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/telemetry_check_%d.bin", dir, s);
+        if (!check_log(path, (long long)s * samples, samples)) failed = true;
+        remove(path);
+    }
+
+    printf("switches forced into the race: %d of %d\n", forced.load(), steps);
+    if (forced.load() != steps)
+    {
+        printf("FAIL: interleaving not reached\n");
+        failed = true;
+    }
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,76 @@
+//===========================================================================
+/*
+    teleop.cpp
+
+    Bilateral coupling law of the master/slave pair.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "teleop.h"
+//---------------------------------------------------------------------------
+
+cVector3d teleop_app_position(const double positionServo[3])
+{
+    cVector3d position;
+    position.x = positionServo[2];
+    position.y = positionServo[0];
+    position.z = positionServo[1];
+    return position;
+}
+
+//---------------------------------------------------------------------------
+
+cVector3d teleop_velocity(const cVector3d& position, const cVector3d& lastPosition, double interval)
+{
+    cVector3d velocity;
+    position.subr(lastPosition, velocity);
+    if (interval > 0)
+        velocity.div(interval);
+    else
+        velocity.zero();
+    return velocity;
+}
+
+//---------------------------------------------------------------------------
+
+void teleop_centering_force(const TeleopGains& gains, const cVector3d& position,
+                            const cVector3d& velocity, double force[3])
+{
+    force[0] = -gains.Kp*position.y - 2*gains.Kd*velocity.y;
+    force[1] = -gains.Kp*position.z - 2*gains.Kd*velocity.z;
+    force[2] = -gains.Kp*position.x - 2*gains.Kd*velocity.x;
+}
+
+//---------------------------------------------------------------------------
+
+void teleop_coupling_force(const TeleopGains& gains,
+                           const cVector3d& position, const cVector3d& velocity,
+                           const cVector3d& otherPosition, const cVector3d& otherVelocity,
+                           cVector3d& integral, cVector3d& errorPosition,
+                           cVector3d& errorVelocity, double force[3])
+{
+    errorPosition = position - otherPosition;
+    errorVelocity = velocity - otherVelocity;
+    teleop_error_force(gains, errorPosition, errorVelocity, integral, force);
+}
+
+//---------------------------------------------------------------------------
+
+void teleop_error_force(const TeleopGains& gains, const cVector3d& errorPosition,
+                        const cVector3d& errorVelocity, cVector3d& integral, double force[3])
+{
+    integral += errorPosition;
+
+    force[0] = -gains.Kp*errorPosition.y - gains.Kd*errorVelocity.y - gains.Ki*integral.y;
+    force[1] = -gains.Kp*errorPosition.z - gains.Kd*errorVelocity.z - gains.Ki*integral.z;
+    force[2] = -gains.Kp*errorPosition.x - gains.Kd*errorVelocity.x - gains.Ki*integral.x;
+}
+
+//---------------------------------------------------------------------------
+
+bool teleop_should_apply(const cVector3d& errorPosition, const cVector3d& errorVelocity)
+{
+    return (errorPosition.length() > TELEOP_APPLY_ERROR_POS &&
+            errorVelocity.length() > TELEOP_APPLY_ERROR_VEL);
+}
@@ -0,0 +1,70 @@
+//===========================================================================
+/*
+    teleop.h
+
+    Bilateral coupling law of the master/slave pair. Each device is pulled
+    towards the other with a PID on the position difference; before the
+    start time both grips are only centered. updateHaptics() and the batch
+    sweep runner share this code, so a gain found in a sweep behaves the
+    same on the devices.
+
+    Positions and velocities are in the application frame (x = HDAL z,
+    y = HDAL x, z = HDAL y), forces are returned in HDAL order.
+*/
+//===========================================================================
+#pragma once
+
+#include "math/CVector3d.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// a coupling force is only commanded when both errors exceed these
+// thresholds, otherwise the previous force is held
+const double TELEOP_APPLY_ERROR_POS = 0.008;    // [m]
+const double TELEOP_APPLY_ERROR_VEL = 0.001;    // [m/s]
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct TeleopGains
+{
+    double Kp;      // [N/m]
+    double Kd;      // [N s/m]
+    double Ki;      // [N/m] per tick of accumulated error
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// HDAL tool position to the application frame
+cVector3d teleop_app_position(const double positionServo[3]);
+
+// finite-difference velocity since the previous sample, zero if no time passed
+cVector3d teleop_velocity(const cVector3d& position, const cVector3d& lastPosition, double interval);
+
+// centering force before the start time [HDAL order]
+void teleop_centering_force(const TeleopGains& gains, const cVector3d& position,
+                            const cVector3d& velocity, double force[3]);
+
+// coupling force towards the other device [HDAL order]; accumulates the
+// position error into "integral" and returns the errors used
+void teleop_coupling_force(const TeleopGains& gains,
+                           const cVector3d& position, const cVector3d& velocity,
+                           const cVector3d& otherPosition, const cVector3d& otherVelocity,
+                           cVector3d& integral, cVector3d& errorPosition,
+                           cVector3d& errorVelocity, double force[3]);
+
+// PID force on given errors [HDAL order]; accumulates the position error
+// into "integral" (the coupling of a device to several others, see
+// coupling.h)
+void teleop_error_force(const TeleopGains& gains, const cVector3d& errorPosition,
+                        const cVector3d& errorVelocity, cVector3d& integral, double force[3]);
+
+// true if the errors are large enough for the force to be commanded
+bool teleop_should_apply(const cVector3d& errorPosition, const cVector3d& errorVelocity);
@@ -0,0 +1,120 @@
+//===========================================================================
+/*
+    thread_pool.cpp
+
+    Work-stealing pool for batches of independent jobs.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "thread_pool.h"
+//---------------------------------------------------------------------------
+
+WorkStealingPool::WorkStealingPool(int numThreads)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = (int)std::thread::hardware_concurrency();
+    }
+    if (numThreads <= 0)
+    {
+        numThreads = 1;
+    }
+
+    m_numThreads = numThreads;
+    m_steals = 0;
+    for (int i = 0; i < m_numThreads; i++)
+    {
+        m_queues.push_back(new Queue());
+    }
+}
+
+//---------------------------------------------------------------------------
+
+WorkStealingPool::~WorkStealingPool()
+{
+    for (int i = 0; i < m_numThreads; i++)
+    {
+        delete m_queues[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void WorkStealingPool::run(int count, PoolJob job, void* arg)
+{
+    // deal the jobs out round robin, in order, so that neighbouring grid
+    // points (similar run times) end up on different workers
+    for (int n = 0; n < count; n++)
+    {
+        m_queues[n % m_numThreads]->jobs.push_back(n);
+    }
+    m_steals = 0;
+
+    // the calling thread is worker 0
+    std::vector<std::thread> threads;
+    for (int i = 1; i < m_numThreads; i++)
+    {
+        threads.push_back(std::thread(&WorkStealingPool::worker, this, i, job, arg));
+    }
+    worker(0, job, arg);
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void WorkStealingPool::worker(int self, PoolJob job, void* arg)
+{
+    long long steals = 0;
+    int index;
+    while (true)
+    {
+        if (!popOwn(self, index))
+        {
+            if (!steal(self, index))
+            {
+                // nothing left anywhere; jobs never create new jobs
+                break;
+            }
+            steals++;
+        }
+        job(index, arg);
+    }
+
+    std::lock_guard<std::mutex> guard(m_statsLock);
+    m_steals += steals;
+}
+
+//---------------------------------------------------------------------------
+
+bool WorkStealingPool::popOwn(int self, int& index)
+{
+    Queue* q = m_queues[self];
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (q->jobs.empty()) return (false);
+    index = q->jobs.back();
+    q->jobs.pop_back();
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool WorkStealingPool::steal(int self, int& index)
+{
+    for (int k = 1; k < m_numThreads; k++)
+    {
+        Queue* q = m_queues[(self + k) % m_numThreads];
+        std::lock_guard<std::mutex> guard(q->lock);
+        if (!q->jobs.empty())
+        {
+            index = q->jobs.front();
+            q->jobs.pop_front();
+            return (true);
+        }
+    }
+    return (false);
+}
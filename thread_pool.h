@@ -0,0 +1,57 @@
+//===========================================================================
+/*
+    thread_pool.h
+
+    Work-stealing pool for batches of independent jobs. The job indices
+    are dealt out to one queue per worker; a worker takes jobs from the
+    back of its own queue and, once that is empty, steals from the front
+    of the others, so long and short jobs even out across the cores.
+*/
+//===========================================================================
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+// a job, called once for every index of a batch
+typedef void (*PoolJob)(int index, void* arg);
+
+class WorkStealingPool
+{
+  public:
+
+    // 0 threads = one per hardware thread
+    WorkStealingPool(int numThreads = 0);
+    ~WorkStealingPool();
+
+    int getNumThreads() const { return m_numThreads; }
+
+    // run job(0 .. count-1, arg) on all workers and wait for the batch
+    void run(int count, PoolJob job, void* arg);
+
+    // jobs a worker of the last batch took from another worker's queue
+    long long getSteals() const { return m_steals; }
+
+  private:
+
+    struct Queue
+    {
+        std::mutex      lock;
+        std::deque<int> jobs;
+    };
+
+    void worker(int self, PoolJob job, void* arg);
+    bool popOwn(int self, int& index);
+    bool steal(int self, int& index);
+
+    int m_numThreads;
+    std::vector<Queue*> m_queues;
+    std::mutex m_statsLock;
+    long long m_steals;
+};
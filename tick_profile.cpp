@@ -0,0 +1,193 @@
+//===========================================================================
+/*
+    tick_profile.cpp
+
+    Per-phase latency histograms of the servo tick.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "tick_profile.h"
+#include "servo_timer.h"
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
+//---------------------------------------------------------------------------
+
+static const char* phaseNames[PHASE_COUNT] =
+{
+    "read", "velocity", "force", "log", "write", "publish"
+};
+
+//---------------------------------------------------------------------------
+
+// index of the highest set bit, v > 0
+static int high_bit(unsigned long long v)
+{
+#if defined(_WIN32)
+    unsigned long bit;
+    _BitScanReverse64(&bit, v);
+    return (int)bit;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+static int bucket_index(long long ns)
+{
+    if (ns < 0) ns = 0;
+    unsigned long long v = (unsigned long long)ns;
+    if (v < (unsigned long long)(2 * HIST_SUB_BUCKETS)) return (int)v;
+
+    int shift = high_bit(v) - HIST_SUB_BITS;
+    int index = (shift + 1) * HIST_SUB_BUCKETS + (int)(v >> shift) - HIST_SUB_BUCKETS;
+    return (index < HIST_BUCKETS) ? index : HIST_BUCKETS - 1;
+}
+
+//---------------------------------------------------------------------------
+
+// largest value that falls in a bucket
+static long long bucket_upper(int index)
+{
+    if (index < 2 * HIST_SUB_BUCKETS) return index;
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    long long sub = index % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+//---------------------------------------------------------------------------
+
+static void hist_clear(LatencyHistogram* hist)
+{
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        hist->counts[b].store(0, std::memory_order_relaxed);
+    }
+    hist->count.store(0, std::memory_order_relaxed);
+    hist->maxNs.store(0, std::memory_order_relaxed);
+}
+
+//---------------------------------------------------------------------------
+
+void profile_init(TickProfile* profile, int numDevices, double rate, bool countMissed)
+{
+    profile->numDevices = (numDevices < PROFILE_MAX_DEVICES) ? numDevices : PROFILE_MAX_DEVICES;
+    profile->periodNs = (long long)(1e9 / rate);
+    profile->countMissed = countMissed;
+    for (int d = 0; d < PROFILE_MAX_DEVICES; d++)
+    {
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            hist_clear(&profile->phases[d][p]);
+        }
+    }
+    hist_clear(&profile->tick);
+    profile->missed.store(0, std::memory_order_relaxed);
+}
+
+//---------------------------------------------------------------------------
+
+void hist_record(LatencyHistogram* hist, long long ns)
+{
+    // one writer: plain increments, no read-modify-write
+    std::atomic<uint32_t>& bucket = hist->counts[bucket_index(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    hist->count.store(hist->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > hist->maxNs.load(std::memory_order_relaxed))
+    {
+        hist->maxNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+long long hist_percentile(const LatencyHistogram* hist, double p)
+{
+    // the buckets are summed rather than trusting "count", which may be
+    // a few ticks ahead of them while the loop runs
+    long long total = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        total += hist->counts[b].load(std::memory_order_relaxed);
+    }
+    if (total == 0) return (0);
+
+    long long rank = (long long)(p * total + 0.5);
+    if (rank < 1) rank = 1;
+    long long seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += hist->counts[b].load(std::memory_order_relaxed);
+        if (seen >= rank) return bucket_upper(b);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+//---------------------------------------------------------------------------
+
+long long profile_mark(TickProfile* profile, int device, int phase, long long start)
+{
+    long long now = servo_time_ns();
+    hist_record(&profile->phases[device][phase], now - start);
+    return now;
+}
+
+//---------------------------------------------------------------------------
+
+void profile_tick(TickProfile* profile, long long lateness, long long work)
+{
+    hist_record(&profile->tick, work);
+    if (profile->countMissed && lateness + work > profile->periodNs)
+    {
+        profile->missed.store(profile->missed.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static void print_row(const char* device, const char* phase, const LatencyHistogram* hist, FILE* out)
+{
+    long long count = hist->count.load(std::memory_order_relaxed);
+    if (count == 0) return;
+    fprintf(out, "  %-4s %-9s %9.2f %9.2f %9.2f %9.2f %12lld\n", device, phase,
+            hist_percentile(hist, 0.50) / 1000.0,
+            hist_percentile(hist, 0.99) / 1000.0,
+            hist_percentile(hist, 0.999) / 1000.0,
+            hist->maxNs.load(std::memory_order_relaxed) / 1000.0,
+            count);
+}
+
+//---------------------------------------------------------------------------
+
+void profile_print(const TickProfile* profile, FILE* out)
+{
+    fprintf(out, "servo phases [us]:\n");
+    fprintf(out, "  %-4s %-9s %9s %9s %9s %9s %12s\n", "dev", "phase", "p50", "p99", "p99.9", "max", "count");
+    for (int d = 0; d < profile->numDevices; d++)
+    {
+        char device[12];
+        snprintf(device, sizeof(device), "#%d", d);
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            print_row(device, phaseNames[p], &profile->phases[d][p], out);
+        }
+    }
+    print_row("all", "tick", &profile->tick, out);
+
+    long long ticks = profile->tick.count.load(std::memory_order_relaxed);
+    if (profile->countMissed)
+        fprintf(out, "  missed deadlines: %lld of %lld ticks\n",
+                profile->missed.load(std::memory_order_relaxed), ticks);
+    else
+        fprintf(out, "  missed deadlines: not counted in virtual time\n");
+}
+
+//---------------------------------------------------------------------------
+
+const char* profile_phase_name(int phase)
+{
+    return (phase >= 0 && phase < PHASE_COUNT) ? phaseNames[phase] : "unknown";
+}
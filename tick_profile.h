@@ -0,0 +1,101 @@
+//===========================================================================
+/*
+    tick_profile.h
+
+    Always-on timing of the phases of a servo tick, per device, so that a
+    slow tick can be traced to the device read, the force computation,
+    the force write or the logging. Each phase is timed with
+    servo_time_ns() and counted into a histogram of fixed size:
+
+        HDR-style buckets: exact below 64 ns, then 32 buckets per power
+        of two, i.e. a resolution of 1/32 (about 3 %) of the value up to
+        2^36 ns (69 s); longer values land in the last bucket
+
+    A histogram is written by the servo thread only. Its counters are
+    relaxed atomics, so the graphics thread can print it at any time
+    without stopping the loop; a print taken while the loop runs may be
+    a tick behind in some buckets.
+*/
+//===========================================================================
+#pragma once
+
+#include <atomic>
+#include <stdio.h>
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// phases of a device's turn in updateHaptics()
+const int PHASE_READ                = 0;    // backend update and position read
+const int PHASE_VELOCITY            = 1;    // velocity estimate
+const int PHASE_FORCE               = 2;    // coupling, filter and gravity
+const int PHASE_LOG                 = 3;    // telemetry record
+const int PHASE_WRITE               = 4;    // force write to the device
+const int PHASE_PUBLISH             = 5;    // snapshot and link packet
+const int PHASE_COUNT               = 6;
+
+const int PROFILE_MAX_DEVICES       = 8;
+
+// bucket layout, see above
+const int HIST_SUB_BITS             = 5;
+const int HIST_SUB_BUCKETS          = 1 << HIST_SUB_BITS;
+const int HIST_MAX_BITS             = 36;
+const int HIST_BUCKETS              = (HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct LatencyHistogram
+{
+    std::atomic<uint32_t>  counts[HIST_BUCKETS];
+    std::atomic<long long> count;
+    std::atomic<long long> maxNs;
+};
+
+struct TickProfile
+{
+    int       numDevices;
+    long long periodNs;         // tick budget
+    bool      countMissed;      // false in virtual time, there are no deadlines
+
+    LatencyHistogram phases[PROFILE_MAX_DEVICES][PHASE_COUNT];
+
+    // wake-up to the end of the last device, all devices
+    LatencyHistogram tick;
+
+    // ticks that ended after the next deadline
+    std::atomic<long long> missed;
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// clear all histograms
+void profile_init(TickProfile* profile, int numDevices, double rate, bool countMissed);
+
+// servo thread: count "ns" into a histogram
+void hist_record(LatencyHistogram* hist, long long ns);
+
+// value [ns] below which a fraction "p" of the counts lie (upper edge of
+// its bucket), 0 if the histogram is empty
+long long hist_percentile(const LatencyHistogram* hist, double p);
+
+// servo thread: end of a phase that started at "start" [ns]; returns
+// the time now, the start of the next phase
+long long profile_mark(TickProfile* profile, int device, int phase, long long start);
+
+// servo thread: end of a tick that woke up "lateness" [ns] after its
+// deadline and worked for "work" [ns]
+void profile_tick(TickProfile* profile, long long lateness, long long work);
+
+// p50 / p99 / p99.9 / max of every phase and of the whole tick
+void profile_print(const TickProfile* profile, FILE* out);
+
+// phase name: "read", "velocity", "force", "log", "write", "publish"
+const char* profile_phase_name(int phase);
@@ -0,0 +1,426 @@
+//===========================================================================
+/*
+    transport.cpp
+
+    Device state exchange between the two sides of a session.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#endif
+#include "transport.h"
+#include "spsc_ring.h"
+#include "servo_timer.h"
+#include <new>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+// written last by side 0 once the segment is set up
+static const uint32_t SHM_READY = 0x4d485346;   // "FSHM"
+
+//---------------------------------------------------------------------------
+
+static void sleep_ms(int ms)
+{
+#if defined(_WIN32)
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+// running mean and maximum of a latency figure
+static void add_sample(double value, long long count, double& last, double& mean, double& max)
+{
+    last = value;
+    mean += (value - mean) / count;
+    if (value > max) max = value;
+}
+
+//---------------------------------------------------------------------------
+
+Transport::Transport()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_nextSeq = 1;
+    m_lastSeq = 0;
+    m_peerSentNs = 0;
+    m_peerRecvNs = 0;
+}
+
+//---------------------------------------------------------------------------
+
+bool Transport::send(TransportPacket& packet)
+{
+    long long now = servo_time_ns();
+    packet.seq = m_nextSeq++;
+    packet.sentNs = now;
+    packet.echoNs = m_peerSentNs;
+    packet.echoHoldNs = (m_peerSentNs != 0) ? now - m_peerRecvNs : 0;
+
+    if (!write(packet))
+    {
+        m_stats.sendFailures++;
+        return (false);
+    }
+    m_stats.sent++;
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+bool Transport::receive(TransportPacket& packet)
+{
+    // keep the newest packet of everything that arrived; UDP may deliver
+    // out of order, so newest means highest packet number
+    TransportPacket incoming;
+    bool found = false;
+    while (read(incoming))
+    {
+        if (incoming.seq <= m_lastSeq)
+        {
+            m_stats.skipped++;
+            continue;
+        }
+        if (found) m_stats.skipped++;
+        if (incoming.seq > m_lastSeq + 1 && m_lastSeq != 0)
+        {
+            m_stats.lost += (long long)(incoming.seq - m_lastSeq - 1);
+        }
+        m_lastSeq = incoming.seq;
+        packet = incoming;
+        found = true;
+    }
+    if (!found) return (false);
+
+    long long now = servo_time_ns();
+    m_peerSentNs = packet.sentNs;
+    m_peerRecvNs = now;
+    m_stats.received++;
+
+    add_sample((now - packet.sentNs) / 1000.0, m_stats.received,
+               m_stats.oneWayLast, m_stats.oneWayMean, m_stats.oneWayMax);
+
+    if (packet.echoNs != 0)
+    {
+        m_stats.rttCount++;
+        double rtt = (double)(now - packet.echoNs - packet.echoHoldNs);
+        add_sample(rtt / 2000.0, m_stats.rttCount,
+                   m_stats.halfRttLast, m_stats.halfRttMean, m_stats.halfRttMax);
+    }
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+void Transport::printStats(const TransportStats& s, FILE* out)
+{
+    fprintf(out, "link: one-way %.1f us (mean %.1f, max %.1f)  rtt/2 %.1f us (mean %.1f, max %.1f)"
+                 "  sent %lld  received %lld  skipped %lld  lost %lld  send failures %lld\n",
+            s.oneWayLast, s.oneWayMean, s.oneWayMax,
+            s.halfRttLast, s.halfRttMean, s.halfRttMax,
+            s.sent, s.received, s.skipped, s.lost, s.sendFailures);
+}
+
+//===========================================================================
+// SHARED MEMORY
+//===========================================================================
+
+struct ShmSegment
+{
+    std::atomic<uint32_t> ready;
+    int64_t               createdNs;    // servo_time_ns of side 0 at creation
+    SpscRing<TransportPacket, TRANSPORT_RING_SIZE> rings[2];   // rings[s] is written by side s
+};
+
+class ShmTransport : public Transport
+{
+  public:
+
+    ShmTransport() : m_segment(NULL), m_side(0), m_handle(NULL) { m_name[0] = 0; }
+    ~ShmTransport();
+
+    bool open(const char* name, int side);
+    const char* getName() { return "shared memory"; }
+
+  protected:
+
+    bool write(const TransportPacket& packet) { return m_segment->rings[m_side].push(packet); }
+    bool read(TransportPacket& packet) { return m_segment->rings[1 - m_side].pop(packet); }
+
+  private:
+
+    // create (side 0) or map (side 1) the segment, no waiting
+    void* map();
+    void  unmap();
+
+    ShmSegment* m_segment;
+    int         m_side;
+    void*       m_handle;       // mapping handle (Windows)
+    char        m_name[128];
+};
+
+//---------------------------------------------------------------------------
+
+void* ShmTransport::map()
+{
+    size_t size = sizeof(ShmSegment);
+
+#if defined(_WIN32)
+    HANDLE mapping = (m_side == 0)
+        ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, m_name)
+        : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name);
+    if (mapping == NULL) return (NULL);
+    void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (memory == NULL)
+    {
+        CloseHandle(mapping);
+        return (NULL);
+    }
+    m_handle = mapping;
+    return memory;
+#else
+    int fd;
+    if (m_side == 0)
+    {
+        // a segment left behind by a crashed run would hold stale packets
+        shm_unlink(m_name);
+        fd = shm_open(m_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, (off_t)size) != 0)
+        {
+            close(fd);
+            return (NULL);
+        }
+    }
+    else
+    {
+        // not sized yet when side 0 is half way through creating it
+        struct stat info;
+        fd = shm_open(m_name, O_RDWR, 0600);
+        if (fd >= 0 && (fstat(fd, &info) != 0 || (size_t)info.st_size < size))
+        {
+            close(fd);
+            return (NULL);
+        }
+    }
+    if (fd < 0) return (NULL);
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (memory == MAP_FAILED) ? NULL : memory;
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+void ShmTransport::unmap()
+{
+#if defined(_WIN32)
+    if (m_segment != NULL) UnmapViewOfFile(m_segment);
+    if (m_handle != NULL) CloseHandle((HANDLE)m_handle);
+    m_handle = NULL;
+#else
+    if (m_segment != NULL) munmap(m_segment, sizeof(ShmSegment));
+#endif
+    m_segment = NULL;
+}
+
+//---------------------------------------------------------------------------
+
+bool ShmTransport::open(const char* name, int side)
+{
+    m_side = side;
+#if defined(_WIN32)
+    snprintf(m_name, sizeof(m_name), "Local\\%s", name);
+#else
+    snprintf(m_name, sizeof(m_name), "/%s", name);
+#endif
+
+    if (side == 0)
+    {
+        void* memory = map();
+        if (memory == NULL) return (false);
+        m_segment = new (memory) ShmSegment();
+        m_segment->createdNs = servo_time_ns();
+        m_segment->ready.store(SHM_READY, std::memory_order_release);
+        return (true);
+    }
+
+    // side 1: wait for a segment that side 0 has set up recently; an older
+    // one is left over from a run that did not shut down, side 0 replaces
+    // it when it starts
+    long long timeout = (long long)(TRANSPORT_CONNECT_TIMEOUT * 1e9);
+    long long deadline = servo_time_ns() + timeout;
+    while (servo_time_ns() < deadline)
+    {
+        void* memory = map();
+        if (memory != NULL)
+        {
+            m_segment = (ShmSegment*)memory;
+            if (m_segment->ready.load(std::memory_order_acquire) == SHM_READY &&
+                servo_time_ns() - m_segment->createdNs < timeout)
+            {
+                return (true);
+            }
+            unmap();
+        }
+        sleep_ms(10);
+    }
+    return (false);
+}
+
+//---------------------------------------------------------------------------
+
+ShmTransport::~ShmTransport()
+{
+    unmap();
+#if !defined(_WIN32)
+    if (m_side == 0 && m_name[0] != 0) shm_unlink(m_name);
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+Transport* transport_create_shm(const char* name, int side)
+{
+    if (side != 0 && side != 1) return (NULL);
+    ShmTransport* transport = new ShmTransport();
+    if (!transport->open(name, side))
+    {
+        delete transport;
+        return (NULL);
+    }
+    return transport;
+}
+
+//===========================================================================
+// UDP
+//===========================================================================
+
+#if defined(_WIN32)
+typedef SOCKET socket_t;
+static const socket_t NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int socket_t;
+static const socket_t NO_SOCKET = -1;
+#endif
+
+class UdpTransport : public Transport
+{
+  public:
+
+    UdpTransport() : m_socket(NO_SOCKET) {}
+    ~UdpTransport();
+
+    bool open(int localPort, const char* host, int port);
+    const char* getName() { return "UDP"; }
+
+  protected:
+
+    bool write(const TransportPacket& packet);
+    bool read(TransportPacket& packet);
+
+  private:
+
+    socket_t           m_socket;
+    struct sockaddr_in m_remote;
+};
+
+//---------------------------------------------------------------------------
+
+bool UdpTransport::open(int localPort, const char* host, int port)
+{
+#if defined(_WIN32)
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return (false);
+#endif
+
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &found) != 0 || found == NULL) return (false);
+    m_remote = *(struct sockaddr_in*)found->ai_addr;
+    m_remote.sin_port = htons((unsigned short)port);
+    freeaddrinfo(found);
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket == NO_SOCKET) return (false);
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((unsigned short)localPort);
+    if (bind(m_socket, (struct sockaddr*)&local, sizeof(local)) != 0) return (false);
+
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    return ioctlsocket(m_socket, FIONBIO, &nonBlocking) == 0;
+#else
+    return fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL, 0) | O_NONBLOCK) == 0;
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+bool UdpTransport::write(const TransportPacket& packet)
+{
+    int n = (int)sendto(m_socket, (const char*)&packet, sizeof(packet), 0,
+                        (const struct sockaddr*)&m_remote, sizeof(m_remote));
+    return (n == (int)sizeof(packet));
+}
+
+//---------------------------------------------------------------------------
+
+bool UdpTransport::read(TransportPacket& packet)
+{
+    // skip anything that is not a packet of ours
+    while (true)
+    {
+        int n = (int)recv(m_socket, (char*)&packet, sizeof(packet), 0);
+        if (n < 0) return (false);
+        if (n == (int)sizeof(packet)) return (true);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+UdpTransport::~UdpTransport()
+{
+#if defined(_WIN32)
+    if (m_socket != NO_SOCKET) closesocket(m_socket);
+    WSACleanup();
+#else
+    if (m_socket != NO_SOCKET) close(m_socket);
+#endif
+}
+
+//---------------------------------------------------------------------------
+
+Transport* transport_create_udp(int localPort, const char* host, int port)
+{
+    UdpTransport* transport = new UdpTransport();
+    if (!transport->open(localPort, host, port))
+    {
+        delete transport;
+        return (NULL);
+    }
+    return transport;
+}
@@ -0,0 +1,135 @@
+//===========================================================================
+/*
+    transport.h
+
+    Device state exchange between the two sides of a session running in
+    separate processes (or machines). Each side sends the position and
+    velocity of its own device once per tick and reads the newest sample
+    of the other side; older samples still in flight are skipped, the
+    coupling only ever wants the latest one.
+
+        SHM     two single-producer / single-consumer rings in a shared
+                memory segment, one per direction; packets are written
+                into and read from the shared slots directly, without a
+                system call
+        UDP     one datagram per packet, non-blocking sockets; for
+                loopback or two machines on a dedicated link
+
+    Latency is measured on every packet received:
+
+        one-way     receive time - send time, on the shared monotonic
+                    clock; only meaningful when both sides run on the same
+                    machine
+        rtt / 2     each packet echoes the send time of the newest packet
+                    it has seen from the other side and how long it held
+                    it, so the round trip is known without synchronized
+                    clocks; half of it estimates the one-way delay between
+                    machines
+
+    Packets are raw little-endian structs; both sides must be built for the
+    same architecture.
+*/
+//===========================================================================
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// packets per ring of the shared-memory transport
+const unsigned TRANSPORT_RING_SIZE  = 256;
+
+// time the second side waits for the first to create the segment [s]
+const double TRANSPORT_CONNECT_TIMEOUT = 10.0;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+#pragma pack(push, 8)
+
+struct TransportPacket
+{
+    int32_t  device;            // sending device
+    int32_t  reserved;
+    uint64_t seq;               // packet number, set by send()
+    int64_t  tick;              // servo tick of the sample
+    int64_t  sentNs;            // send time (servo_time_ns), set by send()
+    int64_t  echoNs;            // sentNs of the newest packet received, 0 = none
+    int64_t  echoHoldNs;        // time from receiving that packet to sending this one
+    double   time;              // servo time of the sample [s]
+    double   pos[3];            // position [m], application frame
+    double   vel[3];            // velocity [m/s]
+};
+
+#pragma pack(pop)
+
+struct TransportStats
+{
+    long long sent;
+    long long received;         // newest packets taken by receive()
+    long long skipped;          // older packets dropped in favour of a newer one
+    long long lost;             // gaps in the packet numbers
+    long long sendFailures;     // ring full / socket error
+
+    // one-way delay on the shared clock [us]
+    double    oneWayLast, oneWayMean, oneWayMax;
+
+    // half round trip [us], 0 until the first echo arrives
+    double    halfRttLast, halfRttMean, halfRttMax;
+    long long rttCount;
+};
+
+//---------------------------------------------------------------------------
+
+class Transport
+{
+  public:
+
+    Transport();
+    virtual ~Transport() {}
+
+    virtual const char* getName() = 0;
+
+    // stamp and send one packet (seq, sentNs and the echo fields are set here)
+    bool send(TransportPacket& packet);
+
+    // newest packet received since the last call, false if none
+    bool receive(TransportPacket& packet);
+
+    const TransportStats& getStats() const { return m_stats; }
+
+    // one line of latency and loss figures
+    static void printStats(const TransportStats& stats, FILE* out);
+
+  protected:
+
+    // next packet in arrival order, false if none is waiting
+    virtual bool write(const TransportPacket& packet) = 0;
+    virtual bool read(TransportPacket& packet) = 0;
+
+  private:
+
+    TransportStats m_stats;
+    uint64_t       m_nextSeq;
+    uint64_t       m_lastSeq;       // newest packet number received
+    int64_t        m_peerSentNs;    // its send time, for the echo
+    int64_t        m_peerRecvNs;    // when it arrived
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// shared-memory transport "name"; side 0 creates the segment, side 1
+// waits for it. NULL on failure.
+Transport* transport_create_shm(const char* name, int side);
+
+// UDP transport receiving on localPort and sending to host:port.
+// NULL on failure.
+Transport* transport_create_udp(int localPort, const char* host, int port);
@@ -0,0 +1,213 @@
+//===========================================================================
+/*
+    velocity_estimator.cpp
+
+    Velocity of the grips from timestamped position samples.
+*/
+//===========================================================================
+
+//---------------------------------------------------------------------------
+#include "velocity_estimator.h"
+#include <math.h>
+#include <string.h>
+//---------------------------------------------------------------------------
+
+// Levant differentiator gains for an acceleration bound L
+static const double LEVANT_LAMBDA0 = 1.1;
+static const double LEVANT_LAMBDA1 = 1.5;
+
+// initial velocity uncertainty of the Kalman filter [m/s]
+static const double KALMAN_INITIAL_VEL = 1.0;
+
+//---------------------------------------------------------------------------
+
+bool velocity_init(VelocityEstimatorBank* bank, int type, int numDevices)
+{
+    memset(bank, 0, sizeof(VelocityEstimatorBank));
+    if (type < VELOCITY_DIFFERENCE || type > VELOCITY_LEVANT) return (false);
+    if (numDevices < 1 || numDevices > VELOCITY_MAX_DEVICES) return (false);
+
+    bank->type = type;
+    bank->numDevices = numDevices;
+    bank->noise = VELOCITY_DEFAULT_NOISE;
+    bank->accel = VELOCITY_DEFAULT_ACCEL;
+    bank->kalmanQ = VELOCITY_DEFAULT_KALMAN_Q;
+    velocity_reset(bank);
+    return (true);
+}
+
+//---------------------------------------------------------------------------
+
+// device at rest at "x" at "time"
+static void restart(VelocityEstimatorBank* bank, int dev, double time, const double x[3])
+{
+    bank->lastTime[dev] = time;
+    bank->head[dev] = 1;
+    bank->count[dev] = 1;
+    bank->histT[0][dev] = time;
+
+    for (int k = 0; k < 3; k++)
+    {
+        int ch = 3 * dev + k;
+        bank->lastPos[ch] = x[k];
+        bank->histX[0][ch] = x[k];
+        bank->kp[ch] = x[k];
+        bank->kv[ch] = 0;
+        bank->P00[ch] = bank->noise * bank->noise;
+        bank->P01[ch] = 0;
+        bank->P11[ch] = KALMAN_INITIAL_VEL * KALMAN_INITIAL_VEL;
+        bank->z0[ch] = x[k];
+        bank->z1[ch] = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void velocity_reset(VelocityEstimatorBank* bank)
+{
+    // all devices at rest at the origin at time zero, the same starting
+    // point as the plain difference in updateHaptics() always had
+    const double origin[3] = { 0, 0, 0 };
+    for (int dev = 0; dev < bank->numDevices; dev++)
+    {
+        restart(bank, dev, 0.0, origin);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// longest end-fit line through the newest sample that stays within the
+// noise bound of every sample it spans
+static double adaptive_window(const VelocityEstimatorBank* bank, int dev, int ch)
+{
+    const int W = VELOCITY_MAX_WINDOW;
+    int newest = (bank->head[dev] + W - 1) % W;
+    double tk = bank->histT[newest][dev];
+    double xk = bank->histX[newest][ch];
+
+    double slope = 0;
+    for (int n = 1; n < bank->count[dev]; n++)
+    {
+        int first = (newest + W - n) % W;
+        double dt = tk - bank->histT[first][dev];
+        if (dt <= 0) break;
+        double s = (xk - bank->histX[first][ch]) / dt;
+
+        bool fits = true;
+        for (int m = 1; m < n; m++)
+        {
+            int j = (newest + W - m) % W;
+            double line = xk + s * (bank->histT[j][dev] - tk);
+            if (fabs(bank->histX[j][ch] - line) > bank->noise)
+            {
+                fits = false;
+                break;
+            }
+        }
+        if (!fits) break;
+        slope = s;
+    }
+    return slope;
+}
+
+//---------------------------------------------------------------------------
+
+cVector3d velocity_estimate(VelocityEstimatorBank* bank, int dev, double time,
+                            const cVector3d& position)
+{
+    const double x[3] = { position.x, position.y, position.z };
+    double v[3] = { 0, 0, 0 };
+    double dt = time - bank->lastTime[dev];
+
+    // clock reset or stall: start again from rest
+    if (dt <= 0 || dt > VELOCITY_MAX_GAP)
+    {
+        restart(bank, dev, time, x);
+        return cVector3d(0, 0, 0);
+    }
+
+    // sample history of the adaptive window
+    const int W = VELOCITY_MAX_WINDOW;
+    int h = bank->head[dev];
+    bank->histT[h][dev] = time;
+    for (int k = 0; k < 3; k++)
+    {
+        bank->histX[h][3 * dev + k] = x[k];
+    }
+    bank->head[dev] = (h + 1) % W;
+    if (bank->count[dev] < W) bank->count[dev]++;
+
+    for (int k = 0; k < 3; k++)
+    {
+        int ch = 3 * dev + k;
+        switch (bank->type)
+        {
+            case VELOCITY_DIFFERENCE:
+                v[k] = (x[k] - bank->lastPos[ch]) / dt;
+                break;
+
+            case VELOCITY_ADAPTIVE:
+                v[k] = adaptive_window(bank, dev, ch);
+                break;
+
+            case VELOCITY_KALMAN:
+            {
+                // predict with the white-noise acceleration model
+                double q = bank->kalmanQ * dt;
+                double P00 = bank->P00[ch] + dt * (2.0 * bank->P01[ch] + dt * bank->P11[ch]) + q * dt * dt / 3.0;
+                double P01 = bank->P01[ch] + dt * bank->P11[ch] + q * dt / 2.0;
+                double P11 = bank->P11[ch] + q;
+                double p = bank->kp[ch] + bank->kv[ch] * dt;
+
+                // correct with the measured position
+                double S  = P00 + bank->noise * bank->noise;
+                double K0 = P00 / S;
+                double K1 = P01 / S;
+                double e  = x[k] - p;
+                bank->kp[ch]  = p + K0 * e;
+                bank->kv[ch] += K1 * e;
+                bank->P00[ch] = (1.0 - K0) * P00;
+                bank->P01[ch] = (1.0 - K0) * P01;
+                bank->P11[ch] = P11 - K1 * P01;
+                v[k] = bank->kv[ch];
+                break;
+            }
+
+            case VELOCITY_LEVANT:
+            {
+                double L = bank->accel;
+                double e = bank->z0[ch] - x[k];
+                double sign = (e > 0) ? 1.0 : ((e < 0) ? -1.0 : 0.0);
+                double u = bank->z1[ch] - LEVANT_LAMBDA1 * sqrt(L * fabs(e)) * sign;
+                bank->z0[ch] += u * dt;
+                bank->z1[ch] -= LEVANT_LAMBDA0 * L * sign * dt;
+                v[k] = bank->z1[ch];
+                break;
+            }
+        }
+        bank->lastPos[ch] = x[k];
+    }
+    bank->lastTime[dev] = time;
+
+    return cVector3d(v[0], v[1], v[2]);
+}
+
+//---------------------------------------------------------------------------
+
+static const char* velocityNames[] = { "diff", "foaw", "kalman", "levant" };
+
+int velocity_type(const char* name)
+{
+    for (int t = 0; t < 4; t++)
+    {
+        if (strcmp(name, velocityNames[t]) == 0) return t;
+    }
+    return (-1);
+}
+
+//---------------------------------------------------------------------------
+
+const char* velocity_name(int type)
+{
+    return (type >= 0 && type < 4) ? velocityNames[type] : "unknown";
+}
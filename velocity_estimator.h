@@ -0,0 +1,114 @@
+//===========================================================================
+/*
+    velocity_estimator.h
+
+    Velocity of the grips from timestamped position samples, per device
+    and axis (channel = device * 3 + axis). The raw finite difference of
+    two samples amplifies the encoder quantization by 1/dt; the other
+    estimators trade a little lag for much less noise, so the damping
+    term can run at higher gains without chatter.
+
+        VELOCITY_DIFFERENCE     (x[k] - x[k-1]) / (t[k] - t[k-1])
+        VELOCITY_ADAPTIVE       first-order adaptive windowing (FOAW, end
+                                fit): the longest window of up to
+                                VELOCITY_MAX_WINDOW samples whose straight
+                                line stays within the noise bound of every
+                                sample in it; long windows while moving
+                                steadily, short ones when the motion changes
+        VELOCITY_KALMAN         constant-velocity Kalman filter, white-noise
+                                acceleration model, exact per-sample dt
+        VELOCITY_LEVANT         first-order robust exact differentiator
+                                (Levant), bounded acceleration
+
+    Every estimator takes the time of each sample, so jittery ticks are
+    handled exactly. Nothing allocates after init. A sample that goes back
+    in time or comes after a long pause (the clock was reset between sweep
+    steps) restarts the channel at rest at its position.
+*/
+//===========================================================================
+#pragma once
+
+#include "math/CVector3d.h"
+
+//---------------------------------------------------------------------------
+// DECLARED CONSTANTS
+//---------------------------------------------------------------------------
+
+// estimator types
+const int VELOCITY_DIFFERENCE       = 0;
+const int VELOCITY_ADAPTIVE         = 1;
+const int VELOCITY_KALMAN           = 2;
+const int VELOCITY_LEVANT           = 3;
+
+const int VELOCITY_MAX_DEVICES      = 8;
+const int VELOCITY_MAX_CHANNELS     = 3 * VELOCITY_MAX_DEVICES;
+
+// longest adaptive window [samples]
+const int VELOCITY_MAX_WINDOW       = 16;
+
+// default position noise bound, about one encoder step at the grip [m]
+const double VELOCITY_DEFAULT_NOISE = 0.00005;
+
+// default acceleration bound of the Levant differentiator, enough for
+// a 2 cm motion at 8 Hz [m/s^2]
+const double VELOCITY_DEFAULT_ACCEL = 50.0;
+
+// default white-noise acceleration density of the Kalman filter [m^2/s^3]
+const double VELOCITY_DEFAULT_KALMAN_Q = 1.0;
+
+// gaps longer than this restart the estimators [s]
+const double VELOCITY_MAX_GAP       = 0.1;
+
+
+//---------------------------------------------------------------------------
+// DECLARED TYPES
+//---------------------------------------------------------------------------
+
+struct VelocityEstimatorBank
+{
+    int    type;
+    int    numDevices;
+    double noise;               // position noise bound / standard deviation [m]
+    double accel;               // Levant acceleration bound [m/s^2]
+    double kalmanQ;             // Kalman process noise density [m^2/s^3]
+
+    // per device: time of the last sample, ring position and fill
+    double lastTime[VELOCITY_MAX_DEVICES];
+    int    head[VELOCITY_MAX_DEVICES];
+    int    count[VELOCITY_MAX_DEVICES];
+    double histT[VELOCITY_MAX_WINDOW][VELOCITY_MAX_DEVICES];
+
+    // per channel
+    double lastPos[VELOCITY_MAX_CHANNELS];
+    double histX[VELOCITY_MAX_WINDOW][VELOCITY_MAX_CHANNELS];
+
+    // Kalman state and covariance
+    double kp[VELOCITY_MAX_CHANNELS];
+    double kv[VELOCITY_MAX_CHANNELS];
+    double P00[VELOCITY_MAX_CHANNELS];
+    double P01[VELOCITY_MAX_CHANNELS];
+    double P11[VELOCITY_MAX_CHANNELS];
+
+    // Levant differentiator state
+    double z0[VELOCITY_MAX_CHANNELS];
+    double z1[VELOCITY_MAX_CHANNELS];
+};
+
+
+//---------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//---------------------------------------------------------------------------
+
+// set up a bank with the default noise and acceleration bounds
+bool velocity_init(VelocityEstimatorBank* bank, int type, int numDevices);
+
+// restart all channels
+void velocity_reset(VelocityEstimatorBank* bank);
+
+// velocity of a device from its position at "time" [s]
+cVector3d velocity_estimate(VelocityEstimatorBank* bank, int device, double time,
+                            const cVector3d& position);
+
+// estimator type from / to its name: "diff", "foaw", "kalman", "levant"
+int velocity_type(const char* name);
+const char* velocity_name(int type);